@@ -0,0 +1,124 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * Find a good buffer size for a read(2)/write(2) loop while it runs,
+ * instead of compiling one in.
+ *
+ * We start out with the st_blksize of the file we read from, which is
+ * what the file system considers efficient, and then keep doubling the
+ * size, measuring how many bytes per second we move at each, until it
+ * stops getting faster, we reach the maximum, or we have spent
+ * BUFTUNE_LIMIT bytes on this.  From then on, we stick with the
+ * fastest size we saw.
+ *
+ * The loop does:
+ *
+ *	buftune_init(&bt, STDIN_FILENO, BUFTUNE_MAX);
+ *	buf = malloc(bt.max);
+ *	while ((n = read(STDIN_FILENO, buf, bt.size)) > 0) {
+ *		write(STDOUT_FILENO, buf, n);
+ *		buftune_update(&bt, n);
+ *	}
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <time.h>
+
+#include "buftune.h"
+
+/* Each size gets at least this many bytes, or four buffers' worth. */
+#define BUFTUNE_PROBE	(256 * 1024)
+
+/* Don't spend more than this on probing. */
+#define BUFTUNE_LIMIT	(16 * 1024 * 1024)
+
+/*
+ * A size has to be this much faster to count as better, and we give up
+ * after this many sizes in a row that were not.
+ */
+#define BUFTUNE_BETTER	1.05
+#define BUFTUNE_MISSES	2
+
+static double
+elapsed(const struct timespec *since) {
+	struct timespec now;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) +
+	    (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+void
+buftune_init(struct buftune *bt, int fd, size_t max) {
+	struct stat st;
+
+	bt->max = max;
+	bt->size = 4096;
+	if (fstat(fd, &st) == 0 && st.st_blksize > 0)
+		bt->size = st.st_blksize;
+	if (bt->size > max)
+		bt->size = max;
+	bt->best = bt->size;
+	bt->bestrate = 0;
+	bt->moved = 0;
+	bt->probed = 0;
+	bt->misses = 0;
+	bt->done = bt->size == max;
+	(void)clock_gettime(CLOCK_MONOTONIC, &bt->start);
+}
+
+/*
+ * Account for n bytes read and written at bt->size, and pick the size
+ * for the next read.
+ */
+void
+buftune_update(struct buftune *bt, size_t n) {
+	double rate, t;
+	size_t probe;
+
+	if (bt->done)
+		return;
+
+	bt->moved += n;
+	bt->probed += n;
+	probe = 4 * bt->size > BUFTUNE_PROBE ? 4 * bt->size : BUFTUNE_PROBE;
+	if (bt->moved < probe && bt->probed < BUFTUNE_LIMIT)
+		return;
+
+	if ((t = elapsed(&bt->start)) <= 0)
+		t = 1e-9;
+	rate = bt->moved / t;
+	if (rate > bt->bestrate * BUFTUNE_BETTER) {
+		bt->best = bt->size;
+		bt->bestrate = rate;
+		bt->misses = 0;
+	} else if (++bt->misses == BUFTUNE_MISSES) {
+		/* Bigger did not help; it is not going to get better. */
+		bt->done = 1;
+	}
+
+	if (bt->done || bt->size * 2 > bt->max ||
+	    bt->probed >= BUFTUNE_LIMIT) {
+		bt->size = bt->best;
+		bt->done = 1;
+		return;
+	}
+	bt->size *= 2;
+	bt->moved = 0;
+	(void)clock_gettime(CLOCK_MONOTONIC, &bt->start);
+}
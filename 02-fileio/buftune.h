@@ -0,0 +1,41 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+#ifndef _BUFTUNE_H_
+#define _BUFTUNE_H_
+
+#include <sys/types.h>
+
+#include <time.h>
+
+/* The largest buffer we try, unless told otherwise. */
+#define BUFTUNE_MAX	(1024 * 1024)
+
+struct buftune {
+	size_t		size;		/* what to read next */
+	size_t		max;		/* the largest size to try */
+	size_t		best;		/* the fastest size so far */
+	double		bestrate;	/* and its bytes per second */
+	size_t		moved;		/* bytes moved at this size */
+	size_t		probed;		/* bytes moved while probing */
+	struct timespec	start;		/* when we switched to this size */
+	int		misses;		/* sizes in a row that were no faster */
+	int		done;		/* settled on best */
+};
+
+void	buftune_init(struct buftune *, int, size_t);
+void	buftune_update(struct buftune *, size_t);
+
+#endif /* !_BUFTUNE_H_ */
@@ -0,0 +1,293 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * How fast does a read(2)/write(2) loop like the one in simple-cat.c
+ * copy, depending on the size of its buffer and on what it copies
+ * from and to?
+ *
+ * For each buffer size, this copies a file on a tmpfs to another one
+ * there, a file on disk to another one on disk, and the same amount of
+ * data through a pipe from a child process, and prints the throughput
+ * of each in MB/s.  The last row shows what buftune.c settles on, and
+ * how fast that is.
+ *
+ * Before each copy on disk, we ask the kernel to drop the source from
+ * the page cache, so that it is actually read from the disk; the
+ * copy itself only goes as far as the page cache.
+ *
+ * cc -Wall catbench.c buftune.c -o catbench
+ * ./catbench [-d diskdir] [-t tmpfsdir] [-r runs] [-s megabytes]
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buftune.h"
+
+#define NTARGETS	3
+
+static size_t sizes[] = {
+	512, 1024, 4096, 16384, 32768, 65536, 131072, 262144, 1048576,
+	4194304
+};
+#define NSIZES	(sizeof(sizes) / sizeof(sizes[0]))
+#define MAXSIZE	4194304
+
+static char *buf;
+static off_t total;
+
+static double copyfile(const char *, size_t, size_t *);
+static double copypipe(size_t, size_t *);
+static void fail(const char *);
+static void makefile(const char *);
+static double now(void);
+static void usage(void);
+
+int
+main(int argc, char **argv) {
+	const char *names[NTARGETS] = { "tmpfs", "disk", "pipe" };
+	const char *dirs[NTARGETS] = { "/dev/shm", "tmp", NULL };
+	char src[NTARGETS][BUFSIZ];
+	double rate, best;
+	size_t i, settled;
+	int ch, j, r, runs;
+	struct stat st;
+
+	runs = 3;
+	total = 64 * 1024 * 1024;
+	while ((ch = getopt(argc, argv, "d:r:s:t:")) != -1) {
+		switch (ch) {
+		case 'd':
+			dirs[1] = optarg;
+			break;
+		case 'r':
+			if ((runs = atoi(optarg)) < 1)
+				usage();
+			break;
+		case 's':
+			if ((total = atoi(optarg)) < 1)
+				usage();
+			total *= 1024 * 1024;
+			break;
+		case 't':
+			dirs[0] = optarg;
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	if ((buf = malloc(MAXSIZE)) == NULL)
+		fail("malloc");
+	memset(buf, 'x', MAXSIZE);
+
+	(void)mkdir(dirs[1], 0777);
+	for (j = 0; j < NTARGETS; j++) {
+		if (dirs[j] == NULL)
+			continue;
+		if (stat(dirs[j], &st) < 0 || !S_ISDIR(st.st_mode)) {
+			fprintf(stderr, "%s: not a directory, skipping %s\n",
+			    dirs[j], names[j]);
+			dirs[j] = NULL;
+			names[j] = NULL;
+			continue;
+		}
+		(void)snprintf(src[j], sizeof(src[j]), "%s/catbench.%ld",
+		    dirs[j], (long)getpid());
+		makefile(src[j]);
+	}
+
+	printf("%10s", "buffer");
+	for (j = 0; j < NTARGETS; j++)
+		if (names[j] != NULL)
+			printf(" %14s", names[j]);
+	printf("\n");
+
+	for (i = 0; i <= NSIZES; i++) {
+		if (i < NSIZES)
+			printf("%10zu", sizes[i]);
+		else
+			printf("%10s", "tuned");
+		for (j = 0; j < NTARGETS; j++) {
+			if (names[j] == NULL)
+				continue;
+			best = 0;
+			settled = 0;
+			for (r = 0; r < runs; r++) {
+				if (dirs[j] != NULL)
+					rate = copyfile(src[j],
+					    i < NSIZES ? sizes[i] : 0, &settled);
+				else
+					rate = copypipe(
+					    i < NSIZES ? sizes[i] : 0, &settled);
+				if (rate > best)
+					best = rate;
+			}
+			if (i < NSIZES)
+				printf(" %9.0f MB/s", best);
+			else
+				printf(" %6.0f@%-7zu", best, settled);
+		}
+		printf("\n");
+		(void)fflush(stdout);
+	}
+
+	for (j = 0; j < NTARGETS; j++)
+		if (dirs[j] != NULL)
+			(void)unlink(src[j]);
+	return(EXIT_SUCCESS);
+}
+
+/*
+ * Copy src to src.copy with a buffer of size bytes, or of the size
+ * buftune picks if size is 0, and return the MB/s.
+ */
+static double
+copyfile(const char *src, size_t size, size_t *settled) {
+	struct buftune bt;
+	char dst[BUFSIZ];
+	double start;
+	ssize_t n;
+	int in, out;
+
+	(void)snprintf(dst, sizeof(dst), "%s.copy", src);
+	if ((in = open(src, O_RDONLY)) < 0)
+		fail(src);
+	if ((out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		fail(dst);
+#ifdef POSIX_FADV_DONTNEED
+	(void)posix_fadvise(in, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+	if (size == 0)
+		buftune_init(&bt, in, BUFTUNE_MAX);
+	else {
+		bt.size = size;
+		bt.done = 1;
+	}
+	start = now();
+	while ((n = read(in, buf, bt.size)) > 0) {
+		if (write(out, buf, n) != n)
+			fail("write");
+		buftune_update(&bt, n);
+	}
+	if (n < 0)
+		fail("read");
+	start = now() - start;
+	*settled = bt.size;
+
+	(void)close(in);
+	(void)close(out);
+	(void)unlink(dst);
+	return (total / start / (1024 * 1024));
+}
+
+/*
+ * Have a child write total bytes into a pipe, size bytes at a time,
+ * or 64k at a time when we tune our reads, and return the MB/s.
+ */
+static double
+copypipe(size_t size, size_t *settled) {
+	struct buftune bt;
+	double start;
+	off_t left;
+	ssize_t n;
+	pid_t pid;
+	int fds[2];
+
+	if (pipe(fds) < 0)
+		fail("pipe");
+	start = now();
+	if ((pid = fork()) < 0)
+		fail("fork");
+	if (pid == 0) {
+		(void)close(fds[0]);
+		n = size ? size : 65536;
+		for (left = total; left > 0; left -= n)
+			if (write(fds[1], buf, left < n ? left : n) < 0)
+				_exit(EXIT_FAILURE);
+		_exit(EXIT_SUCCESS);
+	}
+	(void)close(fds[1]);
+
+	if (size == 0)
+		buftune_init(&bt, fds[0], BUFTUNE_MAX);
+	else {
+		bt.size = size;
+		bt.done = 1;
+	}
+	while ((n = read(fds[0], buf, bt.size)) > 0)
+		buftune_update(&bt, n);
+	if (n < 0)
+		fail("read");
+	(void)close(fds[0]);
+	(void)waitpid(pid, NULL, 0);
+	start = now() - start;
+	*settled = bt.size;
+	return (total / start / (1024 * 1024));
+}
+
+/*
+ * Create the file to copy, and make sure it is on the disk, so that
+ * dropping it from the page cache works.
+ */
+static void
+makefile(const char *path) {
+	off_t left;
+	int fd;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		fail(path);
+	for (left = total; left > 0; left -= MAXSIZE)
+		if (write(fd, buf, left < MAXSIZE ? left : MAXSIZE) < 0)
+			fail(path);
+	if (fsync(fd) < 0)
+		fail(path);
+	(void)close(fd);
+}
+
+static double
+now(void) {
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+fail(const char *what) {
+	fprintf(stderr, "%s: %s\n", what, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static void
+usage(void) {
+	fprintf(stderr, "usage: catbench [-d diskdir] [-t tmpfsdir] "
+	    "[-r runs] [-s megabytes]\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,620 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * Copying with more than one read(2) or write(2) outstanding at a time.
+ *
+ * A plain read/write loop waits for each read before it writes, and for
+ * each write before it reads again, so the device we read from sits
+ * idle while we write and vice versa; a fast disk can only show what
+ * it can do with several requests queued.
+ *
+ * catring() uses Linux's io_uring(7): it sets up depth buffers, each
+ * covering its own stretch of the input, and for each queues a read
+ * and, linked to it, the write of the same buffer, so that the kernel
+ * starts the write as soon as the read is done without waiting for us.
+ * If the read comes up short, the kernel cancels the write and we take
+ * it from there.  When stdout is not something we can write to at an
+ * offset, such as a pipe, the writes instead go out one at a time, in
+ * order, while the reads keep going.
+ *
+ * The buffers are registered with the kernel, which then doesn't have
+ * to map them for every request; if we are not allowed to lock that
+ * much memory, we do without.
+ *
+ * We talk to the kernel directly rather than through liburing, which
+ * makes this longer, but shows what is going on: two rings shared with
+ * the kernel, one of submissions we add to at the tail, and one of
+ * completions we take from at the head.
+ *
+ * catthreads() is the portable version of the same idea: one thread
+ * reads into a ring of buffers, another writes them out.
+ *
+ * Both return 0 once everything was copied and -1 on error.  catring()
+ * returns 1 without having copied anything if io_uring can't be used
+ * for these files, in which case the caller can use catthreads().
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "catring.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING
+#endif
+
+#ifdef HAVE_IO_URING
+struct ring {
+	int			 fd;
+	unsigned		 entries;
+	unsigned		*sqhead, *sqtail, *sqmask, *sqarray;
+	struct io_uring_sqe	*sqes;
+	unsigned		*cqhead, *cqtail, *cqmask;
+	struct io_uring_cqe	*cqes;
+	unsigned		 pending;	/* queued, not yet submitted */
+	void			*sqmap, *cqmap;
+	size_t			 sqlen, cqlen;
+};
+
+enum { S_FREE, S_READ, S_WAIT, S_WRITE };
+
+struct slot {
+	char	*buf;
+	int	 state;
+	int	 linked;	/* a write is linked to the read in flight */
+	off_t	 start;		/* where in the input buf[0] is from */
+	size_t	 have;		/* bytes in buf */
+	size_t	 done;		/* bytes of buf written */
+	size_t	 asked;		/* bytes the read in flight asked for */
+};
+
+/* What a completion is for: the slot, and whether it was a write. */
+#define UDATA(i, w)	((__u64)(i) << 1 | (w))
+
+struct copy {
+	struct ring	 r;
+	struct slot	*slots;
+	int		 in, out;
+	int		 fixed;		/* the buffers are registered */
+	int		 oseek;		/* we can write at an offset */
+	size_t		 size;
+	off_t		 ibase, obase;	/* where the offsets started */
+	off_t		 next;		/* the next stretch of input to read */
+	off_t		 wnext;		/* if !oseek, what to write next */
+	int		 writing;	/* if !oseek, a write is in flight */
+	int		 eof;
+	unsigned	 inflight;
+	off_t		 moved;
+};
+
+static void queue_read(struct copy *, int);
+static void queue_write(struct copy *, int);
+static int ring_init(struct ring *, unsigned);
+static void ring_free(struct ring *);
+static struct io_uring_sqe *ring_get(struct ring *);
+static int ring_enter(struct ring *, unsigned);
+static int seekable(int, off_t *);
+#endif
+
+/*
+ * The ring of buffers catthreads() shares between its reader and
+ * writer: the reader fills bufs[head % depth], the writer empties
+ * bufs[tail % depth].
+ */
+struct pipeline {
+	pthread_mutex_t	  lock;
+	pthread_cond_t	  cond;
+	char		**bufs;
+	ssize_t		 *lens;
+	int		  depth;
+	size_t		  size;
+	unsigned	  head, tail;
+	int		  in, out;
+	int		  eof;		/* the reader is done */
+	int		  error;	/* errno of whichever side failed */
+	off_t		  moved;
+};
+
+static void *reader(void *);
+
+#ifdef HAVE_IO_URING
+int
+catring(int in, int out, int depth, size_t size, off_t *moved) {
+	struct copy c;
+	struct slot *s;
+	struct io_uring_cqe *cqe;
+	struct iovec *iov;
+	unsigned head;
+	int error, i, iswrite, res;
+	char *mem;
+
+	(void)memset(&c, 0, sizeof(c));
+	if (!seekable(in, &c.ibase))
+		return (1);
+	c.oseek = seekable(out, &c.obase) && !(fcntl(out, F_GETFL) & O_APPEND);
+	c.in = in;
+	c.out = out;
+	c.size = size;
+
+	if (ring_init(&c.r, 2 * depth) < 0)
+		return (errno == ENOSYS || errno == EPERM ? 1 : -1);
+	iov = NULL;
+	mem = MAP_FAILED;
+	if ((c.slots = calloc(depth, sizeof(*c.slots))) == NULL ||
+	    (iov = calloc(depth, sizeof(*iov))) == NULL ||
+	    (mem = mmap(NULL, depth * size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		goto fail;
+	for (i = 0; i < depth; i++) {
+		c.slots[i].buf = mem + i * size;
+		iov[i].iov_base = c.slots[i].buf;
+		iov[i].iov_len = size;
+	}
+	c.fixed = syscall(__NR_io_uring_register, c.r.fd,
+	    IORING_REGISTER_BUFFERS, iov, depth) == 0;
+	free(iov);
+
+	c.next = c.wnext = c.ibase;
+	error = 0;
+	for (i = 0; i < depth; i++)
+		queue_read(&c, i);
+
+	while (c.inflight > 0) {
+		if (ring_enter(&c.r, 1) < 0) {
+			error = errno;
+			break;
+		}
+		head = *c.r.cqhead;
+		while (head != __atomic_load_n(c.r.cqtail, __ATOMIC_ACQUIRE)) {
+			cqe = &c.r.cqes[head & *c.r.cqmask];
+			i = cqe->user_data >> 1;
+			iswrite = cqe->user_data & 1;
+			res = cqe->res;
+			head++;
+			__atomic_store_n(c.r.cqhead, head, __ATOMIC_RELEASE);
+			c.inflight--;
+			s = &c.slots[i];
+
+			if (res == -ECANCELED) {
+				/* The read it was linked to came up short. */
+				continue;
+			}
+			if (res < 0) {
+				/*
+				 * If the very first thing we tried didn't
+				 * work, let the caller try something else.
+				 */
+				if (!error && c.moved == 0 && (res == -EINVAL ||
+				    res == -EOPNOTSUPP || res == -EBADF))
+					error = -1;
+				else if (!error || error == -1)
+					error = -res;
+				continue;
+			}
+			if (error)
+				continue;
+
+			if (!iswrite) {
+				s->have += res;
+				if (s->linked && (size_t)res == s->asked) {
+					/* The linked write is on its way. */
+					s->state = S_WRITE;
+					continue;
+				}
+				s->linked = 0;
+				if (res == 0)
+					c.eof = 1;
+				else if (s->have < size) {
+					/* Short, but maybe not the end. */
+					queue_read(&c, i);
+					continue;
+				}
+				s->state = s->have > 0 ? S_WAIT : S_FREE;
+			} else {
+				s->done += res;
+				c.moved += res;
+				if (!c.oseek) {
+					c.writing = 0;
+					c.wnext += res;
+				}
+				if (s->done < s->have)
+					s->state = S_WAIT;
+				else if (!c.eof)
+					queue_read(&c, i);
+				else
+					s->state = S_FREE;
+			}
+		}
+		if (error)
+			continue;
+
+		for (i = 0; i < depth; i++)
+			if (c.slots[i].state == S_WAIT)
+				queue_write(&c, i);
+	}
+
+	ring_free(&c.r);
+	(void)munmap(mem, depth * size);
+	free(c.slots);
+	*moved = c.moved;
+
+	if (error == -1 && c.moved == 0)
+		return (1);
+	if (error) {
+		errno = error == -1 ? EINVAL : error;
+		return (-1);
+	}
+
+	/* Leave the offsets where a read/write loop would have. */
+	(void)lseek(in, c.ibase + c.moved, SEEK_SET);
+	if (c.oseek)
+		(void)lseek(out, c.obase + c.moved, SEEK_SET);
+	return (0);
+
+fail:
+	error = errno;
+	if (mem != MAP_FAILED)
+		(void)munmap(mem, depth * size);
+	free(iov);
+	free(c.slots);
+	ring_free(&c.r);
+	errno = error;
+	return (-1);
+}
+
+/*
+ * Read into slot i: the rest of its stretch of the input if it came up
+ * short before, or else the next stretch.  In the latter case, if we
+ * write at offsets, queue the write of all of it right behind the read.
+ */
+static void
+queue_read(struct copy *c, int i) {
+	struct io_uring_sqe *sqe;
+	struct slot *s;
+
+	s = &c->slots[i];
+	if (s->state != S_READ) {
+		s->start = c->next;
+		s->have = s->done = 0;
+		s->state = S_READ;
+		s->linked = c->oseek;
+		c->next += c->size;
+	}
+	s->asked = c->size - s->have;
+
+	sqe = ring_get(&c->r);
+	sqe->opcode = c->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = c->in;
+	sqe->off = s->start + s->have;
+	sqe->addr = (unsigned long)(s->buf + s->have);
+	sqe->len = s->asked;
+	sqe->buf_index = i;
+	sqe->user_data = UDATA(i, 0);
+	c->inflight++;
+	if (!s->linked)
+		return;
+
+	sqe->flags |= IOSQE_IO_LINK;
+	sqe = ring_get(&c->r);
+	sqe->opcode = c->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->fd = c->out;
+	sqe->off = c->obase + (s->start - c->ibase);
+	sqe->addr = (unsigned long)s->buf;
+	sqe->len = c->size;
+	sqe->buf_index = i;
+	sqe->user_data = UDATA(i, 1);
+	c->inflight++;
+}
+
+/*
+ * Write out what slot i is waiting to.  If we can't write at offsets,
+ * only whatever comes next in the output can go, and only once nothing
+ * else is being written.
+ */
+static void
+queue_write(struct copy *c, int i) {
+	struct io_uring_sqe *sqe;
+	struct slot *s;
+
+	s = &c->slots[i];
+	if (!c->oseek && (c->writing ||
+	    s->start + (off_t)s->done != c->wnext))
+		return;
+	sqe = ring_get(&c->r);
+	sqe->opcode = c->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->fd = c->out;
+	sqe->off = c->oseek ? c->obase + (s->start - c->ibase) + s->done :
+	    (__u64)-1;
+	sqe->addr = (unsigned long)(s->buf + s->done);
+	sqe->len = s->have - s->done;
+	sqe->buf_index = i;
+	sqe->user_data = UDATA(i, 1);
+	s->state = S_WRITE;
+	c->inflight++;
+	if (!c->oseek)
+		c->writing = 1;
+}
+
+/*
+ * Only where we can read at an offset can we have several reads in
+ * flight and still know which part of the input each one got.
+ */
+static int
+seekable(int fd, off_t *off) {
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !(S_ISREG(st.st_mode) ||
+	    S_ISBLK(st.st_mode)))
+		return (0);
+	return ((*off = lseek(fd, 0, SEEK_CUR)) != -1);
+}
+
+static int
+ring_init(struct ring *r, unsigned entries) {
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	(void)memset(r, 0, sizeof(*r));
+	(void)memset(&p, 0, sizeof(p));
+	if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return (-1);
+	r->entries = p.sq_entries;
+
+	r->sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cqlen > r->sqlen)
+			r->sqlen = r->cqlen;
+		r->cqlen = 0;
+	}
+	r->sqmap = mmap(NULL, r->sqlen, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sqmap == MAP_FAILED)
+		goto fail;
+	if (r->cqlen) {
+		r->cqmap = mmap(NULL, r->cqlen, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cqmap == MAP_FAILED)
+			goto fail;
+	} else
+		r->cqmap = r->sqmap;
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+	    IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto fail;
+
+	sq = r->sqmap;
+	cq = r->cqmap;
+	r->sqhead = (unsigned *)(sq + p.sq_off.head);
+	r->sqtail = (unsigned *)(sq + p.sq_off.tail);
+	r->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sqarray = (unsigned *)(sq + p.sq_off.array);
+	r->cqhead = (unsigned *)(cq + p.cq_off.head);
+	r->cqtail = (unsigned *)(cq + p.cq_off.tail);
+	r->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return (0);
+
+fail:
+	ring_free(r);
+	return (-1);
+}
+
+static void
+ring_free(struct ring *r) {
+	int error;
+
+	error = errno;
+	if (r->sqes != NULL && r->sqes != MAP_FAILED)
+		(void)munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+	if (r->cqmap != NULL && r->cqmap != MAP_FAILED && r->cqmap != r->sqmap)
+		(void)munmap(r->cqmap, r->cqlen);
+	if (r->sqmap != NULL && r->sqmap != MAP_FAILED)
+		(void)munmap(r->sqmap, r->sqlen);
+	(void)close(r->fd);
+	errno = error;
+}
+
+/*
+ * Return the next free submission queue entry, cleared.  It is handed
+ * to the kernel on the next ring_enter().
+ */
+static struct io_uring_sqe *
+ring_get(struct ring *r) {
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	tail = *r->sqtail;
+	if (tail - __atomic_load_n(r->sqhead, __ATOMIC_ACQUIRE) == r->entries)
+		(void)ring_enter(r, 0);
+	idx = tail & *r->sqmask;
+	sqe = &r->sqes[idx];
+	(void)memset(sqe, 0, sizeof(*sqe));
+	r->sqarray[idx] = idx;
+	__atomic_store_n(r->sqtail, tail + 1, __ATOMIC_RELEASE);
+	r->pending++;
+	return (sqe);
+}
+
+/* Submit what is queued and wait for at least wait completions. */
+static int
+ring_enter(struct ring *r, unsigned wait) {
+	int n;
+
+	do {
+		n = syscall(__NR_io_uring_enter, r->fd, r->pending, wait,
+		    wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return (-1);
+	r->pending -= n;
+	return (0);
+}
+#else
+int
+catring(int in, int out, int depth, size_t size, off_t *moved) {
+
+	(void)in;
+	(void)out;
+	(void)depth;
+	(void)size;
+	(void)moved;
+	return (1);
+}
+#endif
+
+int
+catthreads(int in, int out, int depth, size_t size, off_t *moved) {
+	struct pipeline p;
+	pthread_t tid;
+	ssize_t n, len;
+	char *buf;
+	int error, i, rval;
+
+	(void)memset(&p, 0, sizeof(p));
+	p.in = in;
+	p.out = out;
+	p.depth = depth;
+	p.size = size;
+	(void)pthread_mutex_init(&p.lock, NULL);
+	(void)pthread_cond_init(&p.cond, NULL);
+	rval = -1;
+	if ((p.bufs = calloc(depth, sizeof(*p.bufs))) == NULL ||
+	    (p.lens = calloc(depth, sizeof(*p.lens))) == NULL)
+		goto out;
+	for (i = 0; i < depth; i++)
+		if ((p.bufs[i] = malloc(size)) == NULL)
+			goto out;
+	if ((errno = pthread_create(&tid, NULL, reader, &p)) != 0)
+		goto out;
+
+	/* We are the writer. */
+	for (;;) {
+		(void)pthread_mutex_lock(&p.lock);
+		while (p.head == p.tail && !p.eof && !p.error)
+			(void)pthread_cond_wait(&p.cond, &p.lock);
+		if (p.error || p.head == p.tail) {
+			(void)pthread_mutex_unlock(&p.lock);
+			break;
+		}
+		buf = p.bufs[p.tail % depth];
+		len = p.lens[p.tail % depth];
+		(void)pthread_mutex_unlock(&p.lock);
+
+		for (; len > 0; buf += n, len -= n) {
+			if ((n = write(out, buf, len)) < 0) {
+				if (errno == EINTR) {
+					n = 0;
+					continue;
+				}
+				break;
+			}
+			p.moved += n;
+		}
+
+		(void)pthread_mutex_lock(&p.lock);
+		if (len > 0)
+			p.error = errno;
+		p.tail++;
+		(void)pthread_cond_signal(&p.cond);
+		(void)pthread_mutex_unlock(&p.lock);
+	}
+
+	/*
+	 * If we gave up, the reader may be blocked in read(2) on a pipe
+	 * or terminal with nothing more to say; don't wait for it.
+	 */
+	if (p.error)
+		(void)pthread_cancel(tid);
+	(void)pthread_join(tid, NULL);
+	*moved = p.moved;
+	if (p.error)
+		errno = p.error;
+	else
+		rval = 0;
+
+out:
+	error = errno;
+	if (p.bufs != NULL)
+		for (i = 0; i < depth; i++)
+			free(p.bufs[i]);
+	free(p.bufs);
+	free(p.lens);
+	(void)pthread_cond_destroy(&p.cond);
+	(void)pthread_mutex_destroy(&p.lock);
+	errno = error;
+	return (rval);
+}
+
+static void *
+reader(void *arg) {
+	struct pipeline *p;
+	unsigned head;
+	ssize_t n;
+	int state;
+
+	/* We can be cancelled in read(2), but nowhere else. */
+	(void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+	p = arg;
+	for (;;) {
+		(void)pthread_mutex_lock(&p->lock);
+		while (p->head - p->tail == (unsigned)p->depth && !p->error)
+			(void)pthread_cond_wait(&p->cond, &p->lock);
+		head = p->head;
+		n = p->error;
+		(void)pthread_mutex_unlock(&p->lock);
+		if (n)
+			break;
+
+		/* Nobody else touches this buffer until we move head. */
+		(void)pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+		while ((n = read(p->in, p->bufs[head % p->depth],
+		    p->size)) < 0 && errno == EINTR)
+			;
+		(void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+		(void)pthread_mutex_lock(&p->lock);
+		if (n > 0) {
+			p->lens[head % p->depth] = n;
+			p->head++;
+		} else {
+			if (n < 0)
+				p->error = errno;
+			p->eof = 1;
+		}
+		(void)pthread_cond_signal(&p->cond);
+		(void)pthread_mutex_unlock(&p->lock);
+		if (n <= 0)
+			break;
+	}
+	return (NULL);
+}
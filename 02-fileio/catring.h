@@ -0,0 +1,28 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+#ifndef _CATRING_H_
+#define _CATRING_H_
+
+#include <sys/types.h>
+
+/* How many buffers to keep in flight, and how large each one is. */
+#define CATRING_DEPTH	8
+#define CATRING_SIZE	(128 * 1024)
+
+int	catring(int, int, int, size_t, off_t *);
+int	catthreads(int, int, int, size_t, off_t *);
+
+#endif /* !_CATRING_H_ */
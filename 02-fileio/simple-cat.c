@@ -19,39 +19,371 @@
  *
  * Guess what, this is also a primitive version of 'cp':
  * ./simple-cat <simple-cat.c >simple-cat.copy
+ *
+ * Copying through our own buffer means every byte crosses the
+ * user/kernel boundary twice.  So by default, we first ask the kernel
+ * to move the data itself, depending on what stdin and stdout are:
+ *
+ *   file -> file      copy_file_range(2), which on some file systems
+ *                     shares the blocks instead of copying them
+ *   file -> other     sendfile(2), e.g. into a socket
+ *   pipe <-> other    splice(2); without a pipe on either side, we
+ *                     splice through one of our own
+ *
+ * If none of these apply or the kernel refuses, we fall back to
+ * read(2) and write(2), with a buffer size found by buftune.c while
+ * copying.
+ *
+ * "-m rw" does nothing but read(2) and write(2) with a fixed buffer of
+ * BUFFSIZE bytes, which is what 'make catio' measures; "copy",
+ * "sendfile" and "splice" force one of the kernel paths.
+ *
+ * "-m uring" and "-m threads" still copy through buffers of our own,
+ * but keep -n of them in flight at a time, so that reading and writing
+ * overlap; see catring.c.  Without io_uring, "uring" falls back to
+ * "threads".
+ *
+ * -v reports what was used.
+ *
+ * cc -Wall simple-cat.c buftune.c catring.c -lpthread -o simple-cat
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "buftune.h"
+#include "catring.h"
+
 /* We'll see later why / how we picked this number. */
 #ifndef BUFFSIZE
 #define BUFFSIZE 32768
 #endif
 
+/* How much to ask the kernel to move at a time. */
+#define CHUNK		(1024 * 1024 * 1024)
+#define SPLICE_CHUNK	(1024 * 1024)
+
+#if defined(__linux__) || defined(__FreeBSD__)
+#define HAVE_COPY_FILE_RANGE
+#endif
+
+enum { M_AUTO, M_COPY, M_SENDFILE, M_SPLICE, M_RW, M_URING, M_THREADS };
+
+static const char *modes[] = { "auto", "copy", "sendfile", "splice", "rw",
+	"uring", "threads" };
+
+static off_t total;
+static size_t tuned;
+
+static int catcopy(void);
+static int catsendfile(void);
+static int catsplice(const struct stat *, const struct stat *);
+static void catrw(int);
+static void fail(const char *);
+static int unsupported(int);
+static void usage(void);
+static void writeall(const char *, size_t);
+
 int
 main(int argc, char **argv) {
-	int n;
-	char buf[BUFFSIZE];
-
-	/* cast to void to silence compiler warnings */
-	(void)argc;
-	(void)argv;
+	struct stat ist, ost;
+	int ch, depth, done, mode, verbose;
+	const char *used;
+	off_t n;
 
-	while ((n = read(STDIN_FILENO, buf, BUFFSIZE)) > 0) {
-		if (write(STDOUT_FILENO, buf, n) != n) {
-			fprintf(stderr, "Unable to write: %s\n", strerror(errno));
-			exit(EXIT_FAILURE);
+	depth = CATRING_DEPTH;
+	mode = M_AUTO;
+	verbose = 0;
+	while ((ch = getopt(argc, argv, "m:n:v")) != -1) {
+		switch (ch) {
+		case 'm':
+			for (mode = 0; mode <= M_THREADS; mode++)
+				if (strcmp(optarg, modes[mode]) == 0)
+					break;
+			if (mode > M_THREADS)
+				usage();
+			break;
+		case 'n':
+			if ((depth = atoi(optarg)) < 1 || depth > 1024)
+				usage();
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
 		}
 	}
+	if (argc != optind)
+		usage();
 
-	if (n < 0) {
-		fprintf(stderr, "Unable to read: %s\n", strerror(errno));
-		exit(EXIT_FAILURE);
+	if (fstat(STDIN_FILENO, &ist) < 0 || fstat(STDOUT_FILENO, &ost) < 0)
+		fail("stat");
+
+	done = 0;
+	used = "read/write";
+	switch (mode) {
+	case M_AUTO:
+		/*
+		 * Unless one of these copied all of stdin, the next one has
+		 * a go at what is left of it.
+		 */
+		if (S_ISREG(ist.st_mode) && S_ISREG(ost.st_mode) &&
+		    catcopy() > 0)
+			used = "copy_file_range";
+		else if ((S_ISFIFO(ist.st_mode) || S_ISFIFO(ost.st_mode) ||
+		    !S_ISREG(ist.st_mode)) && catsplice(&ist, &ost) > 0)
+			used = "splice";
+		else if (S_ISREG(ist.st_mode) && catsendfile() > 0)
+			used = "sendfile";
+		else
+			catrw(1);
+		break;
+	case M_COPY:
+		if (catcopy() < 0)
+			fail("copy_file_range");
+		used = "copy_file_range";
+		break;
+	case M_SENDFILE:
+		if (catsendfile() < 0)
+			fail("sendfile");
+		used = "sendfile";
+		break;
+	case M_SPLICE:
+		if (catsplice(&ist, &ost) < 0)
+			fail("splice");
+		used = "splice";
+		break;
+	case M_RW:
+		catrw(0);
+		break;
+	case M_URING:
+		n = 0;
+		if ((done = catring(STDIN_FILENO, STDOUT_FILENO, depth,
+		    CATRING_SIZE, &n)) < 0)
+			fail("copy with io_uring");
+		total += n;
+		used = "io_uring";
+		if (done == 0)
+			break;
+		/* FALLTHROUGH */
+	case M_THREADS:
+		n = 0;
+		if (catthreads(STDIN_FILENO, STDOUT_FILENO, depth,
+		    CATRING_SIZE, &n) < 0)
+			fail("copy with threads");
+		total += n;
+		used = "threads";
+		break;
 	}
 
+	if (verbose && tuned)
+		fprintf(stderr, "%lld bytes with %s, settled on %zu bytes\n",
+		    (long long)total, used, tuned);
+	else if (verbose)
+		fprintf(stderr, "%lld bytes with %s\n", (long long)total, used);
 	return(EXIT_SUCCESS);
 }
+
+/*
+ * Most of these may also just not work for a particular pair of files,
+ * in which case we try something else.  EBADF is what we get for an
+ * O_APPEND stdout, as after '>>'.
+ */
+static int
+unsupported(int error) {
+	return (error == ENOSYS || error == EINVAL || error == EXDEV ||
+	    error == EOPNOTSUPP || error == ENOTSUP || error == EBADF);
+}
+
+/*
+ * Return 1 if all of stdin was copied, 0 if it was at its end without
+ * anything copied, or -1, with errno set, if the kernel will not do it
+ * for these files and the rest of stdin has to be copied some other way.
+ *
+ * All of these use and advance the file offsets, so after a partial
+ * failure the next method picks up where this one left off.  Unless a
+ * method is forced, a file that looks empty is left to read(2) to make
+ * sure: files in /proc have a size of 0, and copy_file_range(2) believes
+ * it.
+ */
+static int
+catcopy(void) {
+#ifdef HAVE_COPY_FILE_RANGE
+	ssize_t n;
+	off_t start;
+
+	start = total;
+	while ((n = copy_file_range(STDIN_FILENO, NULL, STDOUT_FILENO, NULL,
+	    CHUNK, 0)) > 0)
+		total += n;
+	if (n == 0)
+		return (total > start ? 1 : 0);
+	if (!unsupported(errno))
+		fail("copy_file_range");
+#else
+	errno = ENOSYS;
+#endif
+	return (-1);
+}
+
+static int
+catsendfile(void) {
+#ifdef __linux__
+	ssize_t n;
+	off_t start;
+
+	start = total;
+	while ((n = sendfile(STDOUT_FILENO, STDIN_FILENO, NULL, CHUNK)) > 0)
+		total += n;
+	if (n == 0)
+		return (total > start ? 1 : 0);
+	if (!unsupported(errno))
+		fail("sendfile");
+#else
+	errno = ENOSYS;
+#endif
+	return (-1);
+}
+
+/*
+ * splice(2) needs a pipe on one side.  If neither stdin nor stdout is
+ * one, we splice into a pipe of our own and from there to stdout.
+ */
+static int
+catsplice(const struct stat *ist, const struct stat *ost) {
+#ifdef __linux__
+	ssize_t n, m;
+	off_t start;
+	int fds[2], serrno;
+	char *buf;
+
+	start = total;
+	if (S_ISFIFO(ist->st_mode) || S_ISFIFO(ost->st_mode)) {
+		while ((n = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL,
+		    SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+			total += n;
+		if (n == 0)
+			return (total > start || !S_ISREG(ist->st_mode) ? 1 : 0);
+		if (!unsupported(errno))
+			fail("splice");
+		return (-1);
+	}
+
+	if (pipe(fds) < 0)
+		fail("pipe");
+	(void)fcntl(fds[1], F_SETPIPE_SZ, SPLICE_CHUNK);
+	while ((n = splice(STDIN_FILENO, NULL, fds[1], NULL, SPLICE_CHUNK,
+	    SPLICE_F_MOVE | SPLICE_F_MORE)) > 0) {
+		for (; n > 0; n -= m) {
+			if ((m = splice(fds[0], NULL, STDOUT_FILENO, NULL, n,
+			    SPLICE_F_MOVE | SPLICE_F_MORE)) > 0) {
+				total += m;
+				continue;
+			}
+			if (m == 0 || !unsupported(errno))
+				fail("splice");
+			serrno = errno;
+
+			/*
+			 * Stdout will not take it; what is already in
+			 * the pipe has to go out the old-fashioned way.
+			 */
+			if ((buf = malloc(n)) == NULL)
+				fail("malloc");
+			for (; n > 0; n -= m) {
+				if ((m = read(fds[0], buf, n)) <= 0)
+					fail("read");
+				writeall(buf, m);
+				total += m;
+			}
+			free(buf);
+			(void)close(fds[0]);
+			(void)close(fds[1]);
+			errno = serrno;
+			return (-1);
+		}
+	}
+	(void)close(fds[0]);
+	(void)close(fds[1]);
+	if (n == 0)
+		return (total > start || !S_ISREG(ist->st_mode) ? 1 : 0);
+	if (!unsupported(errno))
+		fail("splice");
+#else
+	(void)ist;
+	(void)ost;
+	errno = ENOSYS;
+#endif
+	return (-1);
+}
+
+/*
+ * Copy through our own buffer: of BUFFSIZE bytes, or if tune is set,
+ * of whatever size buftune finds to be fastest.
+ */
+static void
+catrw(int tune) {
+	struct buftune bt;
+	ssize_t n;
+	char *buf;
+
+	if (tune)
+		buftune_init(&bt, STDIN_FILENO, BUFTUNE_MAX);
+	else {
+		bt.size = bt.max = BUFFSIZE;
+		bt.done = 1;
+	}
+	if ((buf = malloc(bt.max)) == NULL)
+		fail("malloc");
+
+	while ((n = read(STDIN_FILENO, buf, bt.size)) > 0) {
+		writeall(buf, n);
+		total += n;
+		buftune_update(&bt, n);
+	}
+
+	if (n < 0)
+		fail("read");
+	free(buf);
+	if (tune)
+		tuned = bt.size;
+}
+
+static void
+writeall(const char *buf, size_t len) {
+	ssize_t n;
+
+	for (; len > 0; buf += n, len -= n)
+		if ((n = write(STDOUT_FILENO, buf, len)) < 0)
+			fail("write");
+}
+
+static void
+fail(const char *what) {
+	fprintf(stderr, "Unable to %s: %s\n", what, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static void
+usage(void) {
+	fprintf(stderr,
+	    "usage: simple-cat [-v] [-n buffers] "
+	    "[-m auto|copy|sendfile|splice|rw|uring|threads]\n");
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,146 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * Copying a file with holes, such as the one hole.c creates, without
+ * filling them in.
+ *
+ * read(2) happily returns the zeros the kernel supplies for a hole, and
+ * write(2) then stores them, so a naive copy of file.hole reads and
+ * writes ten megabytes of nothing, and takes up that much disk space.
+ *
+ * Instead, we ask the file system where the data is: lseek(2) with
+ * SEEK_DATA moves to the next byte that is not in a hole, and SEEK_HOLE
+ * to the next one that is.  We copy only what lies in between, lseek(2)
+ * the target over the rest, just like hole.c does, and finally set its
+ * size, so that a hole at the end is recreated as well.
+ *
+ * Where the file system doesn't know about holes, SEEK_DATA fails, and
+ * we treat the whole file as data.  When it looks as if the whole file
+ * is data, either because it is or because we can't tell, we skip over
+ * whole blocks of zeros rather than write them; that recreates any
+ * holes the source had, and perhaps a few it didn't.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sparse.h"
+
+static int iszero(const char *, size_t);
+
+/*
+ * Find the first stretch of data in fd at or after off and before size.
+ * Return 1 and set *start and *end to it, or 0 if there is none; -1 if
+ * something went wrong.  If the file system can't tell us, everything
+ * is data.
+ */
+int
+nextdata(int fd, off_t off, off_t size, off_t *start, off_t *end) {
+#ifdef SEEK_DATA
+	off_t data, hole;
+
+	if (off >= size)
+		return (0);
+	if ((data = lseek(fd, off, SEEK_DATA)) < 0) {
+		if (errno == ENXIO)
+			return (0);
+		if (errno != EINVAL)
+			return (-1);
+		data = off;
+		hole = size;
+	} else if ((hole = lseek(fd, data, SEEK_HOLE)) < 0) {
+		return (-1);
+	}
+	if (data >= size)
+		return (0);
+	*start = data;
+	*end = hole < size ? hole : size;
+	return (1);
+#else
+	if (off >= size)
+		return (0);
+	*start = off;
+	*end = size;
+	return (1);
+#endif
+}
+
+/*
+ * Copy the first size bytes of in to out, which is assumed to be empty,
+ * using buf, keeping the holes.  Both offsets end up at size.  Return 0
+ * on success and -1 on error.
+ */
+int
+sparsecopy(int in, int out, off_t size, char *buf, size_t bufsize) {
+	struct stat st;
+	off_t off, start, end;
+	size_t blk, len;
+	ssize_t n;
+	int r, skip;
+
+	/* If we look for zeros ourselves, it's in whole blocks. */
+	blk = 512;
+	if (fstat(out, &st) == 0 && st.st_blksize > 0)
+		blk = st.st_blksize;
+	if (blk > bufsize)
+		blk = bufsize;
+
+	for (off = 0; (r = nextdata(in, off, size, &start, &end)) > 0;
+	    off = end) {
+		skip = start == 0 && end == size;
+		if (lseek(in, start, SEEK_SET) < 0 ||
+		    lseek(out, start, SEEK_SET) < 0)
+			return (-1);
+		while (start < end) {
+			len = end - start < (off_t)bufsize ?
+			    (size_t)(end - start) : bufsize;
+			if ((n = read(in, buf, len)) <= 0) {
+				if (n == 0)
+					break;	/* it shrank under us */
+				return (-1);
+			}
+			if (skip && (size_t)n % blk == 0 && iszero(buf, n)) {
+				if (lseek(out, n, SEEK_CUR) < 0)
+					return (-1);
+			} else if (write(out, buf, n) != n)
+				return (-1);
+			start += n;
+		}
+	}
+	if (r < 0)
+		return (-1);
+
+	/* Whatever hole is left at the end, and the size. */
+	if (ftruncate(out, size) < 0)
+		return (-1);
+	if (lseek(in, size, SEEK_SET) < 0 || lseek(out, size, SEEK_SET) < 0)
+		return (-1);
+	return (0);
+}
+
+static int
+iszero(const char *buf, size_t len) {
+
+	return (len == 0 || (buf[0] == 0 && memcmp(buf, buf + 1, len - 1) == 0));
+}
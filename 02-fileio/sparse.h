@@ -0,0 +1,24 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+#ifndef _SPARSE_H_
+#define _SPARSE_H_
+
+#include <sys/types.h>
+
+int	nextdata(int, off_t, off_t, off_t *, off_t *);
+int	sparsecopy(int, int, off_t, char *, size_t);
+
+#endif /* !_SPARSE_H_ */
@@ -32,22 +32,103 @@
  * time ./a.out <file >out
  *
  * Then, recompile with "-DSYNC" and run it again.
+ *
+ * Rather than using a fixed BUFSIZ, the buffer size is picked by
+ * buftune.c while copying; with O_SYNC, where every write(2) waits
+ * for the disk, that makes quite a difference.
+ *
+ * (Note that Linux ignores O_SYNC in fcntl(2)'s F_SETFL, so there you
+ * won't see a difference unless the file was opened with O_SYNC.)
+ *
+ * O_SYNC makes every single write durable, which is more than most
+ * programs need: an audit log, say, has to be on disk before we claim
+ * to be done, or at most a second or so after a record was written.
+ * So instead of -DSYNC, try
+ *
+ * time ./a.out -v -b 1048576 -t 1000 <file >out
+ *
+ * which calls fdatasync(2) once a megabyte has been written or a second
+ * has passed since the last one, whichever comes first, and once more
+ * at the end, committing all the writes in between as a group.  -v
+ * reports how long those calls took.
+ *
+ * -w additionally asks the kernel, via sync_file_range(2), to start
+ * writing what we wrote right away, and waits for the chunk before,
+ * so that there is never much left for fdatasync(2) to do.  This alone
+ * does not make anything durable, as it does not flush the disk's own
+ * cache or write the metadata.
+ *
+ * cc -Wall sync-cat.c buftune.c
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "buftune.h"
+
+/* How much to write behind at a time with -w. */
+#define BEHIND	(8 * 1024 * 1024)
+
+static double *lat;
+static size_t nlat;
+
+static double now(void);
+static void datasync(void);
+static void behind(off_t, off_t *, off_t *);
+static void report(void);
+static int cmpdouble(const void *, const void *);
+static void usage(void);
+
 int
 main(int argc, char **argv) {
-	int n;
-	char buf[BUFSIZ];
+	struct buftune bt;
+	struct pollfd pfd;
+	int n, ch, verbose, wflag;
+	char *buf;
 	int flags;
+	long ms;
+	size_t bytes, dirty;
+	off_t pos, started, prev;
+	double last, left;
 
-	/* cast to void to silence compiler warnings */
-	(void)argc;
-	(void)argv;
+	bytes = 0;
+	ms = 0;
+	verbose = wflag = 0;
+	while ((ch = getopt(argc, argv, "b:t:vw")) != -1) {
+		switch (ch) {
+		case 'b':
+			if ((bytes = strtoul(optarg, NULL, 10)) == 0)
+				usage();
+			break;
+		case 't':
+			if ((ms = atol(optarg)) <= 0)
+				usage();
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'w':
+			wflag = 1;
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (argc != optind)
+		usage();
 
 	if ((flags = fcntl(STDOUT_FILENO, F_GETFL, 0)) < 0) {
 		perror("Can't get file descriptor flags");
@@ -63,16 +144,165 @@ main(int argc, char **argv) {
 		exit(EXIT_FAILURE);
 	}
 
-	while ((n = read(STDIN_FILENO, buf, BUFSIZ)) > 0 )
+	pos = 0;
+	if (wflag) {
+#ifdef SYNC_FILE_RANGE_WRITE
+		if ((pos = lseek(STDOUT_FILENO, 0, SEEK_CUR)) < 0) {
+			perror("Can't write behind");
+			exit(EXIT_FAILURE);
+		}
+#else
+		fprintf(stderr, "Can't write behind: %s\n", strerror(ENOSYS));
+		exit(EXIT_FAILURE);
+#endif
+	}
+	started = prev = pos;
+
+	buftune_init(&bt, STDIN_FILENO, BUFTUNE_MAX);
+	if ((buf = malloc(bt.max)) == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	dirty = 0;
+	last = now();
+	for (;;) {
+		/*
+		 * If the input dries up, don't hold on to what we wrote
+		 * for longer than we promised.
+		 */
+		if (ms && dirty) {
+			left = last + ms / 1000.0 - now();
+			if (left <= 0 || poll(&pfd, 1, left * 1000 + 1) == 0) {
+				datasync();
+				dirty = 0;
+				last = now();
+			}
+		}
+		if ((n = read(STDIN_FILENO, buf, bt.size)) <= 0)
+			break;
 		if ( write(STDOUT_FILENO, buf, n) != n ) {
 			perror("write error");
 			exit(EXIT_FAILURE);
 		}
+		buftune_update(&bt, n);
+		pos += n;
+		dirty += n;
+		if (wflag)
+			behind(pos, &started, &prev);
+		if ((bytes && dirty >= bytes) ||
+		    (ms && now() - last >= ms / 1000.0)) {
+			datasync();
+			dirty = 0;
+			last = now();
+		}
+	}
 
 	if (n < 0) {
 		perror("read error");
 		exit(EXIT_FAILURE);
 	}
 
+	if (dirty && (bytes || ms))
+		datasync();
+	if (verbose)
+		report();
+
 	return EXIT_SUCCESS;
 }
+
+static double
+now(void) {
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* fdatasync(2) stdout, and remember how long that took. */
+static void
+datasync(void) {
+	static size_t alloc;
+	double start;
+
+	start = now();
+	if (fdatasync(STDOUT_FILENO) < 0) {
+		perror("fdatasync");
+		exit(EXIT_FAILURE);
+	}
+	if (nlat == alloc) {
+		alloc = alloc ? 2 * alloc : 1024;
+		if ((lat = realloc(lat, alloc * sizeof(*lat))) == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	lat[nlat++] = now() - start;
+}
+
+/*
+ * Once another BEHIND bytes have been written since *started, have the
+ * kernel start writing them out, and wait for the chunk before that,
+ * at *prev, to be written.
+ */
+static void
+behind(off_t pos, off_t *started, off_t *prev) {
+#ifdef SYNC_FILE_RANGE_WRITE
+	if (pos - *started < BEHIND)
+		return;
+	if (sync_file_range(STDOUT_FILENO, *started, pos - *started,
+	    SYNC_FILE_RANGE_WRITE) < 0) {
+		perror("sync_file_range");
+		exit(EXIT_FAILURE);
+	}
+	if (*started > *prev && sync_file_range(STDOUT_FILENO, *prev,
+	    *started - *prev, SYNC_FILE_RANGE_WAIT_BEFORE |
+	    SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) < 0) {
+		perror("sync_file_range");
+		exit(EXIT_FAILURE);
+	}
+	*prev = *started;
+	*started = pos;
+#else
+	(void)pos;
+	(void)started;
+	(void)prev;
+#endif
+}
+
+static void
+report(void) {
+	double sum;
+	size_t i;
+
+	if (nlat == 0) {
+		fprintf(stderr, "no syncs\n");
+		return;
+	}
+	qsort(lat, nlat, sizeof(*lat), cmpdouble);
+	sum = 0;
+	for (i = 0; i < nlat; i++)
+		sum += lat[i];
+	fprintf(stderr, "%zu syncs, %.3f ms total; p50 %.3f p90 %.3f "
+	    "p99 %.3f max %.3f ms\n", nlat, sum * 1000,
+	    lat[(nlat - 1) * 50 / 100] * 1000,
+	    lat[(nlat - 1) * 90 / 100] * 1000,
+	    lat[(nlat - 1) * 99 / 100] * 1000, lat[nlat - 1] * 1000);
+}
+
+static int
+cmpdouble(const void *a, const void *b) {
+	double x, y;
+
+	x = *(const double *)a;
+	y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void
+usage(void) {
+	fprintf(stderr, "usage: sync-cat [-vw] [-b bytes] [-t ms]\n");
+	exit(EXIT_FAILURE);
+}
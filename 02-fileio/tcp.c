@@ -0,0 +1,132 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * tcp(1): trivially copy a file, using read(2) and write(2).
+ *
+ * ./tcp source target
+ * ./tcp source directory
+ *
+ * Files with holes in them are copied with the holes; see sparse.c.
+ * Try it on the file hole.c creates, and compare the number of blocks
+ * the copy takes up with that of a copy made by simple-cat.c:
+ *
+ * ./hole && ./tcp file.hole file.hole.copy && ls -ls file.hole*
+ *
+ * cc -Wall tcp.c sparse.c -o tcp
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sparse.h"
+
+#define BUFFSIZE	65536
+
+static void copyfd(int, int);
+static void fail(const char *);
+
+static const char *what;
+
+int
+main(int argc, char **argv) {
+	char target[PATH_MAX], base[PATH_MAX];
+	char *buf;
+	struct stat sst, tst;
+	int in, out;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: tcp source target\n");
+		exit(EXIT_FAILURE);
+	}
+
+	what = argv[1];
+	if ((in = open(argv[1], O_RDONLY)) < 0 || fstat(in, &sst) < 0)
+		fail("open");
+	if (S_ISDIR(sst.st_mode)) {
+		errno = EISDIR;
+		fail("open");
+	}
+
+	/* A directory as the target means the same name, in there. */
+	(void)strncpy(target, argv[2], sizeof(target) - 1);
+	target[sizeof(target) - 1] = '\0';
+	if (stat(argv[2], &tst) == 0 && S_ISDIR(tst.st_mode)) {
+		(void)strncpy(base, argv[1], sizeof(base) - 1);
+		base[sizeof(base) - 1] = '\0';
+		if (snprintf(target, sizeof(target), "%s/%s", argv[2],
+		    basename(base)) >= (int)sizeof(target)) {
+			errno = ENAMETOOLONG;
+			what = argv[2];
+			fail("open");
+		}
+	}
+
+	what = target;
+	if (stat(target, &tst) == 0 && tst.st_dev == sst.st_dev &&
+	    tst.st_ino == sst.st_ino) {
+		fprintf(stderr, "tcp: %s and %s are the same file\n",
+		    argv[1], target);
+		exit(EXIT_FAILURE);
+	}
+	if ((out = open(target, O_WRONLY | O_CREAT | O_TRUNC,
+	    sst.st_mode & 07777)) < 0)
+		fail("open");
+
+	/* Files in /proc claim to be empty; read those to make sure. */
+	if (S_ISREG(sst.st_mode) && sst.st_size > 0 &&
+	    fstat(out, &tst) == 0 && S_ISREG(tst.st_mode)) {
+		if ((buf = malloc(BUFFSIZE)) == NULL)
+			fail("malloc");
+		if (sparsecopy(in, out, sst.st_size, buf, BUFFSIZE) < 0)
+			fail("copy");
+		free(buf);
+	} else
+		copyfd(in, out);
+
+	if (close(out) < 0)
+		fail("close");
+	(void)close(in);
+	return EXIT_SUCCESS;
+}
+
+/* Anything else just gets read until it ends. */
+static void
+copyfd(int in, int out) {
+	char buf[BUFFSIZE];
+	ssize_t n;
+
+	while ((n = read(in, buf, sizeof(buf))) > 0)
+		if (write(out, buf, n) != n)
+			fail("write");
+	if (n < 0)
+		fail("read");
+}
+
+static void
+fail(const char *op) {
+	fprintf(stderr, "tcp: Unable to %s %s: %s\n", op, what,
+	    strerror(errno));
+	exit(EXIT_FAILURE);
+}
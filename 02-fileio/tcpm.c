@@ -0,0 +1,278 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * tcpm(1): trivially copy a file, using mmap(2) and memcpy(3).
+ *
+ * ./tcpm source target
+ * ./tcpm source directory
+ *
+ * Mapping all of both files at once is simple, but fails for files
+ * larger than the address space, and even where it works, leaves the
+ * kernel to guess which of the pages we are done with.  So we map the
+ * files one window of WINDOW bytes at a time, and tell the kernel what
+ * we are up to with madvise(2):
+ *
+ *   - the source window is read sequentially, and we'll need all of it
+ *     soon, so it may as well start reading ahead;
+ *   - what we already copied, we won't look at again, and once a
+ *     window is done, neither the source nor, once written, the
+ *     target needs to stay in the page cache on our account;
+ *   - if the kernel can back the mappings with huge pages, it should,
+ *     since that means far fewer page faults.  Where it can't, it
+ *     ignores the hint.
+ *
+ * Before copying anything, the target is made as large as the source,
+ * as we can't map past its end, and its blocks are allocated up front
+ * with fallocate(2), which keeps it from fragmenting as we go and
+ * makes us run out of space now rather than halfway through with a
+ * SIGBUS.
+ *
+ * Only the parts of the source that hold data are mapped and copied;
+ * holes stay holes, just like with tcp(1).  See sparse.c.  However, the
+ * kernel may cache, and then write, the target in pages larger than
+ * the ones we wrote to, which fills in the edges of the holes next to
+ * them; so once we're done, we punch the holes back out.
+ *
+ * Compare it to tcp(1) with 'make tcpbench'.
+ *
+ * cc -Wall tcpm.c sparse.c -o tcpm
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sparse.h"
+
+/* How much of each file to map at a time, and to copy between hints. */
+#define WINDOW	(64 * 1024 * 1024)
+#define STEP	(4 * 1024 * 1024)
+
+#define BUFFSIZE	65536
+
+static void allocate(int, off_t, off_t);
+static void copyfd(int, int);
+static void fail(const char *);
+static void mapcopy(int, int, off_t);
+static void punch(int, off_t, off_t);
+
+static const char *what;
+
+int
+main(int argc, char **argv) {
+	char target[PATH_MAX], base[PATH_MAX];
+	struct stat sst, tst;
+	int in, out;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: tcpm source target\n");
+		exit(EXIT_FAILURE);
+	}
+
+	what = argv[1];
+	if ((in = open(argv[1], O_RDONLY)) < 0 || fstat(in, &sst) < 0)
+		fail("open");
+	if (S_ISDIR(sst.st_mode)) {
+		errno = EISDIR;
+		fail("open");
+	}
+
+	/* A directory as the target means the same name, in there. */
+	(void)strncpy(target, argv[2], sizeof(target) - 1);
+	target[sizeof(target) - 1] = '\0';
+	if (stat(argv[2], &tst) == 0 && S_ISDIR(tst.st_mode)) {
+		(void)strncpy(base, argv[1], sizeof(base) - 1);
+		base[sizeof(base) - 1] = '\0';
+		if (snprintf(target, sizeof(target), "%s/%s", argv[2],
+		    basename(base)) >= (int)sizeof(target)) {
+			errno = ENAMETOOLONG;
+			what = argv[2];
+			fail("open");
+		}
+	}
+
+	what = target;
+	if (stat(target, &tst) == 0 && tst.st_dev == sst.st_dev &&
+	    tst.st_ino == sst.st_ino) {
+		fprintf(stderr, "tcpm: %s and %s are the same file\n",
+		    argv[1], target);
+		exit(EXIT_FAILURE);
+	}
+
+	/* We need to read what we map for writing, too. */
+	if ((out = open(target, O_RDWR | O_CREAT | O_TRUNC,
+	    sst.st_mode & 07777)) < 0)
+		fail("open");
+
+	/*
+	 * Only plain files can be mapped.  Files in /proc claim to be
+	 * empty, and an empty file can't be mapped at all.
+	 */
+	if (S_ISREG(sst.st_mode) && sst.st_size > 0 &&
+	    fstat(out, &tst) == 0 && S_ISREG(tst.st_mode))
+		mapcopy(in, out, sst.st_size);
+	else
+		copyfd(in, out);
+
+	if (close(out) < 0)
+		fail("close");
+	(void)close(in);
+	return EXIT_SUCCESS;
+}
+
+static void
+mapcopy(int in, int out, off_t size) {
+	off_t off, start, end, wstart, wend, pos, n;
+	char *src, *dst;
+	int r;
+
+	if (ftruncate(out, size) < 0)
+		fail("truncate");
+
+	for (off = 0; (r = nextdata(in, off, size, &start, &end)) > 0;
+	    off = end)
+		allocate(out, start, end - start);
+	if (r < 0)
+		fail("copy");
+
+	for (off = 0; (r = nextdata(in, off, size, &start, &end)) > 0;
+	    off = end) {
+		/*
+		 * Windows are aligned to WINDOW, which is a multiple of
+		 * both the page size and the huge page size.
+		 */
+		for (pos = start; pos < end; pos = wend) {
+			wstart = pos - pos % WINDOW;
+			wend = wstart + WINDOW < end ? wstart + WINDOW : end;
+
+			src = mmap(NULL, wend - wstart, PROT_READ, MAP_SHARED,
+			    in, wstart);
+			if (src == MAP_FAILED)
+				fail("mmap");
+			dst = mmap(NULL, wend - wstart, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, out, wstart);
+			if (dst == MAP_FAILED)
+				fail("mmap");
+
+			(void)madvise(src, wend - wstart, MADV_SEQUENTIAL);
+			(void)madvise(src, wend - wstart, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+			(void)madvise(src, wend - wstart, MADV_HUGEPAGE);
+			(void)madvise(dst, wend - wstart, MADV_HUGEPAGE);
+#endif
+
+			for (; pos < wend; pos += n) {
+				n = wend - pos < STEP ? wend - pos : STEP;
+				(void)memcpy(dst + (pos - wstart),
+				    src + (pos - wstart), n);
+				(void)madvise(src + (pos - wstart) -
+				    (pos - wstart) % getpagesize(),
+				    n + (pos - wstart) % getpagesize(),
+				    MADV_DONTNEED);
+			}
+
+			if (munmap(src, wend - wstart) < 0 ||
+			    munmap(dst, wend - wstart) < 0)
+				fail("munmap");
+#ifdef POSIX_FADV_DONTNEED
+			(void)posix_fadvise(in, wstart, wend - wstart,
+			    POSIX_FADV_DONTNEED);
+#endif
+#ifdef SYNC_FILE_RANGE_WRITE
+			/* Start writing it, so it can leave the cache soon. */
+			(void)sync_file_range(out, wstart, wend - wstart,
+			    SYNC_FILE_RANGE_WRITE);
+#endif
+		}
+	}
+	if (r < 0)
+		fail("copy");
+
+	for (off = 0; (r = nextdata(in, off, size, &start, &end)) > 0;
+	    off = end)
+		if (start > off)
+			punch(out, off, start - off);
+	if (r < 0)
+		fail("copy");
+	if (off < size)
+		punch(out, off, size - off);
+}
+
+/*
+ * Allocate the blocks the data will go into.  Not every file system can
+ * do that, which is fine; posix_fallocate(3) would fall back to writing
+ * zeros, which we don't want, so we only use fallocate(2) where we have
+ * it.
+ */
+static void
+allocate(int fd, off_t off, off_t len) {
+#ifdef __linux__
+	if (fallocate(fd, 0, off, len) < 0 && errno != EOPNOTSUPP &&
+	    errno != ENOSYS)
+		fail("allocate");
+#else
+	(void)fd;
+	(void)off;
+	(void)len;
+#endif
+}
+
+/* Turn what should be a hole in the target back into one. */
+static void
+punch(int fd, off_t off, off_t len) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off,
+	    len) < 0 && errno != EOPNOTSUPP && errno != ENOSYS)
+		fail("punch holes in");
+#else
+	(void)fd;
+	(void)off;
+	(void)len;
+#endif
+}
+
+/* Anything else just gets read until it ends. */
+static void
+copyfd(int in, int out) {
+	char buf[BUFFSIZE];
+	ssize_t n;
+
+	while ((n = read(in, buf, sizeof(buf))) > 0)
+		if (write(out, buf, n) != n)
+			fail("write");
+	if (n < 0)
+		fail("read");
+}
+
+static void
+fail(const char *op) {
+	fprintf(stderr, "tcpm: Unable to %s %s: %s\n", op, what,
+	    strerror(errno));
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,192 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * Connection buffers, and splitting what comes in on a stream socket
+ * into messages.
+ *
+ * The simple servers read(2) into a buffer on the stack, bzero(3) it
+ * first so that whatever they read ends up NUL-terminated, and then
+ * print it as a string.  That clears 8K for every read, no matter how
+ * little arrives; it cuts a message short at the first NUL; and it
+ * takes whatever a single read(2) returns to be a message, when TCP may
+ * just as well deliver half a message, or one and a half.
+ *
+ * Instead, each connection gets a buffer from a pool.  The pool carves
+ * buffers out of larger "slabs" and, when a connection is done, puts
+ * its buffer on a free list for the next one, so that after the first
+ * few connections nothing is allocated at all.  Nothing is ever zeroed
+ * either: a buffer knows how much of it is in use.
+ *
+ * Messages are separated by newlines, or by CRLF.  After each read,
+ * every complete message is handed to the caller, with its length and
+ * without the line ending, and whatever comes after the last newline
+ * stays in the buffer for the next read to complete.  A message that doesn't fit into the buffer is handed out
+ * in pieces; whatever is left when the connection closes is the last
+ * message.
+ *
+ * A pool is not locked; give each thread its own.
+ */
+
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "connbuf.h"
+
+struct slab {
+	struct slab	*next;
+	struct connbuf	 bufs[];
+};
+
+struct bufpool {
+	struct connbuf	*free;
+	struct slab	*slabs;
+};
+
+struct bufpool *
+bufpool_new(void)
+{
+	return calloc(1, sizeof(struct bufpool));
+}
+
+void
+bufpool_free(struct bufpool *p)
+{
+	struct slab *s;
+
+	while ((s = p->slabs) != NULL) {
+		p->slabs = s->next;
+		free(s);
+	}
+	free(p);
+}
+
+/* Returns NULL only if we need another slab and can't get one. */
+struct connbuf *
+bufpool_get(struct bufpool *p)
+{
+	struct connbuf *b;
+	struct slab *s;
+	int i;
+
+	if (p->free == NULL) {
+		/* malloc(3), not calloc(3): we never look at unused bytes. */
+		if ((s = malloc(sizeof(*s) +
+		    BUFPOOL_SLAB * sizeof(struct connbuf))) == NULL)
+			return NULL;
+		s->next = p->slabs;
+		p->slabs = s;
+		for (i = 0; i < BUFPOOL_SLAB; i++) {
+			s->bufs[i].next = p->free;
+			p->free = &s->bufs[i];
+		}
+	}
+
+	b = p->free;
+	p->free = b->next;
+	b->off = b->scan = b->len = 0;
+	return b;
+}
+
+void
+bufpool_put(struct bufpool *p, struct connbuf *b)
+{
+	b->next = p->free;
+	p->free = b;
+}
+
+/*
+ * Read as much as fits after what's already in the buffer; returns
+ * whatever read(2) did.
+ */
+ssize_t
+connbuf_read(int fd, struct connbuf *b)
+{
+	ssize_t n;
+
+	/* Only move the start of a message down when we have to. */
+	if (b->len == sizeof(b->data) && b->off > 0) {
+		(void)memmove(b->data, b->data + b->off, b->len - b->off);
+		b->len -= b->off;
+		b->scan -= b->off;
+		b->off = 0;
+	}
+
+	if ((n = read(fd, b->data + b->len, sizeof(b->data) - b->len)) > 0)
+		b->len += n;
+	return n;
+}
+
+/* Hand out every complete message in the buffer. */
+void
+connbuf_frames(struct connbuf *b, frame_fn fn, void *arg)
+{
+	char *nl;
+	size_t len;
+
+	while ((nl = memchr(b->data + b->scan, '\n', b->len - b->scan)) != NULL) {
+		len = nl - (b->data + b->off);
+		/* telnet(1) and friends end their lines with CRLF. */
+		if (len > 0 && nl[-1] == '\r')
+			len--;
+		fn(b->data + b->off, len, arg);
+		b->off = b->scan = nl - b->data + 1;
+	}
+	b->scan = b->len;
+
+	if (b->off == b->len)
+		b->off = b->scan = b->len = 0;
+	else if (b->off == 0 && b->len == sizeof(b->data)) {
+		/* No newline in sight, and no room to wait for one. */
+		fn(b->data, b->len, arg);
+		b->off = b->scan = b->len = 0;
+	}
+}
+
+/* Hand out what's left at the end of the connection, if anything. */
+void
+connbuf_rest(struct connbuf *b, frame_fn fn, void *arg)
+{
+	if (b->off < b->len)
+		fn(b->data + b->off, b->len - b->off, arg);
+	b->off = b->scan = b->len = 0;
+}
+
+/*
+ * Print a message, which may be anything, so that it doesn't mess up
+ * the terminal: bytes that aren't printable come out as \ooo.
+ */
+void
+frame_print(FILE *fp, const char *msg, size_t len)
+{
+	size_t i, start;
+
+	for (i = start = 0; i < len; i++) {
+		if (isprint((unsigned char)msg[i]) && msg[i] != '\\')
+			continue;
+		(void)fwrite(msg + start, 1, i - start, fp);
+		if (msg[i] == '\\')
+			(void)fputs("\\\\", fp);
+		else
+			(void)fprintf(fp, "\\%03o", (unsigned char)msg[i]);
+		start = i + 1;
+	}
+	(void)fwrite(msg + start, 1, len - start, fp);
+}
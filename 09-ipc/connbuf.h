@@ -0,0 +1,60 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+#ifndef _CONNBUF_H_
+#define _CONNBUF_H_
+
+#include <sys/types.h>
+
+#include <stdio.h>
+
+#define CONNBUF_SIZE	BUFSIZ
+
+/* How many buffers to allocate at once when the pool runs dry. */
+#define BUFPOOL_SLAB	16
+
+/*
+ * What a connection has read so far: data[off] up to data[len] is what
+ * hasn't been handed out as a message yet, and everything before
+ * data[scan] in there is known not to contain a newline.
+ */
+struct connbuf {
+	struct connbuf	*next;		/* on the free list */
+	size_t		 off;
+	size_t		 scan;
+	size_t		 len;
+	char		 data[CONNBUF_SIZE];
+};
+
+struct bufpool;
+
+/*
+ * Called for each message, without its newline (or CRLF).  The message
+ * is not NUL-terminated, and may contain anything, including NULs.
+ */
+typedef void (*frame_fn)(const char *, size_t, void *);
+
+struct bufpool	*bufpool_new(void);
+void		 bufpool_free(struct bufpool *);
+struct connbuf	*bufpool_get(struct bufpool *);
+void		 bufpool_put(struct bufpool *, struct connbuf *);
+
+ssize_t		 connbuf_read(int, struct connbuf *);
+void		 connbuf_frames(struct connbuf *, frame_fn, void *);
+void		 connbuf_rest(struct connbuf *, frame_fn, void *);
+
+void		 frame_print(FILE *, const char *, size_t);
+
+#endif /* !_CONNBUF_H_ */
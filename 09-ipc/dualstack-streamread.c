@@ -19,6 +19,8 @@
  * IPv6, or to use a dual-stack socket.
  *
  * ./a.out [4|6]
+ *
+ * cc -Wall dualstack-streamread.c connbuf.c
  */
 
 #include <arpa/inet.h>
@@ -33,9 +35,20 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "connbuf.h"
+
 #define BACKLOG 5
 
-/* Everything is stuffed into one giant 'main' here to
+/* Called for each message the client sends; peer is "address:port". */
+static void
+printMessage(const char *msg, size_t len, void *peer)
+{
+	(void)printf("Client (%s) sent: \"", (const char *)peer);
+	frame_print(stdout, msg, len);
+	(void)printf("\"\n");
+}
+
+/* Everything else is stuffed into one giant 'main' here to
  * allow the reader to follow step-by-step without
  * having to jump around.  Normally, you'd probably
  * want to modularize this a bit. */
@@ -43,6 +56,7 @@
 int
 main(int argc, char **argv)
 {
+	struct bufpool *pool;
 	int domain, sock, v4or6, v6only;
 	void *s;
 	socklen_t length, s_size;
@@ -135,9 +149,22 @@ main(int argc, char **argv)
 		/* NOTREACHED */
 	}
 
+	if ((pool = bufpool_new()) == NULL) {
+		perror("bufpool_new");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
 	while (1) {
-		int fd, rval;
+		char claddr[INET6_ADDRSTRLEN];
+		char peer[INET6_ADDRSTRLEN + sizeof(":65535")];
+		struct connbuf *b;
+		struct sockaddr_storage addr;
 		struct sockaddr_in6 client;
+		socklen_t len;
+		const char *rip;
+		ssize_t rval;
+		int fd, port;
 		memset(&client, 0, sizeof(client));
 
 		length = sizeof(client);
@@ -146,47 +173,44 @@ main(int argc, char **argv)
 			continue;
 		}
 
-		do {
-			char buf[BUFSIZ];
-			char claddr[INET6_ADDRSTRLEN];
-			struct sockaddr_storage addr;
-			socklen_t len;
-			const char *rip;
-			int port;
-
-			bzero(buf, sizeof(buf));
-			if ((rval = read(fd, buf, BUFSIZ)) < 0) {
-				perror("reading stream message");
-				break;
-			}
-
-			if (rval == 0) {
-				(void)printf("Ending connection\n");
-				break;
-			}
-
-			len = sizeof(addr);
-			if (getpeername(fd, (struct sockaddr *)&addr, &len) < 0) {
-				perror("getpeername");
-				break;
-			}
-
-			if (domain == PF_INET) {
-				struct sockaddr_in *s = (struct sockaddr_in *)&addr;
-				port = ntohs(s->sin_port);
-				rip = inet_ntop(PF_INET, &s->sin_addr, claddr, sizeof(claddr));
-			} else {
-				struct sockaddr_in6 *s = (struct sockaddr_in6 *)&addr;
-				port = ntohs(s->sin6_port);
-				rip = inet_ntop(PF_INET6, &s->sin6_addr, claddr, sizeof(claddr));
-			}
-
-			if (rip == NULL) {
-				perror("inet_ntop");
-				rip = "unknown";
-			}
-			(void)printf("Client (%s:%d) sent: \"%s\"\n", rip, port, buf);
-		} while (rval != 0);
+		len = sizeof(addr);
+		if (getpeername(fd, (struct sockaddr *)&addr, &len) < 0) {
+			perror("getpeername");
+			(void)close(fd);
+			continue;
+		}
+
+		if (domain == PF_INET) {
+			struct sockaddr_in *s = (struct sockaddr_in *)&addr;
+			port = ntohs(s->sin_port);
+			rip = inet_ntop(PF_INET, &s->sin_addr, claddr, sizeof(claddr));
+		} else {
+			struct sockaddr_in6 *s = (struct sockaddr_in6 *)&addr;
+			port = ntohs(s->sin6_port);
+			rip = inet_ntop(PF_INET6, &s->sin6_addr, claddr, sizeof(claddr));
+		}
+
+		if (rip == NULL) {
+			perror("inet_ntop");
+			rip = "unknown";
+		}
+		(void)snprintf(peer, sizeof(peer), "%s:%d", rip, port);
+
+		/* See connbuf.c for how we get from reads to messages. */
+		if ((b = bufpool_get(pool)) == NULL) {
+			perror("getting a buffer");
+			(void)close(fd);
+			continue;
+		}
+
+		while ((rval = connbuf_read(fd, b)) > 0)
+			connbuf_frames(b, printMessage, peer);
+		if (rval < 0)
+			perror("reading stream message");
+		connbuf_rest(b, printMessage, peer);
+		(void)printf("Ending connection\n");
+
+		bufpool_put(pool, b);
 		(void)close(fd);
 	}
 
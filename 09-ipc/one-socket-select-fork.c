@@ -16,6 +16,13 @@
 /* This program shows how we can combine select(2) and
  * a per-connection fork(2) model to handle
  * simultaneous connections in a typical server setup.
+ *
+ * With -p, it instead forks a pool of workers up front
+ * that take turns handling connections; see prefork.c.
+ * -m, -M, and -n set the minimum and maximum number of
+ * idle workers, and the maximum number of workers.
+ *
+ * cc -Wall one-socket-select-fork.c prefork.c
  */
 #include <arpa/inet.h>
 
@@ -34,6 +41,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "prefork.h"
+
 #define BACKLOG 5
 
 #ifndef SLEEP
@@ -106,9 +115,8 @@ handleConnection(int fd, struct sockaddr_in6 client)
 			printf("Client (%s) sent: %s", rip, buf);
 	} while (rval != 0);
 	(void)close(fd);
-	exit(EXIT_SUCCESS);
-	/* NOTREACHED */
 }
+
 void
 handleSocket(int s)
 {
@@ -131,20 +139,66 @@ handleSocket(int s)
 		/* NOTREACHED */
 	} else if (!pid) {
 		handleConnection(fd, client);
+		exit(EXIT_SUCCESS);
 		/* NOTREACHED */
 	}
 	/* parent silently returns */
+	(void)close(fd);
 }
 
+/*
+ * Several children may have exited by the time we get
+ * here, but we only get one SIGCHLD, so collect all of
+ * them, not just one.
+ */
 void
 reap() {
-	wait(NULL);
+	int save;
+
+	save = errno;
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+	errno = save;
 }
 
 int
-main()
+main(int argc, char **argv)
 {
-	int s1;
+	struct prefork pool;
+	int ch, pflag, s1;
+
+	pflag = 0;
+	pool.minspare = PREFORK_MINSPARE;
+	pool.maxspare = PREFORK_MAXSPARE;
+	pool.max = PREFORK_MAX;
+	while ((ch = getopt(argc, argv, "M:m:n:p")) != -1) {
+		switch (ch) {
+		case 'M':
+			pool.maxspare = atoi(optarg);
+			break;
+		case 'm':
+			pool.minspare = atoi(optarg);
+			break;
+		case 'n':
+			pool.max = atoi(optarg);
+			break;
+		case 'p':
+			pflag = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p [-m minspare] "
+			    "[-M maxspare] [-n max]]\n", argv[0]);
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+	if (pool.minspare < 1 || pool.maxspare < pool.minspare ||
+	    pool.max < pool.minspare) {
+		fprintf(stderr, "need 0 < minspare <= maxspare, "
+		    "and minspare <= max\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
 
 	if (signal(SIGCHLD, reap) == SIG_ERR) {
 		perror("signal");
@@ -152,8 +206,17 @@ main()
 		/* NOTREACHED */
 	}
 
+	/* Workers print as they go; don't let that sit in a buffer. */
+	if (pflag)
+		setvbuf(stdout, NULL, _IOLBF, 0);
+
 	s1 = createSocket();
 
+	if (pflag) {
+		prefork_run(s1, &pool, handleConnection);
+		/* NOTREACHED */
+	}
+
 	for (;;) {
 		fd_set ready;
 		struct timeval to;
@@ -0,0 +1,284 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * A pool of pre-forked workers, the way Apache's "prefork" does it.
+ *
+ * Forking a new process for every connection, as
+ * one-socket-select-fork.c and strchkread2.c do, means that every
+ * client first waits for a fork(2), and a burst of clients means a
+ * burst of forks.
+ * Instead, we fork a few workers up front, each of which accept(2)s on
+ * the same listening socket, handles the connection, and then goes
+ * back to accept(2) the next one.  All of them block in accept(2) on
+ * the one socket, and the kernel hands each new connection to exactly
+ * one of them, so there is no need to take turns.  (We don't give each
+ * worker a socket of its own with SO_REUSEPORT: connections that are
+ * queued on a worker's socket when it goes away are reset.)
+ *
+ * The parent doesn't handle any connections.  It keeps track of how
+ * many workers are idle, via a "scoreboard" in memory shared with all
+ * of them, and once a second, forks more if fewer than minspare are
+ * waiting, or asks one to leave if more than maxspare are.  A worker
+ * that's asked to leave finishes the connection it's handling, if any,
+ * first.
+ *
+ * Dead workers are reaped with waitpid(2) and WNOHANG in a loop:
+ * several children may exit before we get to run, but we only get one
+ * SIGCHLD for all of them, so a single wait(2) would leave zombies
+ * behind.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "prefork.h"
+
+/* At most this many new workers per second; doubled while it's needed. */
+#define SPAWN_MAX	32
+
+enum { W_EMPTY, W_STARTING, W_IDLE, W_BUSY };
+
+struct worker {
+	pid_t		pid;
+	volatile int	state;
+	volatile int	quit;		/* set by the parent */
+};
+
+static struct worker *board;
+static volatile sig_atomic_t done;
+
+static void nothing(int);
+static void reapall(int);
+static void stop(int);
+static void spawn(int, int, prefork_fn);
+static void work(int, struct worker *, prefork_fn);
+
+/*
+ * Keep a pool of workers accept(2)ing on sock and calling fn for each
+ * connection, within the limits in p, until we get SIGINT or SIGTERM.
+ */
+void
+prefork_run(int sock, const struct prefork *p, prefork_fn fn)
+{
+	struct sigaction sa;
+	struct timespec second;
+	int i, idle, total, n, rate;
+	sigset_t chld, old;
+
+	board = mmap(NULL, p->max * sizeof(*board), PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_ANON, -1, 0);
+	if (board == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+	(void)memset(board, 0, p->max * sizeof(*board));
+
+	(void)memset(&sa, 0, sizeof(sa));
+	(void)sigemptyset(&sa.sa_mask);
+	sa.sa_handler = nothing;
+	(void)sigaction(SIGCHLD, &sa, NULL);
+	sa.sa_handler = stop;
+	(void)sigaction(SIGINT, &sa, NULL);
+	(void)sigaction(SIGTERM, &sa, NULL);
+
+	(void)sigemptyset(&chld);
+	(void)sigaddset(&chld, SIGCHLD);
+
+	rate = 1;
+	while (!done) {
+		/* Don't let a child's exit interfere with the counting. */
+		(void)sigprocmask(SIG_BLOCK, &chld, &old);
+		reapall(p->max);
+
+		idle = total = 0;
+		for (i = 0; i < p->max; i++) {
+			if (board[i].state == W_EMPTY)
+				continue;
+			total++;
+			if ((board[i].state == W_IDLE ||
+			    board[i].state == W_STARTING) && !board[i].quit)
+				idle++;
+		}
+
+		if (idle < p->minspare && total < p->max) {
+			n = p->minspare - idle;
+			if (n > rate)
+				n = rate;
+			if (n > p->max - total)
+				n = p->max - total;
+			spawn(n, sock, fn);
+			if (rate < SPAWN_MAX)
+				rate *= 2;
+		} else {
+			rate = 1;
+			if (idle > p->maxspare) {
+				/* One at a time, so we don't overshoot. */
+				for (i = 0; i < p->max; i++)
+					if (board[i].state == W_IDLE &&
+					    !board[i].quit)
+						break;
+				if (i < p->max) {
+					board[i].quit = 1;
+					(void)kill(board[i].pid, SIGUSR1);
+				}
+			}
+		}
+		(void)sigprocmask(SIG_SETMASK, &old, NULL);
+
+		/* A SIGCHLD cuts this short, which is what we want. */
+		second.tv_sec = 1;
+		second.tv_nsec = 0;
+		(void)nanosleep(&second, NULL);
+	}
+
+	for (i = 0; i < p->max; i++)
+		if (board[i].state != W_EMPTY)
+			(void)kill(board[i].pid, SIGTERM);
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+	exit(EXIT_SUCCESS);
+}
+
+/* Fork n more workers into empty slots; the caller made sure there are. */
+static void
+spawn(int n, int sock, prefork_fn fn)
+{
+	pid_t pid;
+	int i;
+
+	for (i = 0; n > 0; n--, i++) {
+		while (board[i].state != W_EMPTY)
+			i++;
+		board[i].state = W_STARTING;
+		board[i].quit = 0;
+		if ((pid = fork()) < 0) {
+			perror("fork");
+			board[i].state = W_EMPTY;
+			return;
+		} else if (pid == 0) {
+			work(sock, &board[i], fn);
+			/* NOTREACHED */
+		}
+		board[i].pid = pid;
+	}
+}
+
+static void
+work(int sock, struct worker *w, prefork_fn fn)
+{
+	struct sigaction sa;
+	struct sockaddr_in6 client;
+	socklen_t length;
+	sigset_t usr1, waiting;
+	fd_set ready;
+	int fd;
+
+	/*
+	 * SIGUSR1 is how the parent gets our attention while we wait for
+	 * a connection; it must interrupt the wait, not restart it.
+	 */
+	(void)memset(&sa, 0, sizeof(sa));
+	(void)sigemptyset(&sa.sa_mask);
+	sa.sa_handler = nothing;
+	(void)sigaction(SIGUSR1, &sa, NULL);
+	sa.sa_handler = SIG_DFL;
+	(void)sigaction(SIGCHLD, &sa, NULL);
+	(void)sigaction(SIGINT, &sa, NULL);
+	(void)sigaction(SIGTERM, &sa, NULL);
+
+	/*
+	 * If SIGUSR1 came after we looked at w->quit, but before we
+	 * blocked in accept(2), we would never notice it.  So it is
+	 * blocked everywhere except in pselect(2), which lets it in
+	 * atomically with starting to wait, and returns at once if it
+	 * is already pending.  Only then do we accept(2), without
+	 * blocking, since another worker may have beaten us to it.
+	 */
+	(void)sigemptyset(&usr1);
+	(void)sigaddset(&usr1, SIGUSR1);
+	(void)sigprocmask(SIG_BLOCK, &usr1, &waiting);
+	(void)sigdelset(&waiting, SIGUSR1);
+	(void)fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+	while (!w->quit) {
+		w->state = W_IDLE;
+		FD_ZERO(&ready);
+		FD_SET(sock, &ready);
+		if (pselect(sock + 1, &ready, NULL, NULL, NULL,
+		    &waiting) < 0) {
+			if (errno != EINTR)
+				perror("pselect");
+			continue;
+		}
+		length = sizeof(client);
+		if ((fd = accept(sock, (struct sockaddr *)&client,
+		    &length)) < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+			    errno != ECONNABORTED && errno != EINTR)
+				perror("accept");
+			continue;
+		}
+		/* On the BSDs, it inherits O_NONBLOCK from sock. */
+		(void)fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+		w->state = W_BUSY;
+		fn(fd, client);
+	}
+	exit(EXIT_SUCCESS);
+	/* NOTREACHED */
+}
+
+/* Collect all the workers that have exited, and free their slots. */
+static void
+reapall(int max)
+{
+	pid_t pid;
+	int i;
+
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+		for (i = 0; i < max; i++)
+			if (board[i].state != W_EMPTY && board[i].pid == pid) {
+				board[i].state = W_EMPTY;
+				break;
+			}
+}
+
+static void
+nothing(int sig)
+{
+	(void)sig;
+}
+
+static void
+stop(int sig)
+{
+	(void)sig;
+	done = 1;
+}
@@ -0,0 +1,40 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+#ifndef _PREFORK_H_
+#define _PREFORK_H_
+
+#include <netinet/in.h>
+
+/* How many workers to keep around: waiting, in total, and at most. */
+#define PREFORK_MINSPARE	5
+#define PREFORK_MAXSPARE	10
+#define PREFORK_MAX		256
+
+struct prefork {
+	int	minspare;	/* start more if fewer than this are idle */
+	int	maxspare;	/* stop some if more than this are idle */
+	int	max;		/* never have more than this many workers */
+};
+
+/*
+ * Called in a worker for each connection it accepts; it has to close
+ * the descriptor, but must not exit.
+ */
+typedef void (*prefork_fn)(int, struct sockaddr_in6);
+
+void	prefork_run(int, const struct prefork *, prefork_fn);
+
+#endif /* !_PREFORK_H_ */
@@ -0,0 +1,361 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * The server from one-socket-select.c and two-sockets-select.c, but
+ * without the catch: those use select(2) only to find out that someone
+ * wants to connect, and then sit in read(2) until that client goes
+ * away, so that nobody else gets a word in.
+ *
+ * Here, everything is non-blocking, and a single loop (see reactor.c)
+ * waits for any of the listening sockets and any of the connections at
+ * once: a listening socket that is ready gets all its pending
+ * connections accepted; a connection that is ready gets read until
+ * there is nothing more to read, and whatever complete lines it sent
+ * are printed.  Since we may only get part of a line at a time, each
+ * connection keeps what it has so far in a buffer from a pool shared by
+ * all of them, to pick up from there the next time around; see
+ * connbuf.c.
+ *
+ * A connection that hasn't sent anything for IDLE seconds is closed.
+ * Instead of select(2)'s timeout, a timer tells us every SLEEP seconds
+ * that there is nobody around.
+ *
+ * ./server		like one-socket-select.c
+ * ./server -n 2	like two-sockets-select.c
+ *
+ * cc -Wall reactor-server.c reactor.c connbuf.c -o server
+ */
+
+#include <arpa/inet.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "connbuf.h"
+#include "reactor.h"
+
+#ifndef SLEEP
+#define SLEEP   5
+#endif
+
+#ifndef IDLE
+#define IDLE	60
+#endif
+
+/* How long to wait before accepting again when we ran out of fds. */
+#define RETRY	100
+
+#define MAXSOCKETS	16
+
+struct listener {
+	int		fd;
+	int		full;		/* we ran out of descriptors */
+	struct rtimer	retry;
+};
+
+struct conn {
+	int		fd;
+	char		rip[INET6_ADDRSTRLEN];
+	struct connbuf	*buf;
+	struct rtimer	idle;
+};
+
+static int idle = IDLE;
+static int nconns;
+static struct bufpool *pool;
+static struct rtimer sleeper;
+
+static void acceptAll(struct reactor *, struct listener *);
+static void closeConn(struct reactor *, struct conn *, const char *);
+static int createSocket(void);
+static void handleConn(struct reactor *, int, int, void *);
+static void handleListener(struct reactor *, int, int, void *);
+static void idleConn(struct reactor *, void *);
+static void printLine(const char *, size_t, void *);
+static void retryAccept(struct reactor *, void *);
+static int setNonBlocking(int);
+static void sleepy(struct reactor *, void *);
+
+static int
+setNonBlocking(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL, 0)) < 0)
+		return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int
+createSocket(void)
+{
+	int sock;
+	socklen_t length;
+	struct sockaddr_in6 server;
+
+	memset(&server, 0, sizeof(server));
+
+	if ((sock = socket(PF_INET6, SOCK_STREAM, 0)) < 0) {
+		perror("opening stream socket");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	server.sin6_family = PF_INET6;
+	server.sin6_addr = in6addr_any;
+	server.sin6_port = 0;
+	if (bind(sock, (struct sockaddr *)&server, sizeof(server)) != 0) {
+		perror("binding stream socket");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	length = sizeof(server);
+	if (getsockname(sock, (struct sockaddr *)&server, &length) != 0) {
+		perror("getting socket name");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+	(void)printf("Socket has port #%d\n", ntohs(server.sin6_port));
+
+	/* Not 5: thousands of clients may show up at once. */
+	if (listen(sock, SOMAXCONN) < 0) {
+		perror("listening");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (setNonBlocking(sock) < 0) {
+		perror("fcntl");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	return sock;
+}
+
+static void
+handleListener(struct reactor *r, int fd, int what, void *arg)
+{
+	(void)fd;
+	(void)what;
+	acceptAll(r, arg);
+}
+
+/*
+ * We only hear about a listening socket again once another connection
+ * comes in, so accept all the ones that are waiting now.
+ */
+static void
+acceptAll(struct reactor *r, struct listener *l)
+{
+	struct sockaddr_in6 client;
+	socklen_t length;
+	struct conn *c;
+	int fd;
+
+	for (;;) {
+		length = sizeof(client);
+		if ((fd = accept(l->fd, (struct sockaddr *)&client,
+		    &length)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno == EMFILE || errno == ENFILE) {
+				/*
+				 * The rest will have to wait until some
+				 * other connection closes.
+				 */
+				if (!l->full)
+					perror("accept");
+				l->full = 1;
+				reactor_timer(r, &l->retry, RETRY,
+				    retryAccept, l);
+			} else if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("accept");
+			return;
+		}
+		l->full = 0;
+
+		if ((c = calloc(1, sizeof(*c))) == NULL ||
+		    (c->buf = bufpool_get(pool)) == NULL ||
+		    setNonBlocking(fd) < 0 ||
+		    reactor_add(r, fd, R_READ, handleConn, c) < 0) {
+			perror("setting up connection");
+			if (c != NULL && c->buf != NULL)
+				bufpool_put(pool, c->buf);
+			free(c);
+			(void)close(fd);
+			continue;
+		}
+		c->fd = fd;
+		if (inet_ntop(PF_INET6, &client.sin6_addr, c->rip,
+		    sizeof(c->rip)) == NULL)
+			(void)strncpy(c->rip, "unknown", sizeof(c->rip));
+		(void)printf("Client connection from %s!\n", c->rip);
+		nconns++;
+		reactor_timer(r, &c->idle, idle * 1000, idleConn, c);
+	}
+}
+
+static void
+retryAccept(struct reactor *r, void *arg)
+{
+	acceptAll(r, arg);
+}
+
+static void
+printLine(const char *line, size_t len, void *arg)
+{
+	struct conn *c;
+
+	c = arg;
+	(void)printf("Client (%s) sent: ", c->rip);
+	frame_print(stdout, line, len);
+	(void)printf("\n");
+}
+
+/*
+ * Read whatever is there, print each complete line, and keep the rest
+ * for next time.
+ */
+static void
+handleConn(struct reactor *r, int fd, int what, void *arg)
+{
+	struct conn *c;
+	ssize_t n;
+
+	(void)what;
+	c = arg;
+	for (;;) {
+		if ((n = connbuf_read(fd, c->buf)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			perror("reading stream message");
+			closeConn(r, c, "Dropping");
+			return;
+		}
+		if (n == 0) {
+			connbuf_rest(c->buf, printLine, c);
+			closeConn(r, c, "Ending");
+			return;
+		}
+		connbuf_frames(c->buf, printLine, c);
+	}
+
+	/* It's still alive; push its timeout back. */
+	reactor_timer(r, &c->idle, idle * 1000, idleConn, c);
+}
+
+static void
+idleConn(struct reactor *r, void *arg)
+{
+	closeConn(r, arg, "Timing out");
+}
+
+static void
+closeConn(struct reactor *r, struct conn *c, const char *how)
+{
+	(void)printf("%s connection from %s.\n", how, c->rip);
+	reactor_untimer(r, &c->idle);
+	reactor_del(r, c->fd);
+	(void)close(c->fd);
+	bufpool_put(pool, c->buf);
+	free(c);
+	nconns--;
+}
+
+static void
+sleepy(struct reactor *r, void *arg)
+{
+	(void)arg;
+	if (nconns == 0)
+		(void)printf("Idly sitting here, waiting for connections...\n");
+	reactor_timer(r, &sleeper, SLEEP * 1000, sleepy, NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct listener l[MAXSOCKETS];
+	struct reactor *r;
+	int ch, i, n;
+
+	n = 1;
+	while ((ch = getopt(argc, argv, "i:n:")) != -1) {
+		switch (ch) {
+		case 'i':
+			if ((idle = atoi(optarg)) < 1) {
+				fprintf(stderr, "invalid idle timeout\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'n':
+			n = atoi(optarg);
+			if (n < 1 || n > MAXSOCKETS) {
+				fprintf(stderr, "number of sockets must be "
+				    "between 1 and %d\n", MAXSOCKETS);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			fprintf(stderr, "usage: server [-i idle] [-n sockets]\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	/* We print as we go; don't let that sit in a buffer. */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if ((pool = bufpool_new()) == NULL) {
+		perror("creating buffer pool");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((r = reactor_new()) == NULL) {
+		perror("creating reactor");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < n; i++) {
+		memset(&l[i], 0, sizeof(l[i]));
+		l[i].fd = createSocket();
+		if (reactor_add(r, l[i].fd, R_READ, handleListener, &l[i]) < 0) {
+			perror("watching socket");
+			exit(EXIT_FAILURE);
+		}
+	}
+	reactor_timer(r, &sleeper, SLEEP * 1000, sleepy, NULL);
+
+	if (reactor_run(r) < 0) {
+		perror("waiting for events");
+		exit(EXIT_FAILURE);
+	}
+
+	/* NOTREACHED */
+	return EXIT_SUCCESS;
+}
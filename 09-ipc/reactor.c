@@ -0,0 +1,436 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * A small event loop ("reactor"): register file descriptors together
+ * with a function to call when they become readable or writable, and
+ * timers with a function to call when they expire, then let
+ * reactor_run() wait for either and call the functions.
+ *
+ * Unlike select(2) and poll(2), which are handed the full list of
+ * descriptors on every call and then have to look at every one of
+ * them, epoll(7) on Linux and kqueue(2) on the BSDs remember what we
+ * are interested in and only return what is ready, so that waiting
+ * costs the same with ten connections as with ten thousand.  Both are
+ * used edge-triggered: we only hear about a descriptor again once
+ * something new happened on it, so the functions we call must read,
+ * write, or accept until they get EAGAIN.  Elsewhere, we fall back to
+ * poll(2), which is level-triggered, but the same functions work there,
+ * too.
+ *
+ * Timers are kept in a hashed timing wheel: WHEEL lists, one per tick
+ * of TICK milliseconds, and a timer due in n ticks goes on the list n
+ * ticks ahead, modulo WHEEL.  Arming and cancelling one is constant
+ * time, however many there are, which matters when every connection
+ * has an idle timeout that is pushed back whenever it sends something.
+ */
+
+#include <sys/types.h>
+#if defined(__linux__)
+#define USE_EPOLL
+#include <sys/epoll.h>
+#elif defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || \
+    defined(__DragonFly__) || defined(__APPLE__)
+#define USE_KQUEUE
+#include <sys/event.h>
+#include <sys/time.h>
+#else
+#include <poll.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reactor.h"
+
+#define TICK	10
+#define WHEEL	512
+
+/* How many events to fetch at a time. */
+#define NEVENTS	256
+
+struct handler {
+	reactor_fn	 fn;
+	void		*arg;
+	int		 events;	/* 0 if not registered */
+};
+
+struct reactor {
+	int		  fd;		/* epoll or kqueue */
+	struct handler	 *h;		/* indexed by descriptor */
+	int		  nh;
+	struct rtimer	 *wheel[WHEEL];
+	unsigned long	  tick;		/* timers are run up to here */
+	int		  ntimers;
+	int		  stop;
+#if !defined(USE_EPOLL) && !defined(USE_KQUEUE)
+	struct pollfd	 *pfd;
+	int		  npfd;
+#endif
+};
+
+static unsigned long now(void);
+static int nexttimeout(struct reactor *);
+static void runtimers(struct reactor *);
+static void insert(struct reactor *, struct rtimer *);
+static int watch(struct reactor *, int, int, int);
+
+const char *
+reactor_backend(void)
+{
+#if defined(USE_EPOLL)
+	return "epoll";
+#elif defined(USE_KQUEUE)
+	return "kqueue";
+#else
+	return "poll";
+#endif
+}
+
+struct reactor *
+reactor_new(void)
+{
+	struct reactor *r;
+
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		return NULL;
+#if defined(USE_EPOLL)
+	r->fd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(USE_KQUEUE)
+	r->fd = kqueue();
+#else
+	r->fd = 0;
+#endif
+	if (r->fd < 0) {
+		free(r);
+		return NULL;
+	}
+	r->tick = now();
+	return r;
+}
+
+void
+reactor_free(struct reactor *r)
+{
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+	(void)close(r->fd);
+#else
+	free(r->pfd);
+#endif
+	free(r->h);
+	free(r);
+}
+
+/*
+ * Call fn(r, fd, what, arg) whenever fd becomes ready for any of the
+ * events, which are some of R_READ and R_WRITE.  fd should be
+ * non-blocking.
+ */
+int
+reactor_add(struct reactor *r, int fd, int events, reactor_fn fn, void *arg)
+{
+	struct handler *h;
+	int n;
+
+	if (fd >= r->nh) {
+		n = r->nh ? r->nh : 64;
+		while (n <= fd)
+			n *= 2;
+		if ((h = realloc(r->h, n * sizeof(*h))) == NULL)
+			return -1;
+		(void)memset(h + r->nh, 0, (n - r->nh) * sizeof(*h));
+		r->h = h;
+		r->nh = n;
+	}
+	if (watch(r, fd, 0, events) < 0)
+		return -1;
+	r->h[fd].fn = fn;
+	r->h[fd].arg = arg;
+	r->h[fd].events = events;
+	return 0;
+}
+
+/* Change what fd is watched for. */
+int
+reactor_mod(struct reactor *r, int fd, int events)
+{
+	if (fd >= r->nh || r->h[fd].events == 0)
+		return -1;
+	if (events == r->h[fd].events)
+		return 0;
+	if (watch(r, fd, r->h[fd].events, events) < 0)
+		return -1;
+	r->h[fd].events = events;
+	return 0;
+}
+
+/* Stop watching fd; call this before closing it. */
+void
+reactor_del(struct reactor *r, int fd)
+{
+	if (fd >= r->nh || r->h[fd].events == 0)
+		return;
+	(void)watch(r, fd, r->h[fd].events, 0);
+	r->h[fd].events = 0;
+}
+
+/* Tell the kernel that we now want events instead of old on fd. */
+static int
+watch(struct reactor *r, int fd, int old, int events)
+{
+#if defined(USE_EPOLL)
+	struct epoll_event ev;
+	int op;
+
+	(void)memset(&ev, 0, sizeof(ev));
+	ev.data.fd = fd;
+	ev.events = EPOLLET | EPOLLRDHUP;
+	if (events & R_READ)
+		ev.events |= EPOLLIN;
+	if (events & R_WRITE)
+		ev.events |= EPOLLOUT;
+	if (old == 0)
+		op = EPOLL_CTL_ADD;
+	else if (events == 0)
+		op = EPOLL_CTL_DEL;
+	else
+		op = EPOLL_CTL_MOD;
+	return epoll_ctl(r->fd, op, fd, &ev);
+#elif defined(USE_KQUEUE)
+	struct kevent ev[2];
+	int n;
+
+	n = 0;
+	if ((old ^ events) & R_READ)
+		EV_SET(&ev[n++], fd, EVFILT_READ, events & R_READ ?
+		    EV_ADD | EV_CLEAR : EV_DELETE, 0, 0, NULL);
+	if ((old ^ events) & R_WRITE)
+		EV_SET(&ev[n++], fd, EVFILT_WRITE, events & R_WRITE ?
+		    EV_ADD | EV_CLEAR : EV_DELETE, 0, 0, NULL);
+	return kevent(r->fd, ev, n, NULL, 0, NULL);
+#else
+	struct pollfd *p;
+	int i;
+
+	for (i = 0; i < r->npfd; i++)
+		if (r->pfd[i].fd == fd)
+			break;
+	if (events == 0) {
+		if (i < r->npfd)
+			r->pfd[i] = r->pfd[--r->npfd];
+		return 0;
+	}
+	if (i == r->npfd) {
+		if ((p = realloc(r->pfd, (i + 1) * sizeof(*p))) == NULL)
+			return -1;
+		r->pfd = p;
+		r->npfd++;
+	}
+	(void)old;
+	r->pfd[i].fd = fd;
+	r->pfd[i].events = (events & R_READ ? POLLIN : 0) |
+	    (events & R_WRITE ? POLLOUT : 0);
+	r->pfd[i].revents = 0;
+	return 0;
+#endif
+}
+
+/*
+ * Call fn(r, arg) in ms milliseconds, give or take a tick.  If t is
+ * already armed, it is moved.
+ */
+void
+reactor_timer(struct reactor *r, struct rtimer *t, unsigned int ms,
+    timer_fn fn, void *arg)
+{
+	reactor_untimer(r, t);
+	t->fn = fn;
+	t->arg = arg;
+	t->when = now() + (ms + TICK - 1) / TICK;
+	if (t->when <= r->tick)
+		t->when = r->tick + 1;
+	insert(r, t);
+	r->ntimers++;
+}
+
+void
+reactor_untimer(struct reactor *r, struct rtimer *t)
+{
+	if (t->prevp == NULL)
+		return;
+	if ((*t->prevp = t->next) != NULL)
+		t->next->prevp = t->prevp;
+	t->prevp = NULL;
+	r->ntimers--;
+}
+
+static void
+insert(struct reactor *r, struct rtimer *t)
+{
+	struct rtimer **head;
+
+	head = &r->wheel[t->when % WHEEL];
+	if ((t->next = *head) != NULL)
+		t->next->prevp = &t->next;
+	t->prevp = head;
+	*head = t;
+}
+
+int
+reactor_run(struct reactor *r)
+{
+#if defined(USE_EPOLL)
+	struct epoll_event ev[NEVENTS];
+#elif defined(USE_KQUEUE)
+	struct kevent ev[NEVENTS];
+	struct timespec ts;
+#endif
+	struct {
+		int	fd;
+		int	what;
+	} ready[NEVENTS];
+	struct handler *h;
+	int i, n, nready, timeout;
+
+	r->stop = 0;
+	while (!r->stop) {
+		timeout = nexttimeout(r);
+		nready = 0;
+#if defined(USE_EPOLL)
+		n = epoll_wait(r->fd, ev, NEVENTS, timeout);
+		for (i = 0; i < n; i++, nready++) {
+			ready[i].fd = ev[i].data.fd;
+			ready[i].what = 0;
+			if (ev[i].events & EPOLLIN)
+				ready[i].what |= R_READ;
+			if (ev[i].events & EPOLLOUT)
+				ready[i].what |= R_WRITE;
+			if (ev[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+				ready[i].what |= R_ERROR;
+		}
+#elif defined(USE_KQUEUE)
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000L;
+		n = kevent(r->fd, NULL, 0, ev, NEVENTS,
+		    timeout < 0 ? NULL : &ts);
+		for (i = 0; i < n; i++, nready++) {
+			ready[i].fd = ev[i].ident;
+			ready[i].what = ev[i].filter == EVFILT_WRITE ?
+			    R_WRITE : R_READ;
+			if (ev[i].flags & (EV_EOF | EV_ERROR))
+				ready[i].what |= R_ERROR;
+		}
+#else
+		n = poll(r->pfd, r->npfd, timeout);
+		for (i = 0; i < r->npfd && n > 0 && nready < NEVENTS; i++) {
+			if (r->pfd[i].revents == 0)
+				continue;
+			ready[nready].fd = r->pfd[i].fd;
+			ready[nready].what = 0;
+			if (r->pfd[i].revents & POLLIN)
+				ready[nready].what |= R_READ;
+			if (r->pfd[i].revents & POLLOUT)
+				ready[nready].what |= R_WRITE;
+			if (r->pfd[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+				ready[nready].what |= R_ERROR;
+			nready++;
+		}
+#endif
+		if (n < 0 && errno != EINTR)
+			return -1;
+
+		for (i = 0; i < nready; i++) {
+			/*
+			 * An earlier handler may have stopped watching this
+			 * one in the meantime.
+			 */
+			if (ready[i].fd >= r->nh ||
+			    (h = &r->h[ready[i].fd])->events == 0)
+				continue;
+			h->fn(r, ready[i].fd, ready[i].what, h->arg);
+		}
+		runtimers(r);
+	}
+	return 0;
+}
+
+void
+reactor_stop(struct reactor *r)
+{
+	r->stop = 1;
+}
+
+/* Milliseconds until the first tick that has timers, or -1 if none. */
+static int
+nexttimeout(struct reactor *r)
+{
+	unsigned long t, k;
+	struct timespec ts;
+	long ms;
+
+	if (r->ntimers == 0)
+		return -1;
+	for (k = 1; k < WHEEL; k++)
+		if (r->wheel[(r->tick + k) % WHEEL] != NULL)
+			break;
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	ms = ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+	t = (r->tick + k) * TICK;
+	return (unsigned long)ms >= t ? 0 : (int)(t - ms);
+}
+
+/*
+ * Run the timers on every tick up to now.  Those on a tick's list that
+ * are due a later time around the wheel go back on it.
+ */
+static void
+runtimers(struct reactor *r)
+{
+	struct rtimer *list, *t;
+	unsigned long end;
+
+	end = now();
+	while (r->tick < end) {
+		r->tick++;
+		if ((list = r->wheel[r->tick % WHEEL]) == NULL)
+			continue;
+		r->wheel[r->tick % WHEEL] = NULL;
+		list->prevp = &list;
+		while ((t = list) != NULL) {
+			if ((list = t->next) != NULL)
+				list->prevp = &list;
+			if (t->when > r->tick) {
+				insert(r, t);
+				continue;
+			}
+			/* Unarmed before it runs, so it can rearm itself. */
+			t->prevp = NULL;
+			r->ntimers--;
+			t->fn(r, t->arg);
+		}
+	}
+}
+
+static unsigned long
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL) / TICK;
+}
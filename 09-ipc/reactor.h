@@ -0,0 +1,53 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+#ifndef _REACTOR_H_
+#define _REACTOR_H_
+
+/* What a file descriptor is watched for, and what happened to it. */
+#define R_READ	0x01
+#define R_WRITE	0x02
+#define R_ERROR	0x04
+
+struct reactor;
+
+typedef void (*reactor_fn)(struct reactor *, int, int, void *);
+typedef void (*timer_fn)(struct reactor *, void *);
+
+/*
+ * A timer lives wherever its owner wants it to, usually in the state of
+ * the connection it belongs to; it must be zeroed before its first use.
+ */
+struct rtimer {
+	struct rtimer	 *next;
+	struct rtimer	**prevp;	/* NULL unless armed */
+	unsigned long	  when;		/* in ticks */
+	timer_fn	  fn;
+	void		 *arg;
+};
+
+struct reactor	*reactor_new(void);
+void		 reactor_free(struct reactor *);
+int		 reactor_add(struct reactor *, int, int, reactor_fn, void *);
+int		 reactor_mod(struct reactor *, int, int);
+void		 reactor_del(struct reactor *, int);
+void		 reactor_timer(struct reactor *, struct rtimer *, unsigned int,
+		    timer_fn, void *);
+void		 reactor_untimer(struct reactor *, struct rtimer *);
+int		 reactor_run(struct reactor *);
+void		 reactor_stop(struct reactor *);
+const char	*reactor_backend(void);
+
+#endif /* !_REACTOR_H_ */
@@ -60,22 +60,47 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "connbuf.h"
+#include "prefork.h"
+
 #define BACKLOG 5
 
+static struct bufpool *pool;
+
 #ifndef SLEEP
 #define SLEEP   5
 #endif
 
+/*
+ * Several children may have exited by the time we get
+ * here, but we only get one SIGCHLD, so collect all of
+ * them, not just one.
+ */
 void
 reap() {
-	wait(NULL);
+	int save;
+
+	save = errno;
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+	errno = save;
+}
+
+/* Called for each message the client sends. */
+void
+printMessage(const char *msg, size_t len, void *rip)
+{
+	(void)printf("Client (%s) sent: \"", (const char *)rip);
+	frame_print(stdout, msg, len);
+	(void)printf("\"\n");
 }
 
 void
 handleConnection(int fd, struct sockaddr_in6 client)
 {
+	struct connbuf *b;
 	const char *rip;
-	int rval;
+	ssize_t rval;
 	char claddr[INET6_ADDRSTRLEN];
 
 	if ((rip = inet_ntop(PF_INET6, &(client.sin6_addr), claddr, INET6_ADDRSTRLEN)) == NULL) {
@@ -85,33 +110,79 @@ handleConnection(int fd, struct sockaddr_in6 client)
 		(void)printf("Client connection from %s!\n", rip);
 	}
 
-	do {
-		char buf[BUFSIZ];
-		bzero(buf, sizeof(buf));
-		if ((rval = read(fd, buf, BUFSIZ)) < 0) {
-			perror("reading stream message");
-		} else if (rval == 0) {
-			(void)printf("Ending connection from %s.\n", rip);
-		} else {
-			(void)printf("Client (%s) sent: \"%s\"\n", rip, buf);
-		}
-	} while (rval != 0);
+	/* See connbuf.c for how we get from reads to messages. */
+	if ((b = bufpool_get(pool)) == NULL) {
+		err(EXIT_FAILURE, "getting a buffer");
+		/* NOTREACHED */
+	}
+
+	while ((rval = connbuf_read(fd, b)) > 0)
+		connbuf_frames(b, printMessage, (void *)rip);
+	if (rval < 0)
+		perror("reading stream message");
+	connbuf_rest(b, printMessage, (void *)rip);
+	(void)printf("Ending connection from %s.\n", rip);
 
+	/* A pre-forked worker uses it again for its next client. */
+	bufpool_put(pool, b);
 	(void)close(fd);
-	exit(EXIT_SUCCESS);
-	/* NOTREACHED */
 }
 
 /*
  * This program uses select() to check that someone is trying to connect
  * before calling accept().
+ *
+ * With -p, it instead forks a pool of workers up front that take turns
+ * handling connections; see prefork.c.  -m, -M, and -n set the minimum
+ * and maximum number of idle workers, and the maximum number of
+ * workers.
+ *
+ * cc -Wall strchkread2.c connbuf.c prefork.c
  */
-int main()
+int main(int argc, char **argv)
 {
-	int sock;
+	struct prefork workers;
+	int ch, pflag, sock;
 	socklen_t length;
 	struct sockaddr_in6 server;
 
+	pflag = 0;
+	workers.minspare = PREFORK_MINSPARE;
+	workers.maxspare = PREFORK_MAXSPARE;
+	workers.max = PREFORK_MAX;
+	while ((ch = getopt(argc, argv, "M:m:n:p")) != -1) {
+		switch (ch) {
+		case 'M':
+			workers.maxspare = atoi(optarg);
+			break;
+		case 'm':
+			workers.minspare = atoi(optarg);
+			break;
+		case 'n':
+			workers.max = atoi(optarg);
+			break;
+		case 'p':
+			pflag = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p [-m minspare] "
+			    "[-M maxspare] [-n max]]\n", argv[0]);
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+	if (workers.minspare < 1 || workers.maxspare < workers.minspare ||
+	    workers.max < workers.minspare) {
+		fprintf(stderr, "need 0 < minspare <= maxspare, "
+		    "and minspare <= max\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	/* Workers print as they go; don't let that sit in a buffer. */
+	if (pflag)
+		setvbuf(stdout, NULL, _IOLBF, 0);
+
 	memset(&server, 0, sizeof(server));
 
 	if (signal(SIGCHLD, reap) == SIG_ERR) {
@@ -119,6 +190,12 @@ int main()
 		/* NOTREACHED */
 	}
 
+	/* Each child gets its buffer from its copy of this. */
+	if ((pool = bufpool_new()) == NULL) {
+		err(EXIT_FAILURE, "bufpool_new");
+		/* NOTREACHED */
+	}
+
 	if ((sock = socket(PF_INET6, SOCK_STREAM, 0)) < 0) {
 		err(EXIT_FAILURE, "opening stream socket");
 		/* NOTREACHED */
@@ -145,6 +222,11 @@ int main()
 		/* NOTREACHED */
 	}
 
+	if (pflag) {
+		prefork_run(sock, &workers, handleConnection);
+		/* NOTREACHED */
+	}
+
 	while (1) {
 		fd_set ready;
 		struct timeval to;
@@ -176,9 +258,11 @@ int main()
 				/* NOTREACHED */
 			} else if (!pid) {
 				handleConnection(fd, client);
+				exit(EXIT_SUCCESS);
 				/* NOTREACHED */
 			}
 			/* parent loops */
+			(void)close(fd);
 		} else {
 			(void)printf("Idly sitting here, waiting for connections...\n");
 		}
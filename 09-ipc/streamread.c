@@ -42,6 +42,10 @@
  *
  *	@(#)streamread.c	8.1 (Berkeley) 6/8/93
  */
+#ifdef __linux__
+#define _GNU_SOURCE	/* CPU_SET(3), pthread_setaffinity_np(3) */
+#endif
+
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -50,23 +54,72 @@
 
 #include <err.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "connbuf.h"
+
 #define BACKLOG 5
 
+#define MAXSHARDS	256
+
 /*
  * This program creates a socket and then begins an infinite loop. Each time
  * through the loop it accepts a connection and prints out messages from it.
  * When the connection breaks, or a termination message comes through, the
- * program accepts a new connection.
+ * program accepts a new connection.  A message is a line, or whatever
+ * is left when the connection closes; see connbuf.c.
+ *
+ * -b sets the listen(2) backlog.  Five is plenty for a demo, but once
+ * more than that many clients try to connect while we're busy reading,
+ * the kernel drops their SYNs, and they have to wait for a retransmit.
+ *
+ * -s runs that same loop in several threads ("shards"), each with a
+ * listening socket of its own, all bound to the same port with
+ * SO_REUSEPORT; -s 0 gives us one per CPU we're allowed to run on.  The
+ * kernel spreads new connections across the sockets, so that the shards
+ * don't all contend for one accept queue, and each thread stays on its
+ * CPU.  A shard only handles one connection at a time, though, so those
+ * that the kernel hands to a busy shard wait for it, even if another
+ * one is idle.  Sharding defaults to a backlog of SOMAXCONN.
+ *
+ * While sharded, send the process SIGUSR1 (or SIGINFO, where there is
+ * one) to see how many connections and bytes each shard has handled.
  */
 
-int
-main() {
-	int sock;
+struct shard {
+	pthread_t	tid;
+	int		n;
+	int		cpu;		/* -1 if not pinned */
+	int		sock;
+	struct bufpool	*pool;
+	/* Only the shard's thread writes these; readers may lag a bit. */
+	volatile unsigned long	accepts;
+	volatile unsigned long	bytes;
+};
+
+static int createSocket(int *, int, int);
+static int getCPUs(int *, int);
+static void handleConnection(int, struct sockaddr_in6 *, struct bufpool *,
+    struct shard *);
+static void printMessage(const char *, size_t, void *);
+static void report(struct shard *, int);
+static void *runShard(void *);
+static void sharded(int, int);
+
+/*
+ * Bind to the given port, or pick one and print it if that is 0.  With
+ * reuse, other sockets may then bind to the same port.
+ */
+static int
+createSocket(int *port, int backlog, int reuse)
+{
+	int on, sock;
 	socklen_t length;
 	struct sockaddr_in6 server;
 
@@ -77,9 +130,16 @@ main() {
 		/* NOTREACHED */
 	}
 
+	on = 1;
+	if (reuse && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on,
+	    sizeof(on)) < 0) {
+		err(EXIT_FAILURE, "setting SO_REUSEPORT");
+		/* NOTREACHED */
+	}
+
 	server.sin6_family = PF_INET6;
 	server.sin6_addr = in6addr_any;
-	server.sin6_port = 0;
+	server.sin6_port = htons(*port);
 	if (bind(sock, (struct sockaddr *)&server, sizeof(server)) != 0) {
 		err(EXIT_FAILURE, "binding stream socket");
 		/* NOTREACHED */
@@ -91,17 +151,283 @@ main() {
 		err(EXIT_FAILURE, "getting socket name");
 		/* NOTREACHED */
 	}
-	(void)printf("Socket has port #%d\n", ntohs(server.sin6_port));
+	if (*port == 0) {
+		*port = ntohs(server.sin6_port);
+		(void)printf("Socket has port #%d\n", *port);
+	}
 
-	if (listen(sock, BACKLOG) < 0) {
+	if (listen(sock, backlog) < 0) {
 		err(EXIT_FAILURE, "listening");
 		/* NOTREACHED */
 	}
 
+	return sock;
+}
+
+struct peer {
+	const char	*rip;
+	struct shard	*s;
+};
+
+/* Print one message from a client. */
+static void
+printMessage(const char *msg, size_t len, void *arg)
+{
+	struct peer *p;
+
+	p = arg;
+	flockfile(stdout);
+	if (p->s == NULL)
+		(void)printf("Client (%s) sent: \"", p->rip);
+	else
+		(void)printf("Shard %d: client (%s) sent: \"", p->s->n,
+		    p->rip);
+	frame_print(stdout, msg, len);
+	(void)printf("\"\n");
+	funlockfile(stdout);
+}
+
+/*
+ * Print each message the client sends until it goes away; see
+ * connbuf.c for what a message is.
+ */
+static void
+handleConnection(int fd, struct sockaddr_in6 *client, struct bufpool *pool,
+    struct shard *s)
+{
+	struct connbuf *b;
+	struct peer p;
+	ssize_t rval;
+	char claddr[INET6_ADDRSTRLEN];
+
+	if ((p.rip = inet_ntop(PF_INET6, &(client->sin6_addr), claddr,
+	    INET6_ADDRSTRLEN)) == NULL) {
+		perror("inet_ntop");
+		p.rip = "unknown";
+	}
+	p.s = s;
+
+	if ((b = bufpool_get(pool)) == NULL) {
+		perror("getting a buffer");
+		(void)close(fd);
+		return;
+	}
+
+	while ((rval = connbuf_read(fd, b)) > 0) {
+		if (s != NULL)
+			s->bytes += rval;
+		connbuf_frames(b, printMessage, &p);
+	}
+	if (rval < 0)
+		perror("reading stream message");
+	connbuf_rest(b, printMessage, &p);
+	(void)printf("Ending connection\n");
+
+	bufpool_put(pool, b);
+	(void)close(fd);
+}
+
+/*
+ * Fill in the CPUs we may run on, and return how many there are, or 0
+ * if we can't tell which ones they are (and so won't pin anything).
+ */
+static int
+getCPUs(int *cpus, int max)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	int i, n;
+
+	if (sched_getaffinity(0, sizeof(set), &set) < 0)
+		return 0;
+	for (i = n = 0; i < CPU_SETSIZE && n < max; i++)
+		if (CPU_ISSET(i, &set))
+			cpus[n++] = i;
+	return n;
+#else
+	(void)cpus;
+	(void)max;
+	return 0;
+#endif
+}
+
+static void *
+runShard(void *arg)
+{
+	struct shard *s;
+	struct sockaddr_in6 client;
+	socklen_t length;
+	int fd;
+
+	s = arg;
+#ifdef __linux__
+	if (s->cpu >= 0) {
+		cpu_set_t set;
+		int e;
+
+		CPU_ZERO(&set);
+		CPU_SET(s->cpu, &set);
+		if ((e = pthread_setaffinity_np(pthread_self(), sizeof(set),
+		    &set)) != 0)
+			warnx("shard %d: can't pin to CPU %d: %s", s->n, s->cpu,
+			    strerror(e));
+	}
+#endif
+
+	while (1) {
+		memset(&client, 0, sizeof(client));
+		length = sizeof(client);
+		if ((fd = accept(s->sock, (struct sockaddr *)&client,
+		    &length)) < 0) {
+			perror("accept");
+			continue;
+		}
+		s->accepts++;
+		handleConnection(fd, &client, s->pool, s);
+	}
+
+	/* NOTREACHED */
+	return NULL;
+}
+
+static void
+report(struct shard *shards, int n)
+{
+	unsigned long accepts, bytes;
+	int i;
+
+	accepts = bytes = 0;
+	for (i = 0; i < n; i++) {
+		(void)fprintf(stderr, "shard %3d cpu %3d: %10lu accepts "
+		    "%14lu bytes\n", i, shards[i].cpu, shards[i].accepts,
+		    shards[i].bytes);
+		accepts += shards[i].accepts;
+		bytes += shards[i].bytes;
+	}
+	(void)fprintf(stderr, "total:            %10lu accepts "
+	    "%14lu bytes\n", accepts, bytes);
+}
+
+/*
+ * Start n shards, or one per CPU if n is 0, and then wait for someone
+ * to ask how they're doing.  Only this thread takes signals, so that
+ * the shards don't have to worry about them.
+ */
+static void
+sharded(int n, int backlog)
+{
+	struct shard *shards;
+	sigset_t set;
+	int cpus[MAXSHARDS];
+	int e, i, ncpus, port, sig;
+
+	ncpus = getCPUs(cpus, MAXSHARDS);
+	if (n == 0 && (n = ncpus) == 0 &&
+	    (n = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		n = 1;
+	if (n > MAXSHARDS)
+		n = MAXSHARDS;
+
+	if ((shards = calloc(n, sizeof(*shards))) == NULL) {
+		err(EXIT_FAILURE, "calloc");
+		/* NOTREACHED */
+	}
+
+	(void)sigemptyset(&set);
+	(void)sigaddset(&set, SIGUSR1);
+#ifdef SIGINFO
+	(void)sigaddset(&set, SIGINFO);
+#endif
+	(void)sigaddset(&set, SIGINT);
+	(void)sigaddset(&set, SIGTERM);
+	if ((e = pthread_sigmask(SIG_BLOCK, &set, NULL)) != 0) {
+		errx(EXIT_FAILURE, "pthread_sigmask: %s", strerror(e));
+		/* NOTREACHED */
+	}
+
+	/* The first socket picks the port; the others join it. */
+	port = 0;
+	for (i = 0; i < n; i++) {
+		shards[i].n = i;
+		shards[i].cpu = ncpus > 0 ? cpus[i % ncpus] : -1;
+		shards[i].sock = createSocket(&port, backlog, 1);
+		if ((shards[i].pool = bufpool_new()) == NULL) {
+			err(EXIT_FAILURE, "bufpool_new");
+			/* NOTREACHED */
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if ((e = pthread_create(&shards[i].tid, NULL, runShard,
+		    &shards[i])) != 0) {
+			errx(EXIT_FAILURE, "pthread_create: %s", strerror(e));
+			/* NOTREACHED */
+		}
+	}
+	(void)printf("%d shards listening\n", n);
+
+	while (1) {
+		if ((e = sigwait(&set, &sig)) != 0) {
+			errx(EXIT_FAILURE, "sigwait: %s", strerror(e));
+			/* NOTREACHED */
+		}
+		report(shards, n);
+		if (sig == SIGINT || sig == SIGTERM)
+			exit(EXIT_SUCCESS);
+	}
+	/* NOTREACHED */
+}
+
+int
+main(int argc, char **argv) {
+	struct bufpool *pool;
+	int backlog, ch, nshards, port, sock;
+	socklen_t length;
+
+	backlog = -1;
+	nshards = -1;
+	while ((ch = getopt(argc, argv, "b:s:")) != -1) {
+		switch (ch) {
+		case 'b':
+			if ((backlog = atoi(optarg)) < 1) {
+				errx(EXIT_FAILURE, "invalid backlog");
+				/* NOTREACHED */
+			}
+			break;
+		case 's':
+			nshards = atoi(optarg);
+			if (nshards < 0 || nshards > MAXSHARDS) {
+				errx(EXIT_FAILURE, "number of shards must be "
+				    "between 0 and %d", MAXSHARDS);
+				/* NOTREACHED */
+			}
+			break;
+		default:
+			(void)fprintf(stderr, "usage: %s [-b backlog] "
+			    "[-s shards]\n", argv[0]);
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	/* Several threads print at once; keep their lines whole. */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if (nshards >= 0) {
+		sharded(nshards, backlog > 0 ? backlog : SOMAXCONN);
+		/* NOTREACHED */
+	}
+
+	port = 0;
+	sock = createSocket(&port, backlog > 0 ? backlog : BACKLOG, 0);
+
+	if ((pool = bufpool_new()) == NULL) {
+		err(EXIT_FAILURE, "bufpool_new");
+		/* NOTREACHED */
+	}
+
 	while (1) {
-		int fd, rval;
-		char buf[BUFSIZ];
-		char claddr[INET6_ADDRSTRLEN];
+		int fd;
 		struct sockaddr_in6 client;
 		memset(&client, 0, sizeof(client));
 
@@ -111,25 +437,7 @@ main() {
 			continue;
 		}
 
-		do {
-			bzero(buf, sizeof(buf));
-			if ((rval = read(fd, buf, BUFSIZ)) < 0) {
-				perror("reading stream message");
-			}
-
-			if (rval == 0) {
-				(void)printf("Ending connection\n");
-			} else {
-				const char *rip;
-				if ((rip = inet_ntop(PF_INET6, &(client.sin6_addr), claddr, INET6_ADDRSTRLEN)) == NULL) {
-					perror("inet_ntop");
-					rip = "unknown";
-				} else {
-					(void)printf("Client (%s) sent: \"%s\"\n", rip, buf);
-				}
-			}
-		} while (rval != 0);
-		(void)close(fd);
+		handleConnection(fd, &client, pool, NULL);
 	}
 
 	/* NOTREACHED */
@@ -122,6 +122,10 @@ handleSocket(int s)
 /*
  * This program uses select() to check that someone is trying to connect
  * before calling accept().
+ *
+ * Once it has, handleSocket() reads until the client goes away, and
+ * nobody else is served in the meantime; see reactor-server.c for how
+ * to avoid that.
  */
 int
 main()
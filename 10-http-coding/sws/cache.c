@@ -0,0 +1,301 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * A cache of open files.
+ *
+ * Serving a file the obvious way takes a realpath(3) (one lstat(2) per
+ * path component), an open(2), an fstat(2), a look at its contents to
+ * find its type, and a close(2), before we even start sending it.  For
+ * the same few files over and over, that's almost all of the work.
+ *
+ * So we keep the last CACHE_ENTRIES files we served open, together
+ * with their stat(2) results, their type, their Last-Modified header,
+ * and, if they're small, their contents.  Entries are found by the path
+ * the request resolved to via a hash table, and the one used least
+ * recently goes when we need room.
+ *
+ * A file may change after we've cached it.  Once an entry is more than
+ * CACHE_VALID seconds old, we resolve the path again before using it,
+ * and start over if it now leads somewhere else, or the file has
+ * changed.  So at worst, we serve a file that changed up to a second
+ * ago; that's a trade every caching server makes.
+ *
+ * The path may run through symbolic links that somebody else controls,
+ * as under ~user/public_html, and they may change between our looking
+ * at them and our using them.  So once we have checked where a path
+ * leads, we only ever use what it resolved to, and don't follow a
+ * link there, either.
+ *
+ * Each worker has a cache of its own; there's no locking.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <magic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "sws.h"
+
+static struct centry *buckets[CACHE_BUCKETS];
+static struct centry *newest, *oldest;
+static int count;
+static magic_t magic;
+
+static void drop(struct centry *);
+static unsigned int hash(const char *);
+static struct centry *load(const char *, const char *, unsigned int);
+static int samefile(struct stat *, struct stat *);
+
+/*
+ * Loading the magic(5) database takes a while, so we do it once, before
+ * we fork our workers.
+ */
+void
+cache_init(void)
+{
+	if ((magic = magic_open(MAGIC_MIME)) == NULL ||
+	    magic_load(magic, NULL) < 0) {
+		/* We'll just call everything application/octet-stream. */
+		if (magic != NULL)
+			magic_close(magic);
+		magic = NULL;
+	}
+}
+
+/*
+ * Return the entry for the regular file at path, which must resolve to
+ * somewhere under root.  If we can't, return NULL with errno set; we
+ * use EISDIR for a directory, and EACCES for anything that isn't a
+ * regular file or is outside of root.
+ */
+struct centry *
+cache_get(const char *path, const char *root)
+{
+	struct centry *e;
+	struct stat sb;
+	char real[PATH_MAX];
+	unsigned int h;
+	time_t now;
+
+	h = hash(path);
+	for (e = buckets[h % CACHE_BUCKETS]; e != NULL; e = e->hnext)
+		if (e->hash == h && strcmp(e->path, path) == 0)
+			break;
+
+	if (e != NULL) {
+		now = time(NULL);
+		if (now - e->checked >= CACHE_VALID) {
+			if (cache_resolve(path, root, real) < 0 ||
+			    lstat(real, &sb) < 0) {
+				drop(e);
+				return NULL;
+			}
+			if (strcmp(real, e->real) != 0 ||
+			    !samefile(&sb, &e->st)) {
+				drop(e);
+				return load(path, root, h);
+			}
+			e->checked = now;
+		}
+
+		/* Move it to the front. */
+		if (e != newest) {
+			e->prev->next = e->next;
+			if (e->next != NULL)
+				e->next->prev = e->prev;
+			else
+				oldest = e->prev;
+			e->prev = NULL;
+			e->next = newest;
+			newest->prev = e;
+			newest = e;
+		}
+		return e;
+	}
+
+	return load(path, root, h);
+}
+
+static struct centry *
+load(const char *path, const char *root, unsigned int h)
+{
+	struct centry *e;
+	char real[PATH_MAX];
+	const char *type;
+	ssize_t n;
+	off_t off;
+	int fd;
+
+	if (cache_resolve(path, root, real) < 0)
+		return NULL;
+
+	if ((e = calloc(1, sizeof(*e))) == NULL)
+		return NULL;
+	e->fd = -1;
+
+	if ((fd = open(real, O_RDONLY | O_NONBLOCK | O_NOFOLLOW)) < 0)
+		goto fail;
+	e->fd = fd;
+	if (fstat(fd, &e->st) < 0)
+		goto fail;
+	if (S_ISDIR(e->st.st_mode)) {
+		errno = EISDIR;
+		goto fail;
+	}
+	if (!S_ISREG(e->st.st_mode)) {
+		errno = EACCES;
+		goto fail;
+	}
+	/* We only opened it O_NONBLOCK in case it was a FIFO. */
+	(void)fcntl(fd, F_SETFL, 0);
+	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	if (e->st.st_size <= CACHE_INLINE) {
+		if ((e->body = malloc(e->st.st_size + 1)) == NULL)
+			goto fail;
+		for (off = 0; off < e->st.st_size; off += n) {
+			if ((n = pread(fd, e->body + off, e->st.st_size - off,
+			    off)) < 0) {
+				if (errno == EINTR) {
+					n = 0;
+					continue;
+				}
+				goto fail;
+			}
+			/* It shrank; we'll notice next time. */
+			if (n == 0) {
+				e->st.st_size = off;
+				break;
+			}
+		}
+	}
+
+	if (magic == NULL || (type = e->body != NULL ?
+	    magic_buffer(magic, e->body, e->st.st_size) :
+	    magic_descriptor(magic, fd)) == NULL)
+		type = "application/octet-stream";
+	if ((e->type = strdup(type)) == NULL ||
+	    (e->path = strdup(path)) == NULL || (e->real = strdup(real)) == NULL)
+		goto fail;
+	httpdate(e->st.st_mtime, e->lastmod, sizeof(e->lastmod));
+	e->hash = h;
+	e->checked = time(NULL);
+
+	if (count == CACHE_ENTRIES)
+		drop(oldest);
+
+	e->hnext = buckets[h % CACHE_BUCKETS];
+	buckets[h % CACHE_BUCKETS] = e;
+	e->next = newest;
+	if (newest != NULL)
+		newest->prev = e;
+	else
+		oldest = e;
+	newest = e;
+	count++;
+	return e;
+
+fail:
+	{
+		int save = errno;
+
+		if (e->fd >= 0)
+			(void)close(e->fd);
+		free(e->body);
+		free(e->type);
+		free(e->path);
+		free(e->real);
+		free(e);
+		errno = save;
+	}
+	return NULL;
+}
+
+/*
+ * Resolve path into real, which has room for PATH_MAX bytes.  Symbolic
+ * links may not lead out of root: if it does, return -1 with errno set
+ * to EACCES.
+ */
+int
+cache_resolve(const char *path, const char *root, char *real)
+{
+	size_t len;
+
+	if (realpath(path, real) == NULL)
+		return -1;
+	len = strlen(root);
+	if (strncmp(real, root, len) != 0 ||
+	    (real[len] != '/' && real[len] != '\0' && len > 1)) {
+		errno = EACCES;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+drop(struct centry *e)
+{
+	struct centry **pp;
+
+	for (pp = &buckets[e->hash % CACHE_BUCKETS]; *pp != e;
+	    pp = &(*pp)->hnext)
+		;
+	*pp = e->hnext;
+
+	if (e->prev != NULL)
+		e->prev->next = e->next;
+	else
+		newest = e->next;
+	if (e->next != NULL)
+		e->next->prev = e->prev;
+	else
+		oldest = e->prev;
+	count--;
+
+	(void)close(e->fd);
+	free(e->body);
+	free(e->type);
+	free(e->path);
+	free(e->real);
+	free(e);
+}
+
+/* FNV-1a */
+static unsigned int
+hash(const char *s)
+{
+	unsigned int h;
+
+	for (h = 2166136261u; *s != '\0'; s++)
+		h = (h ^ (unsigned char)*s) * 16777619u;
+	return h;
+}
+
+static int
+samefile(struct stat *a, struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+	    a->st_size == b->st_size && a->st_mtime == b->st_mtime &&
+	    a->st_ctime == b->st_ctime;
+}
@@ -0,0 +1,53 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <time.h>
+
+/* How many files we keep open. */
+#define CACHE_ENTRIES	256
+#define CACHE_BUCKETS	512
+
+/* Files up to this size we keep in memory, too. */
+#define CACHE_INLINE	(32 * 1024)
+
+/* Seconds we trust what we know about a file before we look again. */
+#define CACHE_VALID	1
+
+struct centry {
+	char		*path;		/* as requested */
+	char		*real;		/* what it resolved to */
+	unsigned int	 hash;
+	int		 fd;
+	struct stat	 st;
+	char		*type;		/* Content-Type */
+	char		 lastmod[32];	/* Last-Modified */
+	char		*body;		/* all of the file, if it's small */
+	time_t		 checked;
+	struct centry	*hnext;		/* in the same bucket */
+	struct centry	*prev;		/* in LRU order, newest first */
+	struct centry	*next;
+};
+
+void		 cache_init(void);
+struct centry	*cache_get(const char *, const char *);
+int		 cache_resolve(const char *, const char *, char *);
+
+#endif /* !_CACHE_H_ */
@@ -0,0 +1,338 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * Running CGIs, as described in RFC3875.
+ *
+ * "/cgi-bin/dir/script/more?query" runs dir/script under the -c
+ * directory, with "/more" as its PATH_INFO and "query" as its
+ * QUERY_STRING.  What the script prints starts with headers of its
+ * own; "Status" and "Location" tell us what status to answer with, and
+ * all others are passed on to the client, after our own.  Since we
+ * don't know how much the script will have to say, we don't send a
+ * Content-Length, but close the connection when it's done, which
+ * HTTP/1.0 allows for.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE	/* asprintf(3), closefrom(3), memmem(3) */
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "sws.h"
+
+/* Seconds a CGI may take to say something before we give up on it. */
+#define CGI_TIMEOUT	30
+
+#define NENV		16
+
+static ssize_t cgiread(int, char *, size_t);
+static void run(struct request *, char *, const char *, const char *)
+    __attribute__((__noreturn__));
+static int sendheaders(struct request *, char *, size_t);
+
+/* rest is what's left of the URI after "/cgi-bin". */
+void
+cgi(struct request *r, const char *rest)
+{
+	struct stat sb;
+	struct iovec iov;
+	char path[PATH_MAX], real[PATH_MAX], script[PATH_MAX];
+	char buf[REQMAX];
+	const char *p, *q;
+	size_t len, hlen, n;
+	ssize_t rval;
+	pid_t pid;
+	int body, fds[2], status;
+
+	/* Find the first component that is a file; that's the script. */
+	len = snprintf(path, sizeof(path), "%s", config.cgidir);
+	for (p = rest; ; p = q) {
+		while (*p == '/')
+			p++;
+		if (*p == '\0') {
+			/* No indexing in here. */
+			senderror(r, 403);
+			return;
+		}
+		if ((q = strchr(p, '/')) == NULL)
+			q = p + strlen(p);
+		n = q - p;
+		if ((n == 1 && *p == '.') || (n == 2 && p[0] == '.' &&
+		    p[1] == '.')) {
+			senderror(r, 403);
+			return;
+		}
+		if (len + n + 2 > sizeof(path)) {
+			senderror(r, 400);
+			return;
+		}
+		path[len++] = '/';
+		(void)memcpy(path + len, p, n);
+		len += n;
+		path[len] = '\0';
+
+		if (stat(path, &sb) < 0) {
+			senderror(r, errno == EACCES ? 403 : 404);
+			return;
+		}
+		if (!S_ISDIR(sb.st_mode))
+			break;
+	}
+
+	/* Don't let a symbolic link lead out of the CGI directory. */
+	len = strlen(config.cgidir);
+	if (!S_ISREG(sb.st_mode) || realpath(path, real) == NULL ||
+	    strncmp(real, config.cgidir, len) != 0 || real[len] != '/' ||
+	    access(real, X_OK) < 0) {
+		senderror(r, 403);
+		return;
+	}
+	(void)snprintf(script, sizeof(script), "/cgi-bin%.*s",
+	    (int)(q - rest), rest);
+
+	if (pipe(fds) < 0) {
+		senderror(r, 500);
+		return;
+	}
+	if ((pid = fork()) < 0) {
+		(void)close(fds[0]);
+		(void)close(fds[1]);
+		senderror(r, 500);
+		return;
+	} else if (pid == 0) {
+		(void)close(fds[0]);
+		if (fds[1] != STDOUT_FILENO) {
+			(void)dup2(fds[1], STDOUT_FILENO);
+			(void)close(fds[1]);
+		}
+		run(r, real, script, q);
+		/* NOTREACHED */
+	}
+	(void)close(fds[1]);
+
+	/* Collect the script's headers, and answer with ours and them. */
+	for (hlen = 0; ; hlen += rval) {
+		if (hlen == sizeof(buf) ||
+		    (rval = cgiread(fds[0], buf + hlen, sizeof(buf) - hlen)) <= 0) {
+			senderror(r, 500);
+			goto done;
+		}
+		if ((body = sendheaders(r, buf, hlen + rval)) < 0)
+			goto done;
+		if (body > 0)
+			break;
+	}
+
+	/* Whatever came after the headers is the start of the body. */
+	len = hlen + rval - body;
+	(void)memmove(buf, buf + body, len);
+	while (!r->head) {
+		iov.iov_base = buf;
+		iov.iov_len = len;
+		if (len > 0 && writeall(r->fd, &iov, 1) < 0)
+			break;
+		r->size += len;
+		if ((rval = cgiread(fds[0], buf, sizeof(buf))) <= 0)
+			break;
+		len = rval;
+	}
+
+done:
+	/* Don't wait for it to finish what nobody's going to read. */
+	(void)close(fds[0]);
+	(void)kill(pid, SIGTERM);
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+		;
+}
+
+/* Read from the CGI, but only for so long. */
+static ssize_t
+cgiread(int fd, char *buf, size_t size)
+{
+	struct pollfd pfd;
+	ssize_t n;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		if ((n = poll(&pfd, 1, CGI_TIMEOUT * 1000)) == 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if (n < 0 || (n = read(fd, buf, size)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		return n;
+	}
+}
+
+/*
+ * If buf holds all of the CGI's headers, send the client our response
+ * headers, and return where the body starts.  Returns 0 if we need to
+ * read more, and -1 if we've answered with an error or couldn't answer.
+ */
+static int
+sendheaders(struct request *r, char *buf, size_t len)
+{
+	struct iovec iov[2];
+	char out[REQMAX + 512], hdr[REQMAX + 1];
+	char *line, *next, *end, *v;
+	size_t body, hlen, n;
+	int have;
+
+	/* Whichever comes first; the body may have either. */
+	body = 0;
+	if ((end = memmem(buf, len, "\n\n", 2)) != NULL)
+		body = end + 2 - buf;
+	if ((end = memmem(buf, len, "\r\n\r\n", 4)) != NULL &&
+	    (body == 0 || (size_t)(end + 4 - buf) < body))
+		body = end + 4 - buf;
+	if (body == 0)
+		return 0;
+
+	r->status = 200;
+	have = 0;
+	hlen = 0;
+	(void)memcpy(hdr, buf, body);
+	hdr[body] = '\0';
+	for (line = hdr; *line != '\0'; line = next) {
+		if ((next = strchr(line, '\n')) == NULL)
+			next = line + strlen(line);
+		else
+			*next++ = '\0';
+		if ((n = strlen(line)) > 0 && line[n - 1] == '\r')
+			line[--n] = '\0';
+		if (n == 0)
+			break;
+		if ((v = strchr(line, ':')) == NULL)
+			continue;
+		*v++ = '\0';
+		while (*v == ' ' || *v == '\t')
+			v++;
+
+		if (strcasecmp(line, "Status") == 0) {
+			if ((r->status = atoi(v)) < 100 || r->status > 999)
+				r->status = 500;
+			have = 1;
+			continue;
+		}
+		if (strcasecmp(line, "Location") == 0) {
+			if (!have)
+				r->status = 302;
+			have = 1;
+		} else if (strcasecmp(line, "Content-Type") == 0)
+			have = 1;
+		hlen += snprintf(out + hlen, sizeof(out) - hlen, "%s: %s\r\n",
+		    line, v);
+		if (hlen + 2 >= sizeof(out)) {
+			senderror(r, 500);
+			return -1;
+		}
+	}
+
+	/* A script has to tell us at least one of those. */
+	if (!have) {
+		senderror(r, 500);
+		return -1;
+	}
+
+	n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %d %s\r\nDate: %s\r\n"
+	    "Server: %s\r\n", r->status, reason(r->status), datenow(), SERVER);
+	(void)memcpy(out + hlen, "\r\n", 2);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = n;
+	iov[1].iov_base = out;
+	iov[1].iov_len = hlen + 2;
+	if (writeall(r->fd, iov, 2) < 0)
+		return -1;
+	return body;
+}
+
+static void
+run(struct request *r, char *path, const char *script,
+    const char *pathinfo)
+{
+	char *argv[2], *env[NENV], host[256], *p;
+	int fd, i;
+
+	if ((fd = open("/dev/null", O_RDONLY)) >= 0 && fd != STDIN_FILENO) {
+		(void)dup2(fd, STDIN_FILENO);
+		(void)close(fd);
+	}
+	/*
+	 * Whatever else we have open is none of the script's business,
+	 * and mustn't outlive us in something it leaves running.
+	 */
+	closefrom(STDERR_FILENO + 1);
+
+	/* We ignore SIGPIPE; the script shouldn't have to. */
+	(void)signal(SIGPIPE, SIG_DFL);
+
+	if (gethostname(host, sizeof(host)) < 0)
+		(void)snprintf(host, sizeof(host), "localhost");
+	host[sizeof(host) - 1] = '\0';
+
+	i = 0;
+	env[i++] = "GATEWAY_INTERFACE=CGI/1.1";
+	env[i++] = "PATH=/bin:/usr/bin:/usr/local/bin";
+	env[i++] = "SERVER_PROTOCOL=HTTP/1.0";
+	env[i++] = "SERVER_SOFTWARE=" SERVER;
+	env[i++] = r->head ? "REQUEST_METHOD=HEAD" : "REQUEST_METHOD=GET";
+	if (asprintf(&env[i], "QUERY_STRING=%s",
+	    r->query != NULL ? r->query : "") > 0)
+		i++;
+	if (asprintf(&env[i], "REMOTE_ADDR=%s", r->rip) > 0)
+		i++;
+	if (asprintf(&env[i], "SCRIPT_NAME=%s", script) > 0)
+		i++;
+	if (asprintf(&env[i], "SERVER_NAME=%s", host) > 0)
+		i++;
+	if (asprintf(&env[i], "SERVER_PORT=%d", config.port) > 0)
+		i++;
+	if (*pathinfo != '\0' && asprintf(&env[i], "PATH_INFO=%s",
+	    pathinfo) > 0)
+		i++;
+	env[i] = NULL;
+
+	/* RFC3875 wants the script to run in its own directory. */
+	if ((p = strrchr(path, '/')) != NULL) {
+		*p = '\0';
+		(void)chdir(*path != '\0' ? path : "/");
+		*p = '/';
+	}
+
+	argv[0] = path;
+	argv[1] = NULL;
+	(void)execve(path, argv, env);
+	_exit(127);
+	/* NOTREACHED */
+}
@@ -0,0 +1,838 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * Reading, checking, and answering a request.
+ *
+ * A file is sent one of two ways.  If it's small, the cache has its
+ * contents, and the headers and the body go out together in a single
+ * writev(2): for a file we've served before, that is all it costs us.
+ * Otherwise, we "cork" the socket (TCP_CORK, or TCP_NOPUSH on the
+ * BSDs), write the headers, and have the kernel send the body straight
+ * from the file with sendfile(2), where there is one; with the socket
+ * corked, the headers don't go out in a packet of their own, but
+ * together with the start of the body.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE	/* strptime(3), timegm(3) */
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "sws.h"
+
+static void cork(int, int);
+static int decode(char *);
+static void dispatch(struct request *);
+static int encode(const char *, char *, size_t);
+static void htmlputs(const char *, FILE *);
+static void logrequest(struct request *);
+static int nodots(const struct dirent *);
+static int normalize(const char *, char *, size_t);
+static int parse(struct request *, char *);
+static time_t parsedate(const char *);
+static int readrequest(struct request *, char *);
+static void redirect(struct request *);
+static int sendbody(int, int, off_t);
+static void sendentry(struct request *, struct centry *);
+static void sendindex(struct request *, const char *, const char *);
+static void serve(struct request *, const char *, const char *);
+static int statuserror(int);
+
+/*
+ * Answer the request on fd, from the client at sa.  The caller closes
+ * the connection.
+ */
+void
+handle(int fd, struct sockaddr *sa)
+{
+	struct request r;
+	char buf[REQMAX + 1];
+	int status;
+
+	r.fd = fd;
+	r.line[0] = '\0';
+	r.head = 0;
+	r.uri = r.query = NULL;
+	r.ims = -1;
+	r.when = time(NULL);
+	r.status = 0;
+	r.size = 0;
+
+	/* IPv4 clients on our dual-stack socket look like ::ffff:a.b.c.d. */
+	if (sa->sa_family == AF_INET6 &&
+	    IN6_IS_ADDR_V4MAPPED(&((struct sockaddr_in6 *)sa)->sin6_addr))
+		(void)inet_ntop(AF_INET,
+		    &((struct sockaddr_in6 *)sa)->sin6_addr.s6_addr[12],
+		    r.rip, sizeof(r.rip));
+	else if (sa->sa_family == AF_INET6)
+		(void)inet_ntop(AF_INET6, &((struct sockaddr_in6 *)sa)->sin6_addr,
+		    r.rip, sizeof(r.rip));
+	else
+		(void)inet_ntop(AF_INET, &((struct sockaddr_in *)sa)->sin_addr,
+		    r.rip, sizeof(r.rip));
+
+	if ((status = readrequest(&r, buf)) < 0)
+		return;
+	if (status == 0)
+		status = parse(&r, buf);
+	if (status != 0)
+		senderror(&r, status);
+	else
+		dispatch(&r);
+	logrequest(&r);
+}
+
+/*
+ * Read until the empty line that ends the headers.  Returns 0 once we
+ * have that, an HTTP status to reply with, or -1 if the client went
+ * away or never said anything.
+ */
+static int
+readrequest(struct request *r, char *buf)
+{
+	size_t len, from;
+	ssize_t n;
+
+	len = 0;
+	for (;;) {
+		if ((n = recv(r->fd, buf + len, REQMAX - len, 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			if (len == 0)
+				return -1;
+			/* A request line without headers will do. */
+			buf[len] = '\0';
+			return strchr(buf, '\n') != NULL ? 0 : 400;
+		}
+
+		from = len > 3 ? len - 3 : 0;
+		len += n;
+		buf[len] = '\0';
+		if (strstr(buf + from, "\r\n\r\n") != NULL ||
+		    strstr(buf + from, "\n\n") != NULL)
+			return 0;
+		if (len == REQMAX)
+			return 400;
+	}
+	/* NOTREACHED */
+}
+
+/*
+ * Check the request line
+ *
+ *	Method SP Request-URI SP HTTP-Version CRLF
+ *
+ * and pick out the headers we care about.  Returns 0 if we can go ahead
+ * with the request, or the HTTP status to reply with.
+ */
+static int
+parse(struct request *r, char *buf)
+{
+	char *line, *next, *method, *proto, *p, *v;
+	unsigned long major;
+	size_t n;
+
+	line = buf;
+	if ((next = strchr(line, '\n')) != NULL)
+		*next++ = '\0';
+	if ((n = strlen(line)) > 0 && line[n - 1] == '\r')
+		line[--n] = '\0';
+	(void)strncpy(r->line, line, sizeof(r->line) - 1);
+	r->line[sizeof(r->line) - 1] = '\0';
+
+	method = line;
+	if ((p = strchr(method, ' ')) == NULL)
+		return 400;
+	*p++ = '\0';
+	r->uri = p;
+	if ((p = strchr(r->uri, ' ')) == NULL)
+		return 400;
+	*p++ = '\0';
+	proto = p;
+	if (*method == '\0' || *r->uri == '\0' || strchr(proto, ' ') != NULL)
+		return 400;
+
+	if (strncmp(proto, "HTTP/", 5) != 0)
+		return 400;
+	p = proto + 5;
+	if (!isdigit((unsigned char)*p))
+		return 400;
+	while (*p == '0')
+		p++;
+	for (major = 0; isdigit((unsigned char)*p) && major < 10; p++)
+		major = major * 10 + (*p - '0');
+	if (isdigit((unsigned char)*p))
+		return 505;
+	if (*p++ != '.' || !isdigit((unsigned char)*p))
+		return 400;
+	while (isdigit((unsigned char)*p))
+		p++;
+	if (*p != '\0')
+		return 400;
+	/* We answer HTTP/1.1 too, but as HTTP/1.0. */
+	if (major != 1)
+		return 505;
+
+	for (p = method; *p != '\0'; p++)
+		if (!isalpha((unsigned char)*p))
+			return 400;
+	if (strcmp(method, "HEAD") == 0)
+		r->head = 1;
+	else if (strcmp(method, "GET") != 0)
+		return 501;
+
+	if (*r->uri != '/')
+		return 400;
+	if ((p = strchr(r->uri, '?')) != NULL) {
+		*p++ = '\0';
+		r->query = p;
+	}
+	if (decode(r->uri) < 0)
+		return 400;
+
+	for (line = next; line != NULL && *line != '\0'; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		if ((n = strlen(line)) > 0 && line[n - 1] == '\r')
+			line[--n] = '\0';
+		if (n == 0)
+			break;
+		/* A continuation of the previous header. */
+		if (*line == ' ' || *line == '\t')
+			continue;
+		if ((v = strchr(line, ':')) == NULL)
+			return 400;
+		*v++ = '\0';
+		while (*v == ' ' || *v == '\t')
+			v++;
+		/* An invalid date is to be ignored, says RFC1945. */
+		if (strcasecmp(line, "If-Modified-Since") == 0)
+			r->ims = parsedate(v);
+	}
+
+	return 0;
+}
+
+/* RFC1945 allows for three different date formats. */
+static time_t
+parsedate(const char *s)
+{
+	static const char *formats[] = {
+		"%a, %d %b %Y %H:%M:%S GMT",	/* RFC 1123 */
+		"%A, %d-%b-%y %H:%M:%S GMT",	/* RFC 850 */
+		"%a %b %e %H:%M:%S %Y",		/* asctime(3) */
+	};
+	struct tm tm;
+	const char *end;
+	size_t i;
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		(void)memset(&tm, 0, sizeof(tm));
+		if ((end = strptime(s, formats[i], &tm)) != NULL &&
+		    *end == '\0')
+			return timegm(&tm);
+	}
+	return -1;
+}
+
+/* Undo %-encoding in place; we don't allow for NULs. */
+static int
+decode(char *s)
+{
+	char *d;
+	int c;
+
+	for (d = s; *s != '\0'; s++, d++) {
+		if (*s == '%') {
+			if (!isxdigit((unsigned char)s[1]) ||
+			    !isxdigit((unsigned char)s[2]) ||
+			    sscanf(s + 1, "%2x", &c) != 1 || c == 0)
+				return -1;
+			*d = c;
+			s += 2;
+		} else
+			*d = *s;
+	}
+	*d = '\0';
+	return 0;
+}
+
+/* %-encode anything but unreserved characters and slashes. */
+static int
+encode(const char *s, char *buf, size_t size)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	size_t n;
+
+	for (n = 0; *s != '\0'; s++) {
+		if (n + 4 > size)
+			return -1;
+		if (isalnum((unsigned char)*s) || strchr("-._~/", *s) != NULL)
+			buf[n++] = *s;
+		else {
+			buf[n++] = '%';
+			buf[n++] = hex[(unsigned char)*s >> 4];
+			buf[n++] = hex[(unsigned char)*s & 0xf];
+		}
+	}
+	buf[n] = '\0';
+	return 0;
+}
+
+/*
+ * Turn a URI path into one without "." or ".." components or repeated
+ * slashes, that ends in a slash if it refers to a directory.  Returns
+ * -1 if it tries to go above "/", or doesn't fit.
+ */
+static int
+normalize(const char *uri, char *buf, size_t size)
+{
+	const char *p, *q;
+	size_t len, n;
+	int dir;
+
+	len = 0;
+	dir = 1;
+	for (p = uri; *p != '\0'; p = q) {
+		while (*p == '/')
+			p++;
+		if ((q = strchr(p, '/')) == NULL)
+			q = p + strlen(p);
+		n = q - p;
+		dir = 1;
+		if (n == 0 || (n == 1 && *p == '.'))
+			continue;
+		if (n == 2 && p[0] == '.' && p[1] == '.') {
+			if (len == 0)
+				return -1;
+			while (buf[--len] != '/')
+				;
+			continue;
+		}
+		if (len + n + 2 > size)
+			return -1;
+		buf[len++] = '/';
+		(void)memcpy(buf + len, p, n);
+		len += n;
+		dir = *q == '/';
+	}
+	if (len == 0 || dir)
+		buf[len++] = '/';
+	buf[len] = '\0';
+	return 0;
+}
+
+static void
+dispatch(struct request *r)
+{
+	struct passwd *pw;
+	char home[PATH_MAX], norm[PATH_MAX], root[PATH_MAX];
+	const char *rest;
+	size_t n;
+
+	/*
+	 * Pick the handler by the path the URI leads to, not how it's
+	 * spelled: "//cgi-bin/x" or "/./cgi-bin/x" is still a CGI, and
+	 * mustn't get the script's source sent as a file.
+	 */
+	if (normalize(r->uri, norm, sizeof(norm)) < 0) {
+		senderror(r, 403);
+		return;
+	}
+
+	if (config.cgidir != NULL && strncmp(norm, "/cgi-bin", 8) == 0 &&
+	    (norm[8] == '/' || norm[8] == '\0')) {
+		cgi(r, norm + 8);
+		return;
+	}
+
+	if (strncmp(norm, "/~", 2) == 0) {
+		if ((rest = strchr(norm + 2, '/')) == NULL)
+			rest = norm + strlen(norm);
+		n = rest - (norm + 2);
+		if (n == 0 || n >= sizeof(home)) {
+			senderror(r, 404);
+			return;
+		}
+		(void)memcpy(home, norm + 2, n);
+		home[n] = '\0';
+		if ((pw = getpwnam(home)) == NULL ||
+		    snprintf(home, sizeof(home), "%s/public_html",
+		    pw->pw_dir) >= (int)sizeof(home) ||
+		    realpath(home, root) == NULL) {
+			senderror(r, 404);
+			return;
+		}
+		serve(r, root, rest);
+		return;
+	}
+
+	serve(r, config.docroot, norm);
+}
+
+/* Serve the file or directory rel from under root. */
+static void
+serve(struct request *r, const char *root, const char *rel)
+{
+	struct centry *e;
+	char norm[PATH_MAX], path[PATH_MAX];
+	size_t len;
+
+	if (normalize(rel, norm, sizeof(norm)) < 0) {
+		senderror(r, 403);
+		return;
+	}
+	len = snprintf(path, sizeof(path), "%s%s", root, norm);
+	if (len >= sizeof(path)) {
+		senderror(r, 400);
+		return;
+	}
+
+	if (path[len - 1] == '/') {
+		if (len + sizeof("index.html") > sizeof(path)) {
+			senderror(r, 400);
+			return;
+		}
+		(void)strcpy(path + len, "index.html");
+		if ((e = cache_get(path, root)) != NULL) {
+			sendentry(r, e);
+			return;
+		}
+		if (errno == ENOENT) {
+			path[len] = '\0';
+			sendindex(r, root, path);
+			return;
+		}
+	} else if ((e = cache_get(path, root)) != NULL) {
+		sendentry(r, e);
+		return;
+	} else if (errno == EISDIR) {
+		redirect(r);
+		return;
+	}
+
+	senderror(r, statuserror(errno));
+}
+
+static int
+statuserror(int e)
+{
+	switch (e) {
+	case ENOENT:
+	case ENOTDIR:
+		return 404;
+	case EACCES:
+	case EPERM:
+	case ELOOP:
+	case EISDIR:
+		return 403;
+	case ENAMETOOLONG:
+		return 400;
+	default:
+		return 500;
+	}
+}
+
+static void
+sendentry(struct request *r, struct centry *e)
+{
+	struct iovec iov[2];
+	char hdr[512];
+	int n;
+
+	if (r->ims != -1 && e->st.st_mtime <= r->ims) {
+		r->status = 304;
+		n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 304 %s\r\n"
+		    "Date: %s\r\nServer: %s\r\nLast-Modified: %s\r\n\r\n",
+		    reason(304), datenow(), SERVER, e->lastmod);
+		iov[0].iov_base = hdr;
+		iov[0].iov_len = n;
+		(void)writeall(r->fd, iov, 1);
+		return;
+	}
+
+	r->status = 200;
+	r->size = e->st.st_size;
+	n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+	    "Date: %s\r\nServer: %s\r\nLast-Modified: %s\r\n"
+	    "Content-Type: %s\r\nContent-Length: %lld\r\n\r\n",
+	    datenow(), SERVER, e->lastmod, e->type, (long long)e->st.st_size);
+	if (n >= (int)sizeof(hdr)) {
+		senderror(r, 500);
+		return;
+	}
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = n;
+
+	if (r->head) {
+		(void)writeall(r->fd, iov, 1);
+		return;
+	}
+
+	if (e->body != NULL) {
+		iov[1].iov_base = e->body;
+		iov[1].iov_len = e->st.st_size;
+		(void)writeall(r->fd, iov, 2);
+		return;
+	}
+
+	cork(r->fd, 1);
+	if (writeall(r->fd, iov, 1) == 0)
+		(void)sendbody(r->fd, e->fd, e->st.st_size);
+	cork(r->fd, 0);
+}
+
+/* Hold back partial packets while on, and flush them when turned off. */
+static void
+cork(int fd, int on)
+{
+#if defined(TCP_CORK)
+	(void)setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#elif defined(TCP_NOPUSH)
+	(void)setsockopt(fd, IPPROTO_TCP, TCP_NOPUSH, &on, sizeof(on));
+#else
+	(void)fd;
+	(void)on;
+#endif
+}
+
+static int
+sendbody(int out, int in, off_t size)
+{
+	off_t off;
+	ssize_t n;
+#ifdef __linux__
+	for (off = 0; off < size; ) {
+		if ((n = sendfile(out, in, &off, size - off)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		/* It shrank since we said how big it is. */
+		if (n == 0)
+			return -1;
+	}
+#else
+	struct iovec iov;
+	char buf[64 * 1024];
+
+	for (off = 0; off < size; off += n) {
+		if ((n = pread(in, buf, sizeof(buf), off)) < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return -1;
+		}
+		if (n == 0)
+			return -1;
+		if (n > size - off)
+			n = size - off;
+		iov.iov_base = buf;
+		iov.iov_len = n;
+		if (writeall(out, &iov, 1) < 0)
+			return -1;
+	}
+#endif
+	return 0;
+}
+
+/* "/dir" is a directory: send the client to "/dir/". */
+static void
+redirect(struct request *r)
+{
+	struct iovec iov;
+	char hdr[REQMAX + 256], loc[REQMAX * 3];
+	int n;
+
+	if (encode(r->uri, loc, sizeof(loc)) < 0) {
+		senderror(r, 400);
+		return;
+	}
+	r->status = 301;
+	n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 301 %s\r\n"
+	    "Date: %s\r\nServer: %s\r\nLocation: %s/\r\n"
+	    "Content-Length: 0\r\n\r\n", reason(301), datenow(), SERVER, loc);
+	if (n >= (int)sizeof(hdr)) {
+		senderror(r, 400);
+		return;
+	}
+	iov.iov_base = hdr;
+	iov.iov_len = n;
+	(void)writeall(r->fd, &iov, 1);
+}
+
+static int
+nodots(const struct dirent *d)
+{
+	return d->d_name[0] != '.';
+}
+
+/* Write s, with characters that mean something in HTML escaped. */
+static void
+htmlputs(const char *s, FILE *fp)
+{
+	for (; *s != '\0'; s++) {
+		switch (*s) {
+		case '<':
+			(void)fputs("&lt;", fp);
+			break;
+		case '>':
+			(void)fputs("&gt;", fp);
+			break;
+		case '&':
+			(void)fputs("&amp;", fp);
+			break;
+		case '"':
+			(void)fputs("&quot;", fp);
+			break;
+		default:
+			(void)putc(*s, fp);
+		}
+	}
+}
+
+/*
+ * List the files in dir, but not the ones starting with a '.'.  Like
+ * files, dir may not be a symbolic link out of root.
+ */
+static void
+sendindex(struct request *r, const char *root, const char *dir)
+{
+	struct dirent **names;
+	struct iovec iov[2];
+	struct stat sb;
+	FILE *fp;
+	char hdr[512], lastmod[32], href[NAME_MAX * 3 + 1];
+	char real[PATH_MAX];
+	char *body;
+	size_t len;
+	int i, n, hlen;
+
+	if (cache_resolve(dir, root, real) < 0) {
+		senderror(r, statuserror(errno));
+		return;
+	}
+	if (stat(real, &sb) < 0) {
+		senderror(r, statuserror(errno));
+		return;
+	}
+	httpdate(sb.st_mtime, lastmod, sizeof(lastmod));
+	if (r->ims != -1 && sb.st_mtime <= r->ims) {
+		r->status = 304;
+		hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 304 %s\r\n"
+		    "Date: %s\r\nServer: %s\r\nLast-Modified: %s\r\n\r\n",
+		    reason(304), datenow(), SERVER, lastmod);
+		iov[0].iov_base = hdr;
+		iov[0].iov_len = hlen;
+		(void)writeall(r->fd, iov, 1);
+		return;
+	}
+
+	if ((n = scandir(real, &names, nodots, alphasort)) < 0) {
+		senderror(r, statuserror(errno));
+		return;
+	}
+
+	body = NULL;
+	if ((fp = open_memstream(&body, &len)) == NULL) {
+		for (i = 0; i < n; i++)
+			free(names[i]);
+		free(names);
+		senderror(r, 500);
+		return;
+	}
+	(void)fputs("<!DOCTYPE html>\n<html><head><title>Index of ", fp);
+	htmlputs(r->uri, fp);
+	(void)fputs("</title></head>\n<body>\n<h1>Index of ", fp);
+	htmlputs(r->uri, fp);
+	(void)fputs("</h1>\n<ul>\n", fp);
+	for (i = 0; i < n; i++) {
+		if (encode(names[i]->d_name, href, sizeof(href)) == 0) {
+			(void)fprintf(fp, "<li><a href=\"%s\">", href);
+			htmlputs(names[i]->d_name, fp);
+			(void)fputs("</a></li>\n", fp);
+		}
+		free(names[i]);
+	}
+	free(names);
+	(void)fputs("</ul>\n</body></html>\n", fp);
+	if (fclose(fp) != 0) {
+		free(body);
+		senderror(r, 500);
+		return;
+	}
+
+	r->status = 200;
+	r->size = len;
+	hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+	    "Date: %s\r\nServer: %s\r\nLast-Modified: %s\r\n"
+	    "Content-Type: text/html\r\nContent-Length: %zu\r\n\r\n",
+	    datenow(), SERVER, lastmod, len);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = hlen;
+	iov[1].iov_base = body;
+	iov[1].iov_len = len;
+	(void)writeall(r->fd, iov, r->head ? 1 : 2);
+	free(body);
+}
+
+void
+senderror(struct request *r, int status)
+{
+	struct iovec iov[2];
+	char hdr[256], body[256];
+	int hlen, blen;
+
+	r->status = status;
+	blen = snprintf(body, sizeof(body), "<!DOCTYPE html>\n<html><head>"
+	    "<title>%d %s</title></head>\n<body><h1>%d %s</h1></body></html>\n",
+	    status, reason(status), status, reason(status));
+	r->size = blen;
+	hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %d %s\r\n"
+	    "Date: %s\r\nServer: %s\r\n"
+	    "Content-Type: text/html\r\nContent-Length: %d\r\n\r\n",
+	    status, reason(status), datenow(), SERVER, blen);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = hlen;
+	iov[1].iov_base = body;
+	iov[1].iov_len = blen;
+	(void)writeall(r->fd, iov, r->head ? 1 : 2);
+}
+
+const char *
+reason(int status)
+{
+	switch (status) {
+	case 200:
+		return "OK";
+	case 301:
+		return "Moved Permanently";
+	case 302:
+		return "Moved Temporarily";
+	case 304:
+		return "Not Modified";
+	case 400:
+		return "Bad Request";
+	case 403:
+		return "Forbidden";
+	case 404:
+		return "Not Found";
+	case 500:
+		return "Internal Server Error";
+	case 501:
+		return "Not Implemented";
+	case 505:
+		return "HTTP Version Not Supported";
+	default:
+		return "Unknown";
+	}
+}
+
+/* Write all of it, picking up after short writes. */
+int
+writeall(int fd, struct iovec *iov, int n)
+{
+	ssize_t w;
+
+	while (n > 0) {
+		if ((w = writev(fd, iov, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (n > 0 && (size_t)w >= iov->iov_len) {
+			w -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+	return 0;
+}
+
+void
+httpdate(time_t t, char *buf, size_t size)
+{
+	struct tm tm;
+
+	(void)strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT",
+	    gmtime_r(&t, &tm));
+}
+
+/* The Date header only changes once a second, so only format it then. */
+const char *
+datenow(void)
+{
+	static char buf[32];
+	static time_t last;
+	time_t now;
+
+	if ((now = time(NULL)) != last) {
+		httpdate(now, buf, sizeof(buf));
+		last = now;
+	}
+	return buf;
+}
+
+/* '%a %t "%r" %>s %b', in a single write(2), so lines don't mix. */
+static void
+logrequest(struct request *r)
+{
+	struct tm tm;
+	char buf[REQMAX + 256], when[32];
+	int n;
+
+	if (config.logfd < 0 || r->status == 0)
+		return;
+	(void)strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%SZ",
+	    gmtime_r(&r->when, &tm));
+	n = snprintf(buf, sizeof(buf), "%s %s \"%s\" %d %lld\n", r->rip, when,
+	    r->line, r->status, (long long)r->size);
+	if (n >= (int)sizeof(buf))
+		n = sizeof(buf) - 1;
+	(void)write(config.logfd, buf, n);
+}
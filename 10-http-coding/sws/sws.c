@@ -0,0 +1,349 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * sws(1), a simple web server, as described in the manual page at
+ * https://stevens.netmeister.org/631/sws.1 -- written with an eye on
+ * how much each request costs us.
+ *
+ * Forking a child for each connection means a fork(2) per request, and
+ * forgetting everything we learned about the files we served as soon
+ * as that child exits.  Instead, we fork a fixed number of workers up
+ * front.  Each of them accept(2)s on the same listening socket, answers
+ * the request, and goes back for the next one, and keeps a cache of the
+ * files it has served (see cache.c).  A worker that dies is replaced.
+ *
+ * With -d, there are no workers: we answer one connection at a time
+ * ourselves, as the manual page asks for.
+ *
+ * Files are in http.c, CGIs in cgi.c.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE	/* accept4(2) */
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "sws.h"
+
+#define DEFAULT_PORT	8080
+
+/* How many workers to run per CPU, and at least. */
+#define WORKERS_PER_CPU	4
+#define MIN_WORKERS	8
+
+struct config config;
+
+static volatile sig_atomic_t done;
+
+static int listenon(const char *);
+static void serve(int) __attribute__((__noreturn__));
+static void stop(int);
+static void supervise(int);
+static void usage(FILE *, int) __attribute__((__noreturn__));
+
+static void
+usage(FILE *fp, int status)
+{
+	(void)fprintf(fp, "usage: sws [-dh] [-c dir] [-i address] "
+	    "[-l file] [-p port] dir\n");
+	exit(status);
+	/* NOTREACHED */
+}
+
+int
+main(int argc, char **argv)
+{
+	char *address, *logfile;
+	char cgidir[PATH_MAX], docroot[PATH_MAX];
+	char *end;
+	long port;
+	int ch, sock;
+
+	address = logfile = NULL;
+	config.cgidir = NULL;
+	config.logfd = -1;
+	config.port = DEFAULT_PORT;
+
+	while ((ch = getopt(argc, argv, "c:dhi:l:p:")) != -1) {
+		switch (ch) {
+		case 'c':
+			if (realpath(optarg, cgidir) == NULL)
+				err(EXIT_FAILURE, "%s", optarg);
+			config.cgidir = cgidir;
+			break;
+		case 'd':
+			config.debug = 1;
+			break;
+		case 'h':
+			usage(stdout, EXIT_SUCCESS);
+			/* NOTREACHED */
+		case 'i':
+			address = optarg;
+			break;
+		case 'l':
+			logfile = optarg;
+			break;
+		case 'p':
+			port = strtol(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || port < 1 ||
+			    port > 65535)
+				errx(EXIT_FAILURE, "invalid port: %s", optarg);
+			config.port = port;
+			break;
+		default:
+			usage(stderr, EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1)
+		usage(stderr, EXIT_FAILURE);
+	if (realpath(argv[0], docroot) == NULL)
+		err(EXIT_FAILURE, "%s", argv[0]);
+	config.docroot = docroot;
+
+	if (config.debug) {
+		config.logfd = STDOUT_FILENO;
+		setvbuf(stdout, NULL, _IOLBF, 0);
+	} else if (logfile != NULL &&
+	    (config.logfd = open(logfile, O_WRONLY | O_APPEND | O_CREAT |
+	    O_CLOEXEC, 0644)) < 0)
+		err(EXIT_FAILURE, "%s", logfile);
+
+	sock = listenon(address);
+
+	/* A client that goes away shouldn't take us with it. */
+	(void)signal(SIGPIPE, SIG_IGN);
+
+	cache_init();
+
+	if (config.debug) {
+		serve(sock);
+		/* NOTREACHED */
+	}
+
+	if (daemon(0, 0) < 0)
+		err(EXIT_FAILURE, "daemon");
+	supervise(sock);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Without an address, listen on all IPv6 and IPv4 addresses with a
+ * single dual-stack socket (or just IPv4, if there's no IPv6 here).
+ */
+static int
+listenon(const char *address)
+{
+	struct sockaddr_storage ss;
+	struct sockaddr_in *sin;
+	struct sockaddr_in6 *sin6;
+	socklen_t len;
+	int off, on, sock;
+
+	(void)memset(&ss, 0, sizeof(ss));
+	sin = (struct sockaddr_in *)&ss;
+	sin6 = (struct sockaddr_in6 *)&ss;
+	if (address == NULL) {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr = in6addr_any;
+		sin6->sin6_port = htons(config.port);
+		len = sizeof(*sin6);
+		if ((sock = socket(AF_INET6, SOCK_STREAM, 0)) < 0) {
+			(void)memset(&ss, 0, sizeof(ss));
+			sin->sin_family = AF_INET;
+			sin->sin_addr.s_addr = htonl(INADDR_ANY);
+			sin->sin_port = htons(config.port);
+			len = sizeof(*sin);
+			if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+				err(EXIT_FAILURE, "socket");
+		} else {
+			off = 0;
+			if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &off,
+			    sizeof(off)) < 0)
+				err(EXIT_FAILURE, "setsockopt");
+		}
+	} else if (inet_pton(AF_INET6, address, &sin6->sin6_addr) == 1) {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(config.port);
+		len = sizeof(*sin6);
+		if ((sock = socket(AF_INET6, SOCK_STREAM, 0)) < 0)
+			err(EXIT_FAILURE, "socket");
+	} else if (inet_pton(AF_INET, address, &sin->sin_addr) == 1) {
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(config.port);
+		len = sizeof(*sin);
+		if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+			err(EXIT_FAILURE, "socket");
+	} else
+		errx(EXIT_FAILURE, "invalid address: %s", address);
+
+	/* Nor this, or whatever a CGI leaves behind keeps our port. */
+	if (fcntl(sock, F_SETFD, FD_CLOEXEC) < 0)
+		err(EXIT_FAILURE, "fcntl");
+
+	on = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0)
+		err(EXIT_FAILURE, "setsockopt");
+
+#ifdef TCP_DEFER_ACCEPT
+	/* Don't wake a worker until the client has sent something. */
+	on = TIMEOUT;
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &on, sizeof(on));
+#endif
+
+	if (bind(sock, (struct sockaddr *)&ss, len) < 0)
+		err(EXIT_FAILURE, "bind");
+	if (listen(sock, SOMAXCONN) < 0)
+		err(EXIT_FAILURE, "listen");
+	return sock;
+}
+
+/* Answer one connection after another. */
+static void
+serve(int sock)
+{
+	struct sockaddr_storage ss;
+	struct timeval tv;
+	socklen_t len;
+	int fd;
+
+	/*
+	 * A client that doesn't send its request, or doesn't take our
+	 * answer, in TIMEOUT seconds is dropped, so that it can't hold on
+	 * to a worker forever.  These go on each connection, not on the
+	 * listening socket, where they would time out accept(2), too.
+	 */
+	tv.tv_sec = TIMEOUT;
+	tv.tv_usec = 0;
+
+	for (;;) {
+		len = sizeof(ss);
+		/* A CGI gets a pipe, not the client's connection. */
+#ifdef SOCK_CLOEXEC
+		fd = accept4(sock, (struct sockaddr *)&ss, &len, SOCK_CLOEXEC);
+#else
+		if ((fd = accept(sock, (struct sockaddr *)&ss, &len)) >= 0)
+			(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED &&
+			    config.debug)
+				warn("accept");
+			continue;
+		}
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv,
+		    sizeof(tv)) < 0 ||
+		    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv,
+		    sizeof(tv)) < 0) {
+			(void)close(fd);
+			continue;
+		}
+		handle(fd, (struct sockaddr *)&ss);
+		(void)close(fd);
+	}
+	/* NOTREACHED */
+}
+
+static void
+stop(int sig)
+{
+	(void)sig;
+	done = 1;
+}
+
+/* Keep our workers running until we're told to stop. */
+static void
+supervise(int sock)
+{
+	struct sigaction sa;
+	pid_t *pids, pid;
+	long ncpu;
+	int i, n;
+
+	if ((ncpu = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		ncpu = 1;
+	if ((n = ncpu * WORKERS_PER_CPU) < MIN_WORKERS)
+		n = MIN_WORKERS;
+	if ((pids = calloc(n, sizeof(*pids))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	/* No SA_RESTART: a signal has to get us out of wait(2). */
+	(void)memset(&sa, 0, sizeof(sa));
+	(void)sigemptyset(&sa.sa_mask);
+	sa.sa_handler = stop;
+	(void)sigaction(SIGTERM, &sa, NULL);
+	(void)sigaction(SIGINT, &sa, NULL);
+	(void)sigaction(SIGHUP, &sa, NULL);
+
+	while (!done) {
+		for (i = 0; i < n; i++) {
+			if (pids[i] != 0)
+				continue;
+			if ((pid = fork()) < 0) {
+				/* Try again when the next one exits. */
+				break;
+			} else if (pid == 0) {
+				(void)signal(SIGTERM, SIG_DFL);
+				(void)signal(SIGINT, SIG_DFL);
+				(void)signal(SIGHUP, SIG_DFL);
+				serve(sock);
+				/* NOTREACHED */
+			}
+			pids[i] = pid;
+		}
+
+		if ((pid = wait(NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			/* No children at all: we couldn't fork any. */
+			(void)sleep(1);
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			if (pids[i] == pid)
+				pids[i] = 0;
+	}
+
+	for (i = 0; i < n; i++)
+		if (pids[i] != 0)
+			(void)kill(pids[i], SIGTERM);
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+	free(pids);
+}
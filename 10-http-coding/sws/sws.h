@@ -0,0 +1,68 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+#ifndef _SWS_H_
+#define _SWS_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <netinet/in.h>
+
+#include <time.h>
+
+#define SERVER		"sws/1.0"
+
+/* Longest request (line and headers) we accept. */
+#define REQMAX		8192
+
+/* Seconds a client gets to send its request, or to take our answer. */
+#define TIMEOUT		60
+
+struct config {
+	const char	*docroot;	/* resolved */
+	const char	*cgidir;	/* resolved, or NULL */
+	int		 logfd;		/* -1 if we don't log */
+	int		 debug;
+	int		 port;
+};
+
+struct request {
+	int		 fd;
+	char		 rip[INET6_ADDRSTRLEN];
+	char		 line[REQMAX];	/* the request line, for the log */
+	int		 head;		/* HEAD, not GET */
+	char		*uri;		/* without the query, and decoded */
+	char		*query;		/* what came after '?', or NULL */
+	time_t		 ims;		/* If-Modified-Since, or -1 */
+	time_t		 when;		/* when the request came in */
+	int		 status;
+	off_t		 size;		/* bytes of body sent */
+};
+
+extern struct config config;
+
+/* cgi.c */
+void		 cgi(struct request *, const char *);
+
+/* http.c */
+void		 handle(int, struct sockaddr *);
+const char	*datenow(void);
+void		 httpdate(time_t, char *, size_t);
+const char	*reason(int);
+void		 senderror(struct request *, int);
+int		 writeall(int, struct iovec *, int);
+
+#endif /* !_SWS_H_ */
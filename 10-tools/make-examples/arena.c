@@ -0,0 +1,123 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * A bump allocator for things that all go away at the same time, such
+ * as the user and group names display() keeps for each entry of a
+ * directory until it has been printed.
+ *
+ * Memory is carved out of large blocks in order, and given back all at
+ * once with arena_reset().  The blocks themselves are kept for the next
+ * directory, so that after the largest directory so far, listing more
+ * of them does not call malloc(3) at all.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <fts.h>
+#include <stdlib.h>
+
+#include "ls.h"
+#include "extern.h"
+
+#define ABLOCK_SIZE	(64 * 1024)
+
+#define ARENA_ALIGN(n)	(((n) + sizeof(long long) - 1) & \
+			    ~(sizeof(long long) - 1))
+
+struct ablock {
+	struct ablock	*next;
+	size_t		 size;		/* bytes after the header */
+	size_t		 used;
+};
+
+struct arena {
+	struct ablock	*head;
+	struct ablock	*cur;		/* block being carved up */
+	struct ablock	*tail;
+	size_t		 inuse;		/* bytes handed out since the reset */
+	size_t		 peak;
+	size_t		 total;		/* bytes in all blocks */
+};
+
+ARENA *
+arena_create(void)
+{
+	ARENA *ap;
+
+	if ((ap = calloc(1, sizeof(ARENA))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	return (ap);
+}
+
+/*
+ * Return size bytes, aligned for any use, that stay valid until the
+ * next arena_reset().
+ */
+void *
+arena_malloc(ARENA *ap, size_t size)
+{
+	struct ablock *bp;
+	size_t bsize;
+	void *mem;
+
+	size = ARENA_ALIGN(size);
+	while ((bp = ap->cur) != NULL && bp->size - bp->used < size)
+		ap->cur = bp->next;
+	if (bp == NULL) {
+		bsize = size > ABLOCK_SIZE ? size : ABLOCK_SIZE;
+		if ((bp = malloc(ARENA_ALIGN(sizeof(struct ablock)) +
+		    bsize)) == NULL)
+			err(EXIT_FAILURE, NULL);
+		bp->next = NULL;
+		bp->size = bsize;
+		bp->used = 0;
+		if (ap->tail == NULL)
+			ap->head = bp;
+		else
+			ap->tail->next = bp;
+		ap->tail = ap->cur = bp;
+		ap->total += bsize;
+	}
+
+	mem = (char *)bp + ARENA_ALIGN(sizeof(struct ablock)) + bp->used;
+	bp->used += size;
+	if ((ap->inuse += size) > ap->peak)
+		ap->peak = ap->inuse;
+	return (mem);
+}
+
+/*
+ * Give back everything handed out so far, keeping the blocks.
+ */
+void
+arena_reset(ARENA *ap)
+{
+	struct ablock *bp;
+
+	for (bp = ap->head; bp != NULL; bp = bp->next)
+		bp->used = 0;
+	ap->cur = ap->head;
+	ap->inuse = 0;
+}
+
+void
+arena_stats(ARENA *ap, const char *what)
+{
+
+	warnx("%s: %lu bytes at most, in %lu bytes of blocks", what,
+	    (u_long)ap->peak, (u_long)ap->total);
+}
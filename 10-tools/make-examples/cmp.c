@@ -44,25 +44,40 @@ __RCSID("$NetBSD: cmp.c,v 1.17 2003/08/07 09:05:14 agc Exp $");
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <err.h>
 #include <fts.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "ls.h"
 #include "extern.h"
 
-#if defined(_POSIX_SOURCE) || defined(_POSIX_C_SOURCE) || \
-    defined(_XOPEN_SOURCE) || defined(__NetBSD__)
-#define ATIMENSEC_CMP(x, op, y) ((x)->st_atimensec op (y)->st_atimensec)
-#define CTIMENSEC_CMP(x, op, y) ((x)->st_ctimensec op (y)->st_ctimensec)
-#define MTIMENSEC_CMP(x, op, y) ((x)->st_mtimensec op (y)->st_mtimensec)
-#else
-#define ATIMENSEC_CMP(x, op, y) \
-	((x)->st_atimespec.tv_nsec op (y)->st_atimespec.tv_nsec)
-#define CTIMENSEC_CMP(x, op, y) \
-	((x)->st_ctimespec.tv_nsec op (y)->st_ctimespec.tv_nsec)
-#define MTIMENSEC_CMP(x, op, y) \
-	((x)->st_mtimespec.tv_nsec op (y)->st_mtimespec.tv_nsec)
-#endif
+#define ATIMENSEC_CMP(x, op, y) (ATIMENSEC(x) op ATIMENSEC(y))
+#define CTIMENSEC_CMP(x, op, y) (CTIMENSEC(x) op CTIMENSEC(y))
+#define MTIMENSEC_CMP(x, op, y) (MTIMENSEC(x) op MTIMENSEC(y))
+
+/*
+ * A sort key packed so that sorting an array of them in ascending order
+ * gives the same order as the comparison functions below, without going
+ * back to the FTSENTs: key is the size or seconds of the time stamp,
+ * turned around so that larger ones come first, or the first bytes of the
+ * name when sorting by name; nsec breaks ties between time stamps and pfx,
+ * the first bytes of the name, between files.  Only names that start
+ * the same need strcmp().
+ */
+struct skey {
+	u_int64_t	 key;
+	u_int64_t	 pfx;
+	u_int32_t	 nsec;
+	FTSENT		*p;
+};
+
+/* Below this, the radix sort is not worth its passes. */
+#define SORT_RADIX_MIN	64
+
+static void	skey_fill(struct skey *, FTSENT *, int);
+static void	skey_radix(struct skey *, struct skey *, size_t);
+static int	skeycmp(const void *, const void *);
 
 int
 namecmp(const FTSENT *a, const FTSENT *b)
@@ -197,3 +212,167 @@ revsizecmp(const FTSENT *a, const FTSENT *b)
 	else
 		return (revnamecmp(a, b));
 }
+
+/*
+ * Sort a directory listing the way mastercmp() would, but on an array
+ * of packed keys rather than through pointers to the entries: a radix
+ * sort on the 64-bit keys, followed by a comparison sort of each run of
+ * equal keys.  Entries that could not be stat'ed go last, by name.
+ */
+FTSENT *
+sortlist(FTSENT *head, size_t nents)
+{
+	struct skey *a, *tmp;
+	FTSENT *p, *ns, **nstail, **tailp;
+	size_t i, j, n;
+
+	if ((a = malloc(nents * sizeof(*a))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	ns = NULL;
+	nstail = &ns;
+	for (n = 0, p = head; p != NULL; p = p->fts_link)
+		if (p->fts_info == FTS_NS) {
+			*nstail = p;
+			nstail = &p->fts_link;
+		} else
+			skey_fill(&a[n++], p, sortkey);
+	*nstail = NULL;
+
+	if (n >= SORT_RADIX_MIN) {
+		if ((tmp = malloc(n * sizeof(*tmp))) == NULL)
+			err(EXIT_FAILURE, NULL);
+		skey_radix(a, tmp, n);
+		free(tmp);
+		for (i = 0; i < n; i = j) {
+			for (j = i + 1; j < n && a[j].key == a[i].key; j++)
+				continue;
+			if (j - i > 1)
+				qsort(&a[i], j - i, sizeof(*a), skeycmp);
+		}
+	} else
+		qsort(a, n, sizeof(*a), skeycmp);
+
+	tailp = &head;
+	for (i = 0; i < n; i++) {
+		*tailp = a[f_reversesort ? n - 1 - i : i].p;
+		tailp = &(*tailp)->fts_link;
+	}
+
+	/* As in mastercmp(), these are always in ascending name order. */
+	if (ns != NULL && ns->fts_link != NULL) {
+		for (n = 0, p = ns; p != NULL; p = p->fts_link)
+			skey_fill(&a[n++], p, BY_NAME);
+		qsort(a, n, sizeof(*a), skeycmp);
+		for (i = 0; i < n; i++) {
+			*tailp = a[i].p;
+			tailp = &(*tailp)->fts_link;
+		}
+		*tailp = NULL;
+	} else
+		*tailp = ns;
+	free(a);
+	return (head);
+}
+
+static void
+skey_fill(struct skey *k, FTSENT *p, int by)
+{
+	const struct stat *sp;
+	const unsigned char *s;
+	u_int64_t v;
+	int i;
+
+	v = 0;
+	s = (const unsigned char *)p->fts_name;
+	for (i = 0; i < 8; i++) {
+		v <<= 8;
+		if (*s != '\0')
+			v |= *s++;
+	}
+	k->pfx = v;
+	k->nsec = 0;
+	k->p = p;
+
+	/*
+	 * Flip the sign bit so that signed values sort as unsigned ones,
+	 * and complement them so that the largest come first.
+	 */
+	sp = p->fts_statp;
+	switch (by) {
+	case BY_SIZE:
+		k->key = ~((u_int64_t)sp->st_size ^ (1ULL << 63));
+		break;
+	case BY_TIME:
+		if (f_accesstime) {
+			v = sp->st_atime;
+			k->nsec = ~(u_int32_t)ATIMENSEC(sp);
+		} else if (f_statustime) {
+			v = sp->st_ctime;
+			k->nsec = ~(u_int32_t)CTIMENSEC(sp);
+		} else {
+			v = sp->st_mtime;
+			k->nsec = ~(u_int32_t)MTIMENSEC(sp);
+		}
+		k->key = ~(v ^ (1ULL << 63));
+		break;
+	default:
+		k->key = k->pfx;
+		break;
+	}
+}
+
+/*
+ * Least significant digit first radix sort of a on key, a byte at a
+ * time, using tmp as scratch space.  Bytes that are the same in all keys
+ * are skipped, so that small sizes or nearby time stamps only take a
+ * few passes.
+ */
+static void
+skey_radix(struct skey *a, struct skey *tmp, size_t n)
+{
+	size_t count[8][256], off, c;
+	struct skey *from, *to, *t;
+	size_t i;
+	int d;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++)
+		for (d = 0; d < 8; d++)
+			count[d][(a[i].key >> (d * 8)) & 0xff]++;
+
+	from = a;
+	to = tmp;
+	for (d = 0; d < 8; d++) {
+		if (count[d][(a[0].key >> (d * 8)) & 0xff] == n)
+			continue;
+		for (off = 0, i = 0; i < 256; i++) {
+			c = count[d][i];
+			count[d][i] = off;
+			off += c;
+		}
+		for (i = 0; i < n; i++)
+			to[count[d][(from[i].key >> (d * 8)) & 0xff]++] =
+			    from[i];
+		t = from;
+		from = to;
+		to = t;
+	}
+	if (from != a)
+		memcpy(a, from, n * sizeof(*a));
+}
+
+static int
+skeycmp(const void *va, const void *vb)
+{
+	const struct skey *a, *b;
+
+	a = va;
+	b = vb;
+	if (a->key != b->key)
+		return (a->key < b->key ? -1 : 1);
+	if (a->nsec != b->nsec)
+		return (a->nsec < b->nsec ? -1 : 1);
+	if (a->pfx != b->pfx)
+		return (a->pfx < b->pfx ? -1 : 1);
+	return (strcmp(a->p->fts_name, b->p->fts_name));
+}
@@ -0,0 +1,338 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * The directory reader underneath walk.c.
+ *
+ * On Linux, names are pulled out of the kernel with getdents64(2) into one
+ * large buffer, so that even a huge directory takes only a handful of
+ * system calls, and entries are stat'ed with statx(2), asking only for
+ * the fields the listing is going to print and telling the file system
+ * not to go to the server for them (AT_STATX_DONT_SYNC).  Everywhere
+ * else, this falls back to readdir(3) and fstatat(2).
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ls.h"
+#include "extern.h"
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define USE_GETDENTS
+#endif
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+#define USE_STATX
+#endif
+
+#ifdef USE_GETDENTS
+#define DIRREAD_BUFSIZ	(256 * 1024)
+
+struct linux_dirent64 {
+	u_int64_t	d_ino;
+	int64_t		d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	char		d_name[];
+};
+#endif
+
+struct dirread {
+	int		 fd;
+#ifdef USE_GETDENTS
+	char		*buf;
+	size_t		 len;
+	size_t		 pos;
+#else
+	DIR		*dirp;
+#endif
+};
+
+/*
+ * A DIRREAD can be used for one directory after another; its buffer is
+ * kept around between them.
+ */
+DIRREAD *
+dirread_alloc(void)
+{
+	DIRREAD *dr;
+
+	if ((dr = calloc(1, sizeof(DIRREAD))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	dr->fd = -1;
+#ifdef USE_GETDENTS
+	if ((dr->buf = malloc(DIRREAD_BUFSIZ)) == NULL)
+		err(EXIT_FAILURE, NULL);
+#endif
+	return (dr);
+}
+
+/*
+ * The directories are opened by their whole path, which in a deep
+ * enough tree is longer than PATH_MAX.  fts(3) gets away with that by
+ * chdir'ing down the tree, but the walker's threads share a working
+ * directory, so a path that is too long is opened piece by piece
+ * instead, each one relative to the last.
+ */
+static int
+dirread_openpath(const char *path)
+{
+	char buf[PATH_MAX];
+	const char *p, *end;
+	int fd, nfd, serrno;
+
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1 ||
+	    errno != ENAMETOOLONG)
+		return (fd);
+
+	fd = AT_FDCWD;
+	for (p = path; strlen(p) >= sizeof(buf); p = end) {
+		/* As much of it as fits, up to a slash. */
+		for (end = p + sizeof(buf) - 1; end > p && *end != '/'; end--)
+			continue;
+		if (end == p) {
+			nfd = -1;
+			errno = ENAMETOOLONG;
+			goto out;
+		}
+		memcpy(buf, p, end - p);
+		buf[end - p] = '\0';
+		nfd = openat(fd, buf, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd != AT_FDCWD)
+			(void)close(fd);
+		if ((fd = nfd) == -1)
+			return (-1);
+		while (*end == '/')
+			end++;
+	}
+	nfd = openat(fd, p, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+out:
+	serrno = errno;
+	if (fd != AT_FDCWD)
+		(void)close(fd);
+	errno = serrno;
+	return (nfd);
+}
+
+int
+dirread_open(DIRREAD *dr, const char *path)
+{
+
+#ifdef USE_GETDENTS
+	if ((dr->fd = dirread_openpath(path)) == -1)
+		return (-1);
+	dr->len = dr->pos = 0;
+#else
+	int fd;
+
+	if ((fd = dirread_openpath(path)) == -1)
+		return (-1);
+	if ((dr->dirp = fdopendir(fd)) == NULL) {
+		(void)close(fd);
+		return (-1);
+	}
+	dr->fd = fd;
+#endif
+	return (0);
+}
+
+/*
+ * Return the next name in the directory, or NULL at the end, with errno
+ * set to 0, or on an error, with errno set to say what it was.  The name
+ * stays valid until the next call.  *typep is set to the entry's DT_
+ * type, or DT_UNKNOWN if the file system does not say.
+ */
+const char *
+dirread_next(DIRREAD *dr, size_t *lenp, int *typep)
+{
+#ifdef USE_GETDENTS
+	struct linux_dirent64 *dp;
+	long n;
+
+	if (dr->pos >= dr->len) {
+		if ((n = syscall(SYS_getdents64, dr->fd, dr->buf,
+		    DIRREAD_BUFSIZ)) == -1)
+			return (NULL);
+		if (n == 0) {
+			errno = 0;
+			return (NULL);
+		}
+		dr->len = n;
+		dr->pos = 0;
+	}
+	dp = (struct linux_dirent64 *)(dr->buf + dr->pos);
+	dr->pos += dp->d_reclen;
+	*lenp = strlen(dp->d_name);
+	*typep = dp->d_type;
+	return (dp->d_name);
+#else
+	struct dirent *dp;
+
+	errno = 0;
+	if ((dp = readdir(dr->dirp)) == NULL)
+		return (NULL);
+	*lenp = strlen(dp->d_name);
+#ifdef DT_UNKNOWN
+	*typep = dp->d_type;
+#else
+	*typep = 0;
+#endif
+	return (dp->d_name);
+#endif
+}
+
+/*
+ * Stat name in the directory, following a symbolic link if follow is set.
+ * Only the FLD_ fields in fields are guaranteed to be filled in, along
+ * with the file type, inode and device number.
+ */
+int
+dirread_stat(DIRREAD *dr, const char *name, int follow, int fields,
+    struct stat *sp)
+{
+#ifdef USE_STATX
+	struct statx stx;
+	unsigned int mask;
+
+	mask = STATX_TYPE | STATX_INO;
+	if (fields & (FLD_MODE | FLD_EXEC))
+		mask |= STATX_MODE;
+	if (fields & FLD_NLINK)
+		mask |= STATX_NLINK;
+	if (fields & FLD_OWNER)
+		mask |= STATX_UID | STATX_GID;
+	if (fields & FLD_SIZE)
+		mask |= STATX_SIZE;
+	if (fields & FLD_BLOCKS)
+		mask |= STATX_BLOCKS;
+	if (fields & FLD_ATIME)
+		mask |= STATX_ATIME;
+	if (fields & FLD_MTIME)
+		mask |= STATX_MTIME;
+	if (fields & FLD_CTIME)
+		mask |= STATX_CTIME;
+
+	if (statx(dr->fd, name, AT_STATX_DONT_SYNC |
+	    (follow ? 0 : AT_SYMLINK_NOFOLLOW), mask, &stx) == -1) {
+		if (errno != ENOSYS)
+			return (-1);
+		return (fstatat(dr->fd, name, sp,
+		    follow ? 0 : AT_SYMLINK_NOFOLLOW));
+	}
+
+	memset(sp, 0, sizeof(struct stat));
+	sp->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+	sp->st_ino = stx.stx_ino;
+	sp->st_mode = stx.stx_mode;
+	sp->st_nlink = stx.stx_nlink;
+	sp->st_uid = stx.stx_uid;
+	sp->st_gid = stx.stx_gid;
+	sp->st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+	sp->st_size = stx.stx_size;
+	sp->st_blksize = stx.stx_blksize;
+	sp->st_blocks = stx.stx_blocks;
+	sp->st_atim.tv_sec = stx.stx_atime.tv_sec;
+	sp->st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+	sp->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+	sp->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+	sp->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+	sp->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+	return (0);
+#else
+	(void)fields;
+	return (fstatat(dr->fd, name, sp, follow ? 0 : AT_SYMLINK_NOFOLLOW));
+#endif
+}
+
+/*
+ * Stat the directory itself.  Unlike dirread_stat(), this always asks
+ * the file system for the current attributes, even a network one that
+ * has them cached: the -z snapshot goes by them to tell whether the
+ * directory has changed.
+ */
+int
+dirread_fstat(DIRREAD *dr, struct stat *sp)
+{
+
+	return (fstat(dr->fd, sp));
+}
+
+/*
+ * Fill in *sp for an entry of type type, as returned by dirread_next(),
+ * without a stat, if the FLD_ fields in fields do not ask for more than
+ * the type tells.  Only the file type is filled in, and the rest zeroed.
+ * Return -1 if the entry has to be stat'ed after all, because its type
+ * is unknown, it is a symbolic link to follow, or it is a regular file
+ * whose permissions are wanted.
+ */
+int
+dirread_type(int type, int follow, int fields, struct stat *sp)
+{
+
+#ifdef DTTOIF
+	if ((fields & ~(FLD_TYPE | FLD_EXEC)) != 0 || type == DT_UNKNOWN ||
+	    (follow && type == DT_LNK) ||
+	    ((fields & FLD_EXEC) && type == DT_REG))
+		return (-1);
+	memset(sp, 0, sizeof(struct stat));
+	sp->st_mode = DTTOIF(type);
+	return (0);
+#else
+	(void)type;
+	(void)follow;
+	(void)fields;
+	(void)sp;
+	return (-1);
+#endif
+}
+
+void
+dirread_close(DIRREAD *dr)
+{
+
+#ifdef USE_GETDENTS
+	(void)close(dr->fd);
+#else
+	(void)closedir(dr->dirp);
+#endif
+	dr->fd = -1;
+}
+
+void
+dirread_free(DIRREAD *dr)
+{
+
+#ifdef USE_GETDENTS
+	free(dr->buf);
+#endif
+	free(dr);
+}
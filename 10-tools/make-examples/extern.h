@@ -31,6 +31,11 @@
  *	@(#)extern.h	8.1 (Berkeley) 5/31/93
  */
 
+ARENA	*arena_create(void);
+void	*arena_malloc(ARENA *, size_t);
+void	 arena_reset(ARENA *);
+void	 arena_stats(ARENA *, const char *);
+
 int	 acccmp(const FTSENT *, const FTSENT *);
 int	 revacccmp(const FTSENT *, const FTSENT *);
 int	 modcmp(const FTSENT *, const FTSENT *);
@@ -41,16 +46,66 @@ int	 statcmp(const FTSENT *, const FTSENT *);
 int	 revstatcmp(const FTSENT *, const FTSENT *);
 int	 sizecmp(const FTSENT *, const FTSENT *);
 int	 revsizecmp(const FTSENT *, const FTSENT *);
+FTSENT	*sortlist(FTSENT *, size_t);
+
+DIRREAD	*dirread_alloc(void);
+void	 dirread_close(DIRREAD *);
+void	 dirread_free(DIRREAD *);
+int	 dirread_fstat(DIRREAD *, struct stat *);
+const char *dirread_next(DIRREAD *, size_t *, int *);
+int	 dirread_open(DIRREAD *, const char *);
+int	 dirread_stat(DIRREAD *, const char *, int, int, struct stat *);
+int	 dirread_type(int, int, int, struct stat *);
+
+const char *idcache_group(gid_t);
+void	 idcache_stats(void);
+const char *idcache_user(uid_t);
 
 int	 ls_main(int, char *[]);
 
+size_t	 namescan(const char *, size_t, int);
+int	 namewidth(const char *, size_t);
+
+void	 out_char(int);
+void	 out_commit(size_t);
+int	 out_flush(void);
+void	 out_int(int64_t);
+int	 out_pad(const char *, int, int);
+char	*out_reserve(size_t);
+void	 out_spaces(int);
+int	 out_str(const char *);
+int	 out_uint(u_int64_t, int);
+void	 out_write(const char *, size_t);
+
 int	 printescaped(const char *);
 void	 printacol(DISPLAY *);
 void	 printcol(DISPLAY *);
+void	 printentry(DISPLAY *, FTSENT *);
 void	 printlong(DISPLAY *);
+void	 printrecords(DISPLAY *);
 void	 printscol(DISPLAY *);
 void	 printstream(DISPLAY *);
+void	 recordfill(struct lsrecord *, const struct stat *);
+void	 recordstat(const struct lsrecord *, struct stat *);
 int	 safe_print(const char *);
 void	 usage(void);
 
+void	 snapshot_add(SNAPSHOT *, const char *, const struct stat *, FTSENT *,
+	    int);
+int	 snapshot_close(SNAPSHOT *);
+const struct lsrecord *snapshot_find(SNAPSHOT *, const char *,
+	    const struct stat *, size_t *);
+SNAPSHOT *snapshot_open(const char *, int);
+void	 snapshot_stats(SNAPSHOT *);
+
+size_t	 timefmt(char *, time_t, time_t, int);
+void	 timefmt_stats(void);
+size_t	 timefmt_uncached(char *, time_t, time_t, int);
+
+FTSENT	*walk_children(WALK *);
+void	 walk_close(WALK *);
+WALK	*walk_open(FTSENT *, int, int, FTSENT *(*)(FTSENT *, size_t), int,
+	    int, SNAPSHOT *);
+FTSENT	*walk_read(WALK *);
+
 #include "stat_flags.h"
@@ -0,0 +1,121 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * A cache of user and group names for the long format.
+ *
+ * With the passwd and group databases behind LDAP or SSSD, every lookup
+ * that misses the C library's own small cache can be a round trip to a
+ * server, so a long listing of a tree with many owners spends most of
+ * its time waiting for names.  The caches here live for the whole run,
+ * remember ids that have no name as well as those that do, and have a
+ * fixed size: each id hashes to a set of a few slots, and when all of
+ * them are taken, they are reused in turn.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <fts.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ls.h"
+#include "extern.h"
+
+#define IDCACHE_SETS	256	/* must be a power of two */
+#define IDCACHE_WAYS	4
+
+struct ident {
+	u_int32_t	 id;
+	int		 valid;
+	char		*name;		/* NULL if the id has no name */
+};
+
+struct idcache {
+	struct ident	 ent[IDCACHE_SETS][IDCACHE_WAYS];
+	int		 next[IDCACHE_SETS];	/* slot to reuse next */
+	u_long		 hits;
+	u_long		 misses;
+};
+
+static struct idcache users, groups;
+
+static const char	*idcache_lookup(struct idcache *, u_int32_t, int);
+
+/*
+ * Return the name of user uid, or NULL if it has none.
+ */
+const char *
+idcache_user(uid_t uid)
+{
+
+	return (idcache_lookup(&users, uid, 1));
+}
+
+/*
+ * Return the name of group gid, or NULL if it has none.
+ */
+const char *
+idcache_group(gid_t gid)
+{
+
+	return (idcache_lookup(&groups, gid, 0));
+}
+
+void
+idcache_stats(void)
+{
+
+	warnx("user names: %lu hits, %lu misses", users.hits, users.misses);
+	warnx("group names: %lu hits, %lu misses", groups.hits, groups.misses);
+}
+
+static const char *
+idcache_lookup(struct idcache *c, u_int32_t id, int user)
+{
+	struct ident *set, *e;
+	const char *name;
+	u_int32_t h;
+	int i;
+
+	/* Ids tend to be handed out in sequence; spread them by hashing. */
+	h = (id * 2654435761U >> 16) & (IDCACHE_SETS - 1);
+	set = c->ent[h];
+	for (i = 0; i < IDCACHE_WAYS; i++)
+		if (set[i].valid && set[i].id == id) {
+			c->hits++;
+			return (set[i].name);
+		}
+	c->misses++;
+
+	if (user)
+		name = user_from_uid((uid_t)id, 1);
+	else
+		name = group_from_gid((gid_t)id, 1);
+
+	e = &set[c->next[h]];
+	c->next[h] = (c->next[h] + 1) % IDCACHE_WAYS;
+	free(e->name);
+	e->id = id;
+	e->valid = 1;
+	if (name == NULL)
+		e->name = NULL;
+	else if ((e->name = strdup(name)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	return (e->name);
+}
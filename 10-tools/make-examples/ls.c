@@ -68,17 +68,23 @@ __RCSID("$NetBSD: ls.c,v 1.55 2003/12/26 10:51:25 simonb Exp $");
 
 static void	 display(FTSENT *, FTSENT *);
 static int	 mastercmp(const FTSENT **, const FTSENT **);
+static void	 printdirname(FTSENT *, int);
+static void	 flushout(void);
+static void	 ptraverse(int, FTSENT *, int);
+static int	 statfields(void);
+static void	 straverse(int, FTSENT *, int);
 static void	 traverse(int, char **, int);
 
 static void (*printfcn)(DISPLAY *);
 static int (*sortfcn)(const FTSENT *, const FTSENT *);
 
-#define	BY_NAME 0
-#define	BY_SIZE 1
-#define	BY_TIME	2
+static ARENA *names;		/* display()'s NAMES, one directory's worth */
+static SNAPSHOT *snap;		/* the index for -z */
 
 long blocksize;			/* block size units */
+int jobs;			/* number of traversal threads for -j */
 int termwidth = 80;		/* default terminal width */
+int ttyout;			/* stdout is a terminal */
 int sortkey = BY_NAME;
 int rval = EXIT_SUCCESS;	/* exit value - set if error encountered */
 
@@ -86,8 +92,10 @@ int rval = EXIT_SUCCESS;	/* exit value - set if error encountered */
 int f_accesstime;		/* use time of last access */
 int f_column;			/* columnated format */
 int f_columnacross;		/* columnated format, sorted across */
+int f_debug;			/* report cache statistics on exit */
 int f_flags;			/* show flags associated with a file */
 int f_grouponly;		/* long listing without owner */
+int f_immediate;		/* print entries as they are read */
 int f_humanize;			/* humanize the size field */
 int f_inode;			/* print inode */
 int f_listdir;			/* list actual directory, not contents */
@@ -98,6 +106,7 @@ int f_nosort;			/* don't sort output */
 int f_numericonly;		/* don't convert uid/gid to name */
 int f_octal;			/* print octal escapes for nongraphic characters */
 int f_octal_escape;		/* like f_octal but use C escapes if possible */
+int f_record;			/* one record per entry: REC_JSON, REC_BINARY */
 int f_recursive;		/* ls subdirectories also */
 int f_reversesort;		/* reverse whatever sort is used */
 int f_sectime;			/* print the real time for all files */
@@ -108,6 +117,7 @@ int f_stream;			/* stream format */
 int f_type;			/* add type character for non-regular files */
 int f_typedir;			/* add type character for directories */
 int f_whiteout;			/* show whiteout entries */
+char *f_snapshot;		/* the index file for -z */
 
 int
 ls_main(int argc, char *argv[])
@@ -117,11 +127,20 @@ ls_main(int argc, char *argv[])
 	int ch, fts_options;
 	int kflag = 0;
 	const char *p;
+	char *ep;
 
 	setlocale(LC_ALL, "");
 
+	/* Don't lose buffered output if we bail out with err(3). */
+	(void)atexit(flushout);
+
+	/* Set LS_DEBUG in the environment to see how the caches did. */
+	if (getenv("LS_DEBUG") != NULL)
+		f_debug = 1;
+
 	/* Terminal defaults to -Cq, non-terminal defaults to -1. */
 	if (isatty(STDOUT_FILENO)) {
+		ttyout = 1;
 		if ((p = getenv("COLUMNS")) != NULL)
 			termwidth = atoi(p);
 		else if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &win) == 0 &&
@@ -136,30 +155,34 @@ ls_main(int argc, char *argv[])
 		f_listdot = 1;
 
 	fts_options = FTS_PHYSICAL;
-	while ((ch = getopt(argc, argv, "1ABCFLRSTWabcdfghiklmnopqrstuwx")) != -1) {
+	while ((ch = getopt(argc, argv, "1ABCFLO:RSTUWabcdfghij:klmnopqrstuwxz:")) != -1) {
 		switch (ch) {
 		/*
-		 * The -1, -C, -l, -m and -x options all override each other so
-		 * shell aliasing works correctly.
+		 * The -1, -C, -l, -m, -O and -x options all override each
+		 * other so shell aliasing works correctly.
 		 */
 		case '1':
 			f_singlecol = 1;
 			f_column = f_columnacross = f_longform = f_stream = 0;
+			f_record = 0;
 			break;
 		case 'C':
 			f_column = 1;
 			f_columnacross = f_longform = f_singlecol = f_stream =
 			    0;
+			f_record = 0;
 			break;
 		case 'g':
 			if (f_grouponly != -1)
 				f_grouponly = 1;
 			f_longform = 1;
 			f_column = f_columnacross = f_singlecol = f_stream = 0;
+			f_record = 0;
 			break;
 		case 'l':
 			f_longform = 1;
 			f_column = f_columnacross = f_singlecol = f_stream = 0;
+			f_record = 0;
 			/* Never let -g take precedence over -l. */
 			f_grouponly = -1;
 			break;
@@ -167,10 +190,23 @@ ls_main(int argc, char *argv[])
 			f_stream = 1;
 			f_column = f_columnacross = f_longform = f_singlecol =
 			    0;
+			f_record = 0;
+			break;
+		case 'O':
+			if (strcmp(optarg, "json") == 0)
+				f_record = REC_JSON;
+			else if (strcmp(optarg, "binary") == 0)
+				f_record = REC_BINARY;
+			else
+				errx(EXIT_FAILURE, "unknown output format: %s",
+				    optarg);
+			f_column = f_columnacross = f_longform = f_singlecol =
+			    f_stream = 0;
 			break;
 		case 'x':
 			f_columnacross = 1;
 			f_column = f_longform = f_singlecol = f_stream = 0;
+			f_record = 0;
 			break;
 		/* The -c and -u options override each other. */
 		case 'c':
@@ -220,6 +256,14 @@ ls_main(int argc, char *argv[])
 		case 'i':
 			f_inode = 1;
 			break;
+		case 'j':
+			errno = 0;
+			jobs = (int)strtol(optarg, &ep, 10);
+			if (*optarg == '\0' || *ep != '\0' || errno ||
+			    jobs < 1)
+				errx(EXIT_FAILURE, "invalid number of jobs: %s",
+				    optarg);
+			break;
 		case 'k':
 			blocksize = 1024;
 			kflag = 1;
@@ -261,6 +305,11 @@ ls_main(int argc, char *argv[])
 		case 't':
 			sortkey = BY_TIME;
 			break;
+		/* The -U option implies -f. */
+		case 'U':
+			f_immediate = 1;
+			f_nosort = 1;
+			break;
 		case 'W':
 			f_whiteout = 1;
 			break;
@@ -270,6 +319,9 @@ ls_main(int argc, char *argv[])
 			f_octal = 0;
 			f_octal_escape = 0;
 			break;
+		case 'z':
+			f_snapshot = optarg;
+			break;
 		default:
 		case '?':
 			usage();
@@ -278,6 +330,10 @@ ls_main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	/* The snapshot does not keep file flags. */
+	if (f_snapshot != NULL && f_flags)
+		errx(EXIT_FAILURE, "-o cannot be used with -z");
+
 	/*
 	 * If both -g and -l options, let -l take precedence.
 	 */
@@ -285,11 +341,11 @@ ls_main(int argc, char *argv[])
 		f_grouponly = 0;
 
 	/*
-	 * If not -F, -i, -l, -p, -S, -s or -t options, don't require stat
+	 * If not -F, -i, -l, -O, -p, -S, -s or -t options, don't require stat
 	 * information.
 	 */
 	if (!f_inode && !f_longform && !f_size && !f_type && !f_typedir &&
-	    sortkey == BY_NAME)
+	    !f_record && sortkey == BY_NAME && f_snapshot == NULL)
 		fts_options |= FTS_NOSTAT;
 
 	/*
@@ -352,7 +408,9 @@ ls_main(int argc, char *argv[])
 	}
 
 	/* Select a print function. */
-	if (f_singlecol)
+	if (f_record)
+		printfcn = printrecords;
+	else if (f_singlecol)
 		printfcn = printscol;
 	else if (f_columnacross)
 		printfcn = printacol;
@@ -363,10 +421,26 @@ ls_main(int argc, char *argv[])
 	else
 		printfcn = printcol;
 
+	if (f_snapshot != NULL)
+		snap = snapshot_open(f_snapshot, fts_options);
 	if (argc)
 		traverse(argc, argv, fts_options);
 	else
 		traverse(1, dotav, fts_options);
+	if (out_flush() == -1)
+		err(EXIT_FAILURE, "stdout");
+	if (f_debug) {
+		idcache_stats();
+		timefmt_stats();
+		if (names != NULL)
+			arena_stats(names, "names");
+		if (snap != NULL)
+			snapshot_stats(snap);
+	}
+	if (snap != NULL && snapshot_close(snap) == -1) {
+		warn("%s", f_snapshot);
+		rval = EXIT_FAILURE;
+	}
 	exit(rval);
 	/* NOTREACHED */
 }
@@ -390,10 +464,28 @@ traverse(int argc, char *argv[], int options)
 	    fts_open(argv, options, f_nosort ? NULL : mastercmp)) == NULL)
 		err(EXIT_FAILURE, NULL);
 
-	display(NULL, fts_children(ftsp, 0));
+	chp = fts_children(ftsp, 0);
+	display(NULL, chp);
 	if (f_listdir)
 		return;
 
+	if (f_immediate && !f_whiteout && snap == NULL) {
+		straverse(argc, chp, options);
+		return;
+	}
+
+	/*
+	 * Hand everything below the roots to the walker, which reads the
+	 * directories in bulk and only asks for the stat fields we print.
+	 * Without -j, it does so without any threads.  Plain name listings
+	 * are left to fts(3), which does not stat them anyway.  Only the
+	 * walker knows about snapshots.
+	 */
+	if (!f_whiteout && (jobs || !(options & FTS_NOSTAT) || snap != NULL)) {
+		ptraverse(argc, chp, options);
+		return;
+	}
+
 	/*
 	 * If not recursing down this tree and don't need stat info, just get
 	 * the names.
@@ -415,18 +507,7 @@ traverse(int argc, char *argv[], int options)
 			    p->fts_name[0] == '.' && !f_listdot)
 				break;
 
-			/*
-			 * If already output something, put out a newline as
-			 * a separator.  If multiple arguments, precede each
-			 * directory with its name.
-			 */
-			if (output)
-				(void)printf("\n%s:\n", p->fts_path);
-			else if (argc > 1) {
-				(void)printf("%s:\n", p->fts_path);
-				output = 1;
-			}
-
+			printdirname(p, argc);
 			chp = fts_children(ftsp, ch_options);
 			display(p, chp);
 
@@ -438,6 +519,465 @@ traverse(int argc, char *argv[], int options)
 		err(EXIT_FAILURE, "fts_read");
 }
 
+/*
+ * Ptraverse() is traverse() on top of the walker: the roots still come
+ * from fts, but everything below them is read by walk_read(), with the
+ * help of its worker threads under -j.  The
+ * directories are handed to display() in the same order as fts_read()
+ * would have handed them over, so the output does not change.
+ */
+static void
+ptraverse(int argc, FTSENT *roots, int options)
+{
+	WALK *wp;
+	FTSENT *p;
+
+	wp = walk_open(roots, options, statfields(),
+	    f_nosort ? NULL : sortlist, f_recursive, jobs, snap);
+	while ((p = walk_read(wp)) != NULL)
+		switch (p->fts_info) {
+		case FTS_DC:
+			warnx("%s: directory causes a cycle", p->fts_name);
+			break;
+		case FTS_DNR:
+			warnx("%s: %s", p->fts_name, strerror(p->fts_errno));
+			rval = EXIT_FAILURE;
+			break;
+		case FTS_D:
+			if (p->fts_level != FTS_ROOTLEVEL &&
+			    p->fts_name[0] == '.' && !f_listdot)
+				break;
+
+			printdirname(p, argc);
+			display(p, walk_children(wp));
+			break;
+		}
+	walk_close(wp);
+}
+
+/*
+ * State for straverse().
+ */
+struct stream {
+	DIRREAD		*dr;
+	DISPLAY		 d;		/* column widths so far */
+	FTSENT		*ent;		/* the entry being printed */
+	struct stat	 sb;
+	NAMES		*np;
+	size_t		 npsize;
+	int		 argc;
+	int		 options;
+	int		 fields;
+};
+
+/* The directories above the one being read, for cycle detection. */
+struct sparent {
+	dev_t		 dev;
+	ino_t		 ino;
+	struct sparent	*up;
+};
+
+/* A subdirectory to descend into once its parent has been listed. */
+struct ssub {
+	dev_t		 dev;
+	ino_t		 ino;
+	size_t		 off;		/* of its name in the name buffer */
+};
+
+static void	 streamdir(struct stream *, const char *, const char *, int,
+		    struct sparent *);
+static void	 streamentry(struct stream *, FTSENT *);
+static int	 streaminfo(FTSENT *);
+static int	 streamstat(struct stream *, FTSENT *);
+
+/*
+ * Straverse() is traverse() for -U: each entry is printed as soon as it
+ * has been read, rather than once the whole directory has been read and
+ * sorted, so the first lines come out right away and memory use does not
+ * grow with the size of a directory.  The columns of the long format
+ * start out at widths that fit most listings, and grow when an entry
+ * does not fit.
+ */
+static void
+straverse(int argc, FTSENT *roots, int options)
+{
+	struct stream ss;
+	struct sparent top;
+	struct stat sb;
+	FTSENT *p;
+
+	memset(&ss, 0, sizeof(ss));
+	ss.dr = dirread_alloc();
+	if ((ss.ent = malloc(sizeof(FTSENT) + MAXNAMLEN + 1)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	ss.argc = argc;
+	ss.options = options;
+	ss.fields = options & FTS_NOSTAT ? 0 : statfields();
+	ss.d.s_inode = 8;
+	ss.d.s_nlink = 3;
+	ss.d.s_user = ss.d.s_group = 8;
+	if (f_humanize)
+		ss.d.s_block = ss.d.s_size = 4;
+	else {
+		ss.d.s_block = 4;
+		ss.d.s_size = 8;
+	}
+
+	/*
+	 * As in walk_open(), the roots' fts_name holds the whole argument,
+	 * and under FTS_NOSTAT they have to be stat'ed again.
+	 */
+	for (p = roots; p != NULL; p = p->fts_link) {
+		if (p->fts_info != FTS_D)
+			continue;
+		if (!(options & FTS_NOSTAT))
+			sb = *p->fts_statp;
+		else if (stat(p->fts_name, &sb) == -1)
+			memset(&sb, 0, sizeof(sb));
+		top.dev = sb.st_dev;
+		top.ino = sb.st_ino;
+		top.up = NULL;
+		streamdir(&ss, p->fts_name, p->fts_name, FTS_ROOTLEVEL, &top);
+	}
+	dirread_free(ss.dr);
+	free(ss.ent);
+	free(ss.np);
+}
+
+/*
+ * List the directory at path, whose own name is name, and then descend
+ * into its subdirectories in the order they were read, the way fts(3)
+ * would.  Hidden directories are read, but not listed.
+ */
+static void
+streamdir(struct stream *ss, const char *path, const char *name, int level,
+    struct sparent *parent)
+{
+	FTSENT dir, *p;
+	struct sparent self, *t;
+	struct ssub *subs;
+	const char *dname;
+	char *names, *cpath;
+	size_t len, namesize, nameslen, plen;
+	int hidden, i, nsubs, maxsubs, type;
+
+	memset(&dir, 0, sizeof(dir));
+	dir.fts_path = dir.fts_accpath = (char *)path;
+	dir.fts_pathlen = strlen(path);
+	dir.fts_level = level;
+	hidden = level != FTS_ROOTLEVEL && name[0] == '.' && !f_listdot;
+	if (!hidden)
+		printdirname(&dir, ss->argc);
+
+	if (dirread_open(ss->dr, path) == -1) {
+		warnx("%s: %s", name, strerror(errno));
+		rval = EXIT_FAILURE;
+		return;
+	}
+
+	subs = NULL;
+	names = NULL;
+	nsubs = maxsubs = 0;
+	namesize = nameslen = 0;
+	p = ss->ent;
+	while ((dname = dirread_next(ss->dr, &len, &type)) != NULL) {
+		if (ISDOT(dname) && !(ss->options & FTS_SEEDOT))
+			continue;
+		memset(p, 0, sizeof(FTSENT));
+		memcpy(p->fts_name, dname, len + 1);
+		p->fts_namelen = len;
+		p->fts_accpath = p->fts_name;
+		p->fts_parent = &dir;
+		p->fts_level = level + 1;
+		p->fts_statp = &ss->sb;
+
+		/*
+		 * Without FTS_NOSTAT, stat everything whose type does not
+		 * tell enough.  Otherwise, stat only what might be a
+		 * directory to descend into.
+		 */
+		if (!(ss->options & FTS_NOSTAT)) {
+			if ((f_recursive && type == DT_DIR) ||
+			    dirread_type(type, ss->options & FTS_LOGICAL,
+			    ss->fields, p->fts_statp) == -1)
+				p->fts_info = streamstat(ss, p);
+			else
+				p->fts_info = streaminfo(p);
+		} else if (f_recursive && !ISDOT(dname) &&
+		    (!(ss->options & FTS_PHYSICAL) ||
+		    type == DT_DIR || type == DT_UNKNOWN))
+			p->fts_info = streamstat(ss, p);
+		else
+			p->fts_info = FTS_NSOK;
+
+		if (p->fts_info == FTS_D && f_recursive) {
+			if (nsubs == maxsubs) {
+				maxsubs = maxsubs ? maxsubs * 2 : 16;
+				if ((subs = realloc(subs,
+				    maxsubs * sizeof(*subs))) == NULL)
+					err(EXIT_FAILURE, NULL);
+			}
+			if (nameslen + len + 1 > namesize) {
+				namesize = (nameslen + len + 1) * 2;
+				if ((names = realloc(names, namesize)) == NULL)
+					err(EXIT_FAILURE, NULL);
+			}
+			subs[nsubs].dev = ss->sb.st_dev;
+			subs[nsubs].ino = ss->sb.st_ino;
+			subs[nsubs].off = nameslen;
+			memcpy(names + nameslen, dname, len + 1);
+			nameslen += len + 1;
+			nsubs++;
+		}
+
+		if (hidden)
+			continue;
+		if (p->fts_info == FTS_NS) {
+			warnx("%s: %s", p->fts_name, strerror(p->fts_errno));
+			rval = EXIT_FAILURE;
+			continue;
+		}
+		if (p->fts_name[0] == '.' && !f_listdot)
+			continue;
+		streamentry(ss, p);
+		output = 1;
+	}
+	if (errno != 0) {
+		warnx("%s: %s", name, strerror(errno));
+		rval = EXIT_FAILURE;
+	}
+	dirread_close(ss->dr);
+	if (ttyout)
+		(void)out_flush();
+
+	self.up = parent;
+	plen = dir.fts_pathlen;
+	if (plen > 0 && path[plen - 1] == '/')
+		plen--;
+	for (i = 0; i < nsubs; i++) {
+		dname = names + subs[i].off;
+		for (t = parent; t != NULL; t = t->up)
+			if (t->dev == subs[i].dev && t->ino == subs[i].ino)
+				break;
+		if (t != NULL) {
+			warnx("%s: directory causes a cycle", dname);
+			continue;
+		}
+		len = strlen(dname);
+		if ((cpath = malloc(plen + len + 2)) == NULL)
+			err(EXIT_FAILURE, NULL);
+		memcpy(cpath, path, plen);
+		cpath[plen] = '/';
+		memcpy(cpath + plen + 1, dname, len + 1);
+		self.dev = subs[i].dev;
+		self.ino = subs[i].ino;
+		streamdir(ss, cpath, dname, level + 1, &self);
+		free(cpath);
+	}
+	free(subs);
+	free(names);
+}
+
+/*
+ * Print an entry, first widening any column it would not fit in.
+ */
+static void
+streamentry(struct stream *ss, FTSENT *p)
+{
+	struct stat *sp;
+	DISPLAY *d;
+	NAMES *np;
+	const char *user, *group;
+	char buf[21], nuser[12], ngroup[12];
+	char *flags = NULL;
+	size_t need;
+	int flen, glen, len, ulen;
+
+	d = &ss->d;
+	sp = p->fts_statp;
+	if (f_inode &&
+	    (len = snprintf(buf, sizeof(buf), "%lu",
+	    (unsigned long)sp->st_ino)) > d->s_inode)
+		d->s_inode = len;
+	if ((f_size || f_longform) && !f_humanize &&
+	    (len = snprintf(buf, sizeof(buf), "%llu",
+	    (long long)howmany(sp->st_blocks, blocksize))) > d->s_block)
+		d->s_block = len;
+	if (!f_longform) {
+		printentry(d, p);
+		return;
+	}
+
+	if ((len = snprintf(buf, sizeof(buf), "%lu",
+	    (unsigned long)sp->st_nlink)) > d->s_nlink)
+		d->s_nlink = len;
+	if (S_ISCHR(sp->st_mode) || S_ISBLK(sp->st_mode)) {
+		if ((len = snprintf(buf, sizeof(buf), "%u",
+		    major(sp->st_rdev))) > d->s_major)
+			d->s_major = len;
+		if ((len = snprintf(buf, sizeof(buf), "%u",
+		    minor(sp->st_rdev))) > d->s_minor)
+			d->s_minor = len;
+		if (d->s_major + d->s_minor + 2 > d->s_size)
+			d->s_size = d->s_major + d->s_minor + 2;
+		else if (d->s_size - d->s_minor - 2 > d->s_major)
+			d->s_major = d->s_size - d->s_minor - 2;
+	} else if (!f_humanize &&
+	    (len = snprintf(buf, sizeof(buf), "%llu",
+	    (long long)sp->st_size)) > d->s_size)
+		d->s_size = len;
+
+	if (f_numericonly || (user = idcache_user(sp->st_uid)) == NULL) {
+		(void)snprintf(nuser, sizeof(nuser), "%u", sp->st_uid);
+		user = nuser;
+	}
+	if (f_numericonly || (group = idcache_group(sp->st_gid)) == NULL) {
+		(void)snprintf(ngroup, sizeof(ngroup), "%u", sp->st_gid);
+		group = ngroup;
+	}
+	if ((ulen = strlen(user)) > d->s_user)
+		d->s_user = ulen;
+	if ((glen = strlen(group)) > d->s_group)
+		d->s_group = glen;
+	flen = 0;
+	if (f_flags) {
+		flags = flags_to_string(sp->st_flags, "-");
+		if ((flen = strlen(flags)) > d->s_flags)
+			d->s_flags = flen;
+	}
+
+	need = sizeof(NAMES) + ulen + glen + flen + 3;
+	if (need > ss->npsize) {
+		if ((ss->np = realloc(ss->np, need)) == NULL)
+			err(EXIT_FAILURE, NULL);
+		ss->npsize = need;
+	}
+	np = ss->np;
+	np->user = &np->data[0];
+	(void)strcpy(np->user, user);
+	np->group = &np->data[ulen + 1];
+	(void)strcpy(np->group, group);
+	if (f_flags) {
+		np->flags = &np->data[ulen + glen + 2];
+		(void)strcpy(np->flags, flags);
+	}
+	p->fts_pointer = np;
+	printentry(d, p);
+}
+
+/*
+ * Stat p the way fts(3) would, and return its fts_info.
+ */
+static int
+streamstat(struct stream *ss, FTSENT *p)
+{
+	struct stat *sp;
+	int serrno;
+
+	sp = p->fts_statp;
+	if (ss->options & FTS_LOGICAL) {
+		if (dirread_stat(ss->dr, p->fts_name, 1, ss->fields, sp) == -1) {
+			serrno = errno;
+			if (dirread_stat(ss->dr, p->fts_name, 0, ss->fields,
+			    sp) == 0)
+				return (FTS_SLNONE);
+			p->fts_errno = serrno;
+			goto err;
+		}
+	} else if (dirread_stat(ss->dr, p->fts_name, 0, ss->fields,
+	    sp) == -1) {
+		p->fts_errno = errno;
+err:		memset(sp, 0, sizeof(struct stat));
+		return (FTS_NS);
+	}
+	return (streaminfo(p));
+}
+
+/*
+ * Return the fts_info for p from its stat information.
+ */
+static int
+streaminfo(FTSENT *p)
+{
+	struct stat *sp;
+
+	sp = p->fts_statp;
+	if (S_ISDIR(sp->st_mode))
+		return (ISDOT(p->fts_name) ? FTS_DOT : FTS_D);
+	if (S_ISLNK(sp->st_mode))
+		return (FTS_SL);
+	if (S_ISREG(sp->st_mode))
+		return (FTS_F);
+	return (FTS_DEFAULT);
+}
+
+/*
+ * Return the FLD_ stat fields that the listing and the sort need.
+ */
+static int
+statfields(void)
+{
+	int fields, timefield;
+
+	if (f_accesstime)
+		timefield = FLD_ATIME;
+	else if (f_statustime)
+		timefield = FLD_CTIME;
+	else
+		timefield = FLD_MTIME;
+
+	/* A record, or a snapshot, carries all of struct stat. */
+	if (f_record || f_snapshot != NULL)
+		return (FLD_MODE | FLD_NLINK | FLD_OWNER | FLD_SIZE |
+		    FLD_BLOCKS | FLD_ATIME | FLD_MTIME | FLD_CTIME);
+
+	fields = 0;
+	if (f_inode || f_longform || f_size)
+		fields |= FLD_NLINK | FLD_SIZE | FLD_BLOCKS;
+	if (f_longform)
+		fields |= FLD_MODE | FLD_OWNER | timefield;
+	if (f_type)
+		fields |= FLD_TYPE | FLD_EXEC;
+	else if (f_typedir)
+		fields |= FLD_TYPE;
+	if (sortkey == BY_SIZE)
+		fields |= FLD_SIZE;
+	else if (sortkey == BY_TIME)
+		fields |= timefield;
+	return (fields);
+}
+
+/*
+ * If already output something, put out a newline as a separator.  If
+ * multiple arguments, precede each directory with its name.
+ */
+static void
+printdirname(FTSENT *p, int argc)
+{
+
+	/* Records name their directories themselves. */
+	if (f_record)
+		return;
+
+	if (output)
+		out_char('\n');
+	else if (argc > 1)
+		output = 1;
+	else
+		return;
+	out_write(p->fts_path, p->fts_pathlen);
+	out_write(":\n", 2);
+	if (ttyout)
+		(void)out_flush();
+}
+
+static void
+flushout(void)
+{
+
+	(void)out_flush();
+}
+
 /*
  * Display() takes a linked list of FTSENT structures and passes the list
  * along with any other necessary information to the print function.  P
@@ -531,15 +1071,13 @@ display(FTSENT *p, FTSENT *list)
 			stotal += sp->st_size;
 			if (f_longform) {
 				if (f_numericonly ||
-				    (user = user_from_uid(sp->st_uid, 0)) ==
-				    NULL) {
+				    (user = idcache_user(sp->st_uid)) == NULL) {
 					(void)snprintf(nuser, sizeof(nuser),
 					    "%u", sp->st_uid);
 					user = nuser;
 				}
 				if (f_numericonly ||
-				    (group = group_from_gid(sp->st_gid, 0)) ==
-				    NULL) {
+				    (group = idcache_group(sp->st_gid)) == NULL) {
 					(void)snprintf(ngroup, sizeof(ngroup),
 					    "%u", sp->st_gid);
 					group = ngroup;
@@ -556,9 +1094,10 @@ display(FTSENT *p, FTSENT *list)
 				} else
 					flen = 0;
 
-				if ((np = malloc(sizeof(NAMES) +
-				    ulen + glen + flen + 3)) == NULL)
-					err(EXIT_FAILURE, NULL);
+				if (names == NULL)
+					names = arena_create();
+				np = arena_malloc(names,
+				    sizeof(NAMES) + ulen + glen + flen + 3);
 
 				np->user = &np->data[0];
 				(void)strcpy(np->user, user);
@@ -622,10 +1161,11 @@ display(FTSENT *p, FTSENT *list)
 
 	printfcn(&d);
 	output = 1;
+	if (ttyout)
+		(void)out_flush();
 
-	if (f_longform)
-		for (cur = list; cur; cur = cur->fts_link)
-			free(cur->fts_pointer);
+	if (names != NULL)
+		arena_reset(names);
 }
 
 /*
@@ -39,9 +39,51 @@
 
 #define NO_PRINT	1
 
+#define ISDOT(a)	((a)[0] == '.' && \
+			    (!(a)[1] || ((a)[1] == '.' && !(a)[2])))
+
+#if defined(_POSIX_SOURCE) || defined(_POSIX_C_SOURCE) || \
+    defined(_XOPEN_SOURCE) || defined(__NetBSD__)
+#define ATIMENSEC(x)	((x)->st_atimensec)
+#define CTIMENSEC(x)	((x)->st_ctimensec)
+#define MTIMENSEC(x)	((x)->st_mtimensec)
+#else
+#define ATIMENSEC(x)	((x)->st_atimespec.tv_nsec)
+#define CTIMENSEC(x)	((x)->st_ctimespec.tv_nsec)
+#define MTIMENSEC(x)	((x)->st_mtimespec.tv_nsec)
+#endif
+
+#define	REC_JSON	1
+#define	REC_BINARY	2
+
+#define	TIMEFMT_MAX	32	/* room for the time column; see timefmt() */
+
+#define	BY_NAME 0
+#define	BY_SIZE 1
+#define	BY_TIME	2
+
+/*
+ * Stat fields a listing needs.  The file type, inode and device number
+ * are always needed to walk the tree.  When nothing but FLD_TYPE and
+ * FLD_EXEC is asked for, the type from the directory entry will do,
+ * except for the permissions of regular files under FLD_EXEC.
+ */
+#define FLD_MODE	0x0001
+#define FLD_NLINK	0x0002
+#define FLD_OWNER	0x0004
+#define FLD_SIZE	0x0008
+#define FLD_BLOCKS	0x0010
+#define FLD_ATIME	0x0020
+#define FLD_MTIME	0x0040
+#define FLD_CTIME	0x0080
+#define FLD_TYPE	0x0100		/* only the file type */
+#define FLD_EXEC	0x0200		/* and whether a file is executable */
+
 extern long blocksize;		/* block size units */
+extern int sortkey;		/* BY_NAME, BY_SIZE or BY_TIME */
 
 extern int f_accesstime;	/* use time of last access */
+extern int f_debug;		/* report cache statistics on exit */
 extern int f_flags;		/* show flags associated with a file */
 extern int f_grouponly;		/* long listing without owner */
 extern int f_humanize;		/* humanize size field */
@@ -49,6 +91,8 @@ extern int f_inode;		/* print inode */
 extern int f_longform;		/* long listing format */
 extern int f_octal;		/* print octal escapes for nongraphic characters */
 extern int f_octal_escape;	/* like f_octal but use C escapes if possible */
+extern int f_record;		/* one record per entry: REC_JSON, REC_BINARY */
+extern int f_reversesort;	/* reverse whatever sort is used */
 extern int f_sectime;		/* print the real time for all files */
 extern int f_size;		/* list size in short listing */
 extern int f_statustime;	/* use time of last mode change */
@@ -73,6 +117,36 @@ typedef struct {
 	int s_minor;
 } DISPLAY;
 
+typedef struct arena ARENA;
+typedef struct dirread DIRREAD;
+typedef struct snapshot SNAPSHOT;
+typedef struct walk WALK;
+
+/*
+ * The record -O binary writes for each entry, in host byte order, followed
+ * by lr_pathlen bytes of path and then padding up to lr_reclen, which is
+ * always a multiple of 8.
+ */
+struct lsrecord {
+	u_int32_t lr_reclen;
+	u_int32_t lr_pathlen;
+	u_int64_t lr_dev;
+	u_int64_t lr_ino;
+	u_int64_t lr_rdev;
+	u_int64_t lr_nlink;
+	u_int32_t lr_mode;
+	u_int32_t lr_uid;
+	u_int32_t lr_gid;
+	u_int32_t lr_atimensec;
+	u_int32_t lr_mtimensec;
+	u_int32_t lr_ctimensec;
+	int64_t lr_size;
+	int64_t lr_blocks;
+	int64_t lr_atime;
+	int64_t lr_mtime;
+	int64_t lr_ctime;
+};
+
 typedef struct {
 	char *user;
 	char *group;
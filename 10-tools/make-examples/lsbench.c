@@ -0,0 +1,572 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * A benchmark for ls, run by 'make bench'.
+ *
+ * Builds three trees, the way html/makelstest builds its test directory,
+ * but at scale:
+ *
+ *   flat	one directory with many files (a million by default) of
+ *		assorted sizes and times;
+ *   deep	a tree of directories many levels deep, and a single chain
+ *		of directories deeper still;
+ *   mixed	a hundred directories of files from empty to 64MB (sparse),
+ *		symbolic links (good, to directories and dangling),
+ *		subdirectories and fifos.
+ *
+ * The trees are kept for the next run.  Then, for each tree, it runs the
+ * given ls with each of -1, -l, -lR, -S, -t and -f, with its output going
+ * to /dev/null, and reports the wall time (the median of a few runs),
+ * the number of system calls made (where they can be counted, using
+ * ptrace(2) on Linux, in a separate run so as not to slow down the timed
+ * ones) and the peak resident set size.
+ *
+ * With -o, the results are also written to a file; with -b, they are
+ * compared to such a file from an earlier run, and lsbench fails if any
+ * wall time is more than the tolerance (-t, in percent) above it.
+ *
+ * Usage: lsbench [-b baseline] [-d dir] [-n entries] [-o results]
+ *                [-r runs] [-t percent] ls
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/ptrace.h>
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#define COUNT_SYSCALLS
+#endif
+
+#define DEFAULT_DIR	"/tmp/lsbench"
+#define DEFAULT_ENTRIES	1000000
+#define DEFAULT_RUNS	3
+#define DEFAULT_TOL	10
+#define NOISE		0.005	/* seconds; smaller slowdowns are ignored */
+
+#define MAXRUNS		32
+#define SPREAD		(2 * 365 * 24 * 60 * 60)	/* times go back two years */
+
+#define DEEP_FANOUT	3
+#define DEEP_DEPTH	9
+#define DEEP_CHAIN	256
+#define MIXED_DIRS	100
+
+static const char *trees[] = { "flat", "deep", "mixed" };
+static const char *flags[] = { "-1", "-l", "-lR", "-S", "-t", "-f" };
+
+#define NTREES	(sizeof(trees) / sizeof(trees[0]))
+#define NFLAGS	(sizeof(flags) / sizeof(flags[0]))
+
+struct result {
+	double	wall;		/* seconds, median of the runs */
+	long	syscalls;	/* -1 if they could not be counted */
+	long	maxrss;		/* kilobytes */
+};
+
+static u_int64_t	seed = 88172645463325252ULL;
+static time_t		now;
+
+static void	build(const char *, long);
+static void	build_deep(int, int);
+static void	build_flat(int, long);
+static void	build_mixed(int, long);
+static int	cmpdouble(const void *, const void *);
+static long	count_syscalls(const char *, const char *, const char *);
+static pid_t	launch(const char *, const char *, const char *, int);
+static void	makefile(int, const char *, off_t);
+static u_int64_t rnd(void);
+static void	run(const char *, const char *, const char *, int,
+		    struct result *);
+static int	compare(const char *, struct result *, int);
+static void	usage(void);
+
+int
+main(int argc, char **argv)
+{
+	struct result res[NTREES][NFLAGS];
+	const char *baseline, *dir, *out;
+	char path[PATH_MAX];
+	FILE *fp;
+	long entries;
+	int ch, failed, runs, tol;
+	size_t t, f;
+
+	baseline = out = NULL;
+	dir = DEFAULT_DIR;
+	entries = DEFAULT_ENTRIES;
+	runs = DEFAULT_RUNS;
+	tol = DEFAULT_TOL;
+	while ((ch = getopt(argc, argv, "b:d:n:o:r:t:")) != -1) {
+		switch (ch) {
+		case 'b':
+			baseline = optarg;
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'n':
+			if ((entries = strtol(optarg, NULL, 10)) <
+			    MIXED_DIRS * 10)
+				errx(EXIT_FAILURE, "too few entries: %s",
+				    optarg);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			if (runs < 1 || runs > MAXRUNS)
+				errx(EXIT_FAILURE, "runs must be 1 to %d",
+				    MAXRUNS);
+			break;
+		case 't':
+			if ((tol = atoi(optarg)) < 0)
+				errx(EXIT_FAILURE, "invalid tolerance: %s",
+				    optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		usage();
+	if (access(argv[0], X_OK) == -1)
+		err(EXIT_FAILURE, "%s", argv[0]);
+
+	now = time(NULL);
+	build(dir, entries);
+
+	(void)printf("%-6s %-4s %10s %10s %10s\n", "tree", "flag", "wall(s)",
+	    "syscalls", "maxrss(KB)");
+	for (t = 0; t < NTREES; t++) {
+		(void)snprintf(path, sizeof(path), "%s/%s", dir, trees[t]);
+		for (f = 0; f < NFLAGS; f++) {
+			run(argv[0], flags[f], path, runs, &res[t][f]);
+			(void)printf("%-6s %-4s %10.3f ", trees[t], flags[f],
+			    res[t][f].wall);
+			if (res[t][f].syscalls == -1)
+				(void)printf("%10s", "-");
+			else
+				(void)printf("%10ld", res[t][f].syscalls);
+			(void)printf(" %10ld\n", res[t][f].maxrss);
+			(void)fflush(stdout);
+		}
+	}
+
+	if (out != NULL) {
+		if ((fp = fopen(out, "w")) == NULL)
+			err(EXIT_FAILURE, "%s", out);
+		for (t = 0; t < NTREES; t++)
+			for (f = 0; f < NFLAGS; f++)
+				(void)fprintf(fp, "%s %s %.6f %ld %ld\n",
+				    trees[t], flags[f], res[t][f].wall,
+				    res[t][f].syscalls, res[t][f].maxrss);
+		if (fclose(fp) == EOF)
+			err(EXIT_FAILURE, "%s", out);
+	}
+
+	failed = 0;
+	if (baseline != NULL)
+		failed = compare(baseline, &res[0][0], tol);
+	return (failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static void
+usage(void)
+{
+
+	(void)fprintf(stderr, "usage: lsbench [-b baseline] [-d dir] "
+	    "[-n entries] [-o results]\n"
+	    "               [-r runs] [-t percent] ls\n");
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Compare the results to those in file, and report every wall time
+ * more than tol percent slower, unless the difference is too small to
+ * tell from noise.  Returns the number of them.
+ */
+static int
+compare(const char *file, struct result *res, int tol)
+{
+	FILE *fp;
+	char tree[16], flag[16];
+	double wall;
+	long syscalls, maxrss;
+	size_t t, f;
+	int failed;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", file);
+	failed = 0;
+	while (fscanf(fp, "%15s %15s %lf %ld %ld", tree, flag, &wall,
+	    &syscalls, &maxrss) == 5) {
+		for (t = 0; t < NTREES; t++)
+			if (strcmp(tree, trees[t]) == 0)
+				break;
+		for (f = 0; f < NFLAGS; f++)
+			if (strcmp(flag, flags[f]) == 0)
+				break;
+		if (t == NTREES || f == NFLAGS)
+			continue;
+		if (res[t * NFLAGS + f].wall > wall * (100 + tol) / 100 &&
+		    res[t * NFLAGS + f].wall > wall + NOISE) {
+			warnx("%s %s: %.3fs, was %.3fs", tree, flag,
+			    res[t * NFLAGS + f].wall, wall);
+			failed++;
+		}
+	}
+	(void)fclose(fp);
+	return (failed);
+}
+
+/*
+ * Run ls with flag on path runs times, plus once more to count its
+ * system calls.
+ */
+static void
+run(const char *ls, const char *flag, const char *path, int runs,
+    struct result *res)
+{
+	struct timespec start, end;
+	struct rusage ru;
+	double walls[MAXRUNS];
+	pid_t pid;
+	int i, status;
+
+	res->maxrss = 0;
+	for (i = 0; i < runs; i++) {
+		(void)clock_gettime(CLOCK_MONOTONIC, &start);
+		pid = launch(ls, flag, path, 0);
+		if (wait4(pid, &status, 0, &ru) == -1)
+			err(EXIT_FAILURE, "wait4");
+		(void)clock_gettime(CLOCK_MONOTONIC, &end);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) > 1)
+			errx(EXIT_FAILURE, "%s %s %s failed", ls, flag, path);
+		walls[i] = (end.tv_sec - start.tv_sec) +
+		    (end.tv_nsec - start.tv_nsec) / 1e9;
+		if (ru.ru_maxrss > res->maxrss)
+			res->maxrss = ru.ru_maxrss;
+	}
+	qsort(walls, runs, sizeof(double), cmpdouble);
+	res->wall = walls[runs / 2];
+	res->syscalls = count_syscalls(ls, flag, path);
+}
+
+/*
+ * Start ls with flag on path, its output going to /dev/null.  If trace
+ * is set, the child stops itself to be traced before it runs ls.
+ */
+static pid_t
+launch(const char *ls, const char *flag, const char *path, int trace)
+{
+	pid_t pid;
+	int fd;
+
+	if ((pid = fork()) == -1)
+		err(EXIT_FAILURE, "fork");
+	if (pid > 0)
+		return (pid);
+
+	if ((fd = open("/dev/null", O_WRONLY)) == -1)
+		err(EXIT_FAILURE, "/dev/null");
+	(void)dup2(fd, STDOUT_FILENO);
+	(void)dup2(fd, STDERR_FILENO);
+	(void)close(fd);
+#ifdef COUNT_SYSCALLS
+	if (trace) {
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1)
+			_exit(127);
+		(void)raise(SIGSTOP);
+	}
+#else
+	(void)trace;
+#endif
+	(void)execl(ls, ls, flag, path, (char *)NULL);
+	_exit(127);
+}
+
+/*
+ * Count the system calls of one run of ls with flag on path, in all of
+ * its threads, or return -1 if that cannot be done here.
+ */
+static long
+count_syscalls(const char *ls, const char *flag, const char *path)
+{
+#ifdef COUNT_SYSCALLS
+	pid_t pid, tid;
+	long n, stops;
+	int sig, status;
+
+	pid = launch(ls, flag, path, 1);
+	if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status))
+		return (-1);
+	if (ptrace(PTRACE_SETOPTIONS, pid, NULL,
+	    (void *)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE |
+	    PTRACE_O_EXITKILL)) == -1) {
+		(void)kill(pid, SIGKILL);
+		(void)waitpid(pid, &status, 0);
+		return (-1);
+	}
+	(void)ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+	/*
+	 * Every system call stops each thread twice, on the way in and on
+	 * the way out, except for the very last one, which never returns.
+	 */
+	stops = n = 0;
+	for (;;) {
+		if ((tid = waitpid(-1, &status, __WALL)) == -1)
+			break;
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			n++;
+			if (tid == pid)
+				break;
+			continue;
+		}
+		sig = WSTOPSIG(status);
+		if (sig == (SIGTRAP | 0x80)) {
+			stops++;
+			sig = 0;
+		} else if (sig == SIGTRAP || sig == SIGSTOP)
+			sig = 0;
+		(void)ptrace(PTRACE_SYSCALL, tid, NULL, (void *)(long)sig);
+	}
+	return ((stops + n) / 2);
+#else
+	(void)ls;
+	(void)flag;
+	(void)path;
+	return (-1);
+#endif
+}
+
+static int
+cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * A small, fast and above all repeatable random number generator, so
+ * that every run builds the same trees.
+ */
+static u_int64_t
+rnd(void)
+{
+
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return (seed);
+}
+
+/*
+ * Build the trees in dir, unless they are already there for the same
+ * number of entries.
+ */
+static void
+build(const char *dir, long entries)
+{
+	char stamp[32];
+	int dfd, fd;
+
+	(void)snprintf(stamp, sizeof(stamp), ".lsbench-%ld", entries);
+	if (mkdir(dir, 0755) == -1) {
+		if (errno != EEXIST)
+			err(EXIT_FAILURE, "%s", dir);
+		if ((dfd = open(dir, O_RDONLY | O_DIRECTORY)) == -1)
+			err(EXIT_FAILURE, "%s", dir);
+		if (faccessat(dfd, stamp, F_OK, 0) == 0) {
+			(void)close(dfd);
+			return;
+		}
+		errx(EXIT_FAILURE, "%s exists, but was not built by lsbench "
+		    "-n %ld; remove it first", dir, entries);
+	}
+	if ((dfd = open(dir, O_RDONLY | O_DIRECTORY)) == -1)
+		err(EXIT_FAILURE, "%s", dir);
+
+	(void)fprintf(stderr, "lsbench: building trees in %s...\n", dir);
+	build_flat(dfd, entries);
+	build_deep(dfd, 0);
+	build_mixed(dfd, entries / 10);
+
+	if ((fd = openat(dfd, stamp, O_WRONLY | O_CREAT, 0644)) == -1)
+		err(EXIT_FAILURE, "%s/%s", dir, stamp);
+	(void)close(fd);
+	(void)close(dfd);
+}
+
+/*
+ * Create the file name in dfd with the given size, without writing
+ * anything, and a random time in the last two years.
+ */
+static void
+makefile(int dfd, const char *name, off_t size)
+{
+	struct timespec ts[2];
+	int fd;
+
+	if ((fd = openat(dfd, name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		err(EXIT_FAILURE, "%s", name);
+	if (size > 0 && ftruncate(fd, size) == -1)
+		err(EXIT_FAILURE, "%s", name);
+	ts[0].tv_sec = ts[1].tv_sec = now - rnd() % SPREAD;
+	ts[0].tv_nsec = ts[1].tv_nsec = rnd() % 1000000000;
+	if (futimens(fd, ts) == -1)
+		err(EXIT_FAILURE, "%s", name);
+	(void)close(fd);
+}
+
+static void
+build_flat(int dfd, long entries)
+{
+	char name[32];
+	long i;
+	int fd;
+
+	if (mkdirat(dfd, "flat", 0755) == -1 ||
+	    (fd = openat(dfd, "flat", O_RDONLY | O_DIRECTORY)) == -1)
+		err(EXIT_FAILURE, "flat");
+	for (i = 0; i < entries; i++) {
+		(void)snprintf(name, sizeof(name), "f%07ld", i);
+		makefile(fd, name, rnd() % 65536);
+	}
+	(void)close(fd);
+}
+
+/*
+ * A tree DEEP_FANOUT directories wide and DEEP_DEPTH deep, with a few
+ * files in each directory, and a chain of DEEP_CHAIN directories.
+ */
+static void
+build_deep(int dfd, int level)
+{
+	char name[16];
+	int fd, i;
+
+	if (level == 0) {
+		if (mkdirat(dfd, "deep", 0755) == -1 ||
+		    (fd = openat(dfd, "deep", O_RDONLY | O_DIRECTORY)) == -1)
+			err(EXIT_FAILURE, "deep");
+		build_deep(fd, 1);
+		for (i = 0; i < DEEP_CHAIN; i++) {
+			if (mkdirat(fd, "chain", 0755) == -1 ||
+			    (dfd = openat(fd, "chain",
+			    O_RDONLY | O_DIRECTORY)) == -1)
+				err(EXIT_FAILURE, "deep/chain");
+			makefile(dfd, "file", 0);
+			(void)close(fd);
+			fd = dfd;
+		}
+		(void)close(fd);
+		return;
+	}
+
+	for (i = 0; i < 4; i++) {
+		(void)snprintf(name, sizeof(name), "file%d", i);
+		makefile(dfd, name, rnd() % 16384);
+	}
+	if (level == DEEP_DEPTH)
+		return;
+	for (i = 0; i < DEEP_FANOUT; i++) {
+		(void)snprintf(name, sizeof(name), "dir%d", i);
+		if (mkdirat(dfd, name, 0755) == -1 ||
+		    (fd = openat(dfd, name, O_RDONLY | O_DIRECTORY)) == -1)
+			err(EXIT_FAILURE, "%s", name);
+		build_deep(fd, level + 1);
+		(void)close(fd);
+	}
+}
+
+/*
+ * MIXED_DIRS directories with entries between them: mostly files, of
+ * sizes spread over powers of two up to 64MB, and symbolic links,
+ * subdirectories and fifos.
+ */
+static void
+build_mixed(int dfd, long entries)
+{
+	char name[32], target[32];
+	long i, per;
+	int d, fd, mfd, kind;
+
+	if (mkdirat(dfd, "mixed", 0755) == -1 ||
+	    (mfd = openat(dfd, "mixed", O_RDONLY | O_DIRECTORY)) == -1)
+		err(EXIT_FAILURE, "mixed");
+	per = entries / MIXED_DIRS;
+	for (d = 0; d < MIXED_DIRS; d++) {
+		(void)snprintf(name, sizeof(name), "d%02d", d);
+		if (mkdirat(mfd, name, 0755) == -1 ||
+		    (fd = openat(mfd, name, O_RDONLY | O_DIRECTORY)) == -1)
+			err(EXIT_FAILURE, "mixed/%s", name);
+		for (i = 0; i < per; i++) {
+			kind = rnd() % 100;
+			(void)snprintf(name, sizeof(name), "e%06ld", i);
+			if (kind < 70 || i == 0)
+				makefile(fd, name, ((off_t)1 << rnd() % 27) +
+				    rnd() % 1024 - 1);
+			else if (kind < 85) {
+				switch (rnd() % 3) {
+				case 0:
+					(void)snprintf(target, sizeof(target),
+					    "e%06ld", (long)(rnd() % i));
+					break;
+				case 1:
+					(void)snprintf(target, sizeof(target),
+					    "../d%02d", (int)(rnd() % MIXED_DIRS));
+					break;
+				default:
+					(void)snprintf(target, sizeof(target),
+					    "nowhere%ld", i);
+				}
+				if (symlinkat(target, fd, name) == -1)
+					err(EXIT_FAILURE, "%s", name);
+			} else if (kind < 95) {
+				if (mkdirat(fd, name, 0755) == -1)
+					err(EXIT_FAILURE, "%s", name);
+			} else if (mkfifoat(fd, name, 0644) == -1)
+				err(EXIT_FAILURE, "%s", name);
+		}
+		(void)close(fd);
+	}
+	(void)close(mfd);
+}
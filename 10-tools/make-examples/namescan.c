@@ -0,0 +1,160 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * Finding out whether a file name needs escaping before it is printed.
+ *
+ * Almost all names consist of nothing but printable ASCII, which both
+ * strvis(3) and the '?' substitution of printescaped() leave alone, so
+ * safe_print() and printescaped() first ask namescan() how long the
+ * clean part at the start of a name is, copy that verbatim and only
+ * look at the rest byte by byte.
+ *
+ * "Clean" is deliberately narrow: 0x20 to 0x7e and, for strvis(3), not
+ * a backslash.  Anything else, including every byte with the high bit
+ * set, ends the span, so whether it is printable in the current locale
+ * is still decided by the slow path, exactly as before.
+ *
+ * On x86 the scan looks at 16 or, if the CPU has AVX2, 32 bytes at a
+ * time; which one is picked on the first call.  Elsewhere, and for the
+ * tail of a name, it looks at a word at a time.
+ */
+
+#include <sys/types.h>
+
+#include <fts.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ls.h"
+#include "extern.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    defined(__SSE2__)
+#define NAMESCAN_X86
+#include <immintrin.h>
+#endif
+
+#define ONES	((uint64_t)0x0101010101010101ULL)
+#define HIGHS	((uint64_t)0x8080808080808080ULL)
+
+/* Is any byte of x below, or above, n?  Only for n < 128. */
+#define HASLESS(x, n)	(((x) - ONES * (n)) & ~(x) & HIGHS)
+#define HASMORE(x, n)	((((x) + ONES * (127 - (n))) | (x)) & HIGHS)
+
+#define CLEAN(c, noslash)	((c) >= 0x20 && (c) < 0x7f && \
+				    !((noslash) && (c) == '\\'))
+
+static size_t scan_word(const char *, size_t, int);
+#ifdef NAMESCAN_X86
+static size_t scan_sse2(const char *, size_t, int);
+static size_t scan_avx2(const char *, size_t, int)
+    __attribute__((target("avx2")));
+#endif
+
+static size_t (*scanfn)(const char *, size_t, int);
+
+/*
+ * Return the length of the clean span at the start of the len bytes at
+ * s; len if the whole name can be printed as it is.  If noslash is set,
+ * a backslash is not clean, as strvis(3) escapes it.
+ */
+size_t
+namescan(const char *s, size_t len, int noslash)
+{
+
+	if (scanfn == NULL) {
+#ifdef NAMESCAN_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			scanfn = scan_avx2;
+		else
+			scanfn = scan_sse2;
+#else
+		scanfn = scan_word;
+#endif
+	}
+	return (scanfn(s, len, noslash));
+}
+
+static size_t
+scan_word(const char *s, size_t len, int noslash)
+{
+	const unsigned char *p;
+	uint64_t w;
+	size_t i;
+
+	p = (const unsigned char *)s;
+	for (i = 0; len - i >= sizeof(w); i += sizeof(w)) {
+		(void)memcpy(&w, p + i, sizeof(w));
+		if (HASLESS(w, 0x20) || HASMORE(w, 0x7e))
+			break;
+		if (noslash && HASLESS(w ^ (ONES * '\\'), 1))
+			break;
+	}
+	while (i < len && CLEAN(p[i], noslash))
+		i++;
+	return (i);
+}
+
+#ifdef NAMESCAN_X86
+/*
+ * The comparisons are signed, so bytes with the high bit set count as
+ * being below 0x20.
+ */
+static size_t
+scan_sse2(const char *s, size_t len, int noslash)
+{
+	__m128i lo, hi, bs, v, bad;
+	size_t i;
+	int mask;
+
+	lo = _mm_set1_epi8(0x20);
+	hi = _mm_set1_epi8(0x7e);
+	bs = _mm_set1_epi8(noslash ? '\\' : 0);
+	for (i = 0; len - i >= sizeof(v); i += sizeof(v)) {
+		v = _mm_loadu_si128((const __m128i *)(s + i));
+		bad = _mm_or_si128(_mm_cmplt_epi8(v, lo),
+		    _mm_cmpgt_epi8(v, hi));
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, bs));
+		if ((mask = _mm_movemask_epi8(bad)) != 0)
+			return (i + __builtin_ctz(mask));
+	}
+	return (i + scan_word(s + i, len - i, noslash));
+}
+
+static size_t
+scan_avx2(const char *s, size_t len, int noslash)
+{
+	__m256i lo, hi, bs, v, bad;
+	size_t i;
+	unsigned int mask;
+
+	if (len < sizeof(v))
+		return (scan_sse2(s, len, noslash));
+	lo = _mm256_set1_epi8(0x20);
+	hi = _mm256_set1_epi8(0x7e);
+	bs = _mm256_set1_epi8(noslash ? '\\' : 0);
+	for (i = 0; len - i >= sizeof(v); i += sizeof(v)) {
+		v = _mm256_loadu_si256((const __m256i *)(s + i));
+		bad = _mm256_or_si256(_mm256_cmpgt_epi8(lo, v),
+		    _mm256_cmpgt_epi8(v, hi));
+		bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(v, bs));
+		if ((mask = (unsigned int)_mm256_movemask_epi8(bad)) != 0)
+			return (i + __builtin_ctz(mask));
+	}
+	return (i + scan_sse2(s + i, len - i, noslash));
+}
+#endif
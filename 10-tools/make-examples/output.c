@@ -0,0 +1,225 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * The output writer for the print functions.
+ *
+ * Everything ls writes to stdout is formatted straight into one large
+ * buffer, without going through printf(3) and its format parsing for
+ * every field of every entry.  The buffer is written out when it fills
+ * up, with writev(2) when a string too large to copy comes along, and
+ * at exit.  On a terminal, it is also written out after each directory,
+ * so that output and error messages come out in the order expected.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fts.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ls.h"
+#include "extern.h"
+
+#define OUT_BUFSIZ	(64 * 1024)
+
+static char	out_buf[OUT_BUFSIZ];
+static size_t	out_len;
+static int	out_error;	/* errno of a failed write, if any */
+
+static void	out_writev(struct iovec *, int);
+
+/*
+ * Write out whatever is buffered.  Returns -1 if this or any earlier
+ * write failed.
+ */
+int
+out_flush(void)
+{
+	struct iovec iov;
+
+	if (out_len > 0) {
+		iov.iov_base = out_buf;
+		iov.iov_len = out_len;
+		out_writev(&iov, 1);
+	}
+	if (out_error) {
+		errno = out_error;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Return a pointer to room for len bytes in the buffer, or NULL if len
+ * is more than the buffer can ever hold.  Only the bytes that are then
+ * handed to out_commit() are written out.
+ */
+char *
+out_reserve(size_t len)
+{
+
+	if (len > OUT_BUFSIZ)
+		return (NULL);
+	if (OUT_BUFSIZ - out_len < len)
+		(void)out_flush();
+	return (out_buf + out_len);
+}
+
+void
+out_commit(size_t len)
+{
+
+	out_len += len;
+}
+
+void
+out_char(int c)
+{
+
+	if (out_len == OUT_BUFSIZ)
+		(void)out_flush();
+	out_buf[out_len++] = c;
+}
+
+void
+out_write(const char *s, size_t len)
+{
+	struct iovec iov[2];
+
+	if (OUT_BUFSIZ - out_len >= len) {
+		memcpy(out_buf + out_len, s, len);
+		out_len += len;
+		return;
+	}
+
+	/* Don't copy what does not fit anyway; send both in one go. */
+	iov[0].iov_base = out_buf;
+	iov[0].iov_len = out_len;
+	iov[1].iov_base = (void *)s;
+	iov[1].iov_len = len;
+	out_writev(iov, 2);
+}
+
+/*
+ * Write s, and return its length, like printf("%s").
+ */
+int
+out_str(const char *s)
+{
+	size_t len;
+
+	len = strlen(s);
+	out_write(s, len);
+	return ((int)len);
+}
+
+void
+out_spaces(int n)
+{
+	char *p;
+
+	if (n <= 0)
+		return;
+	if ((p = out_reserve(n)) == NULL) {
+		while (n-- > 0)
+			out_char(' ');
+		return;
+	}
+	memset(p, ' ', n);
+	out_commit(n);
+}
+
+/*
+ * Write s padded with spaces to width: on the left, like printf("%*s"),
+ * or on the right if left is set, like printf("%-*s").  Returns the
+ * number of characters written.
+ */
+int
+out_pad(const char *s, int width, int left)
+{
+	int len;
+
+	len = (int)strlen(s);
+	if (!left)
+		out_spaces(width - len);
+	out_write(s, len);
+	if (left)
+		out_spaces(width - len);
+	return (len > width ? len : width);
+}
+
+/*
+ * Write v right-aligned in width columns, like printf("%*llu").
+ * Returns the number of characters written.
+ */
+int
+out_uint(u_int64_t v, int width)
+{
+	char buf[20], *p;
+	int len;
+
+	p = buf + sizeof(buf);
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+	len = buf + sizeof(buf) - p;
+	out_spaces(width - len);
+	out_write(p, len);
+	return (len > width ? len : width);
+}
+
+/*
+ * Write v, like printf("%lld").
+ */
+void
+out_int(int64_t v)
+{
+
+	if (v < 0) {
+		out_char('-');
+		(void)out_uint(-(u_int64_t)v, 0);
+	} else
+		(void)out_uint(v, 0);
+}
+
+static void
+out_writev(struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+
+	out_len = 0;
+	if (out_error)
+		return;
+	while (iovcnt > 0) {
+		if ((n = writev(STDOUT_FILENO, iov, iovcnt)) == -1) {
+			if (errno == EINTR)
+				continue;
+			out_error = errno;
+			return;
+		}
+		for (; iovcnt > 0 && (size_t)n >= iov->iov_len; iov++, iovcnt--)
+			n -= iov->iov_len;
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
@@ -62,15 +62,26 @@ __RCSID("$NetBSD: print.c,v 1.38 2003/12/26 06:19:19 grant Exp $");
 
 extern int termwidth;
 
+static int	gridfits(const int *, int, int, int, int *);
 static int	printaname(FTSENT *, int, int);
+static void	printgrid(DISPLAY *, int);
 static void	printlink(FTSENT *);
+static void	printlongline(DISPLAY *, FTSENT *);
+static void	printjson(FTSENT *);
+static void	printbinary(FTSENT *);
+static void	printjsonstr(const char *, size_t);
+static size_t	recordpath(FTSENT *, char *, size_t);
 static void	printtime(time_t);
 static int	printtype(u_int);
+static int	typechar(u_int);
 
 static time_t	now;
 
 #define	IS_NOPRINT(p)	((p)->fts_number == NO_PRINT)
 
+#define	GRID_GAP	2	/* spaces between columns */
+#define	GRID_MINW	3	/* narrowest column, with its gap */
+
 #define HN_DECIMAL      0x01
 #define HN_NOSPACE      0x02
 #define HN_B            0x04
@@ -233,17 +244,15 @@ printscol(DISPLAY *dp)
 		if (IS_NOPRINT(p))
 			continue;
 		(void)printaname(p, dp->s_inode, dp->s_block);
-		(void)putchar('\n');
+		out_char('\n');
 	}
 }
 
 void
 printlong(DISPLAY *dp)
 {
-	struct stat *sp;
 	FTSENT *p;
-	NAMES *np;
-	char buf[20], szbuf[5];
+	char szbuf[5];
 
 	now = time(NULL);
 
@@ -253,119 +262,189 @@ printlong(DISPLAY *dp)
 			    "", HN_AUTOSCALE,
 			    (HN_DECIMAL | HN_B | HN_NOSPACE))) == -1)
 				err(1, "humanize_number");
-			(void)printf("total %s\n", szbuf);
+			(void)out_str("total ");
+			(void)out_str(szbuf);
 		} else {
-			(void)printf("total %llu\n",
-			    (long long)(howmany(dp->btotal, blocksize)));
+			(void)out_str("total ");
+			(void)out_uint(howmany(dp->btotal, blocksize), 0);
 		}
+		out_char('\n');
 	}
 
 	for (p = dp->list; p; p = p->fts_link) {
 		if (IS_NOPRINT(p))
 			continue;
-		sp = p->fts_statp;
-		if (f_inode)
-			(void)printf("%*lu ", dp->s_inode,
-			    (unsigned long)sp->st_ino);
-		if (f_size && !f_humanize) {
-			(void)printf("%*llu ", dp->s_block,
-			    (long long)howmany(sp->st_blocks, blocksize));
+		printlongline(dp, p);
+	}
+}
+
+static void
+printlongline(DISPLAY *dp, FTSENT *p)
+{
+	struct stat *sp;
+	NAMES *np;
+	char buf[20], szbuf[5];
+
+	sp = p->fts_statp;
+	if (f_inode) {
+		(void)out_uint(sp->st_ino, dp->s_inode);
+		out_char(' ');
+	}
+	if (f_size && !f_humanize) {
+		(void)out_uint(howmany(sp->st_blocks, blocksize),
+		    dp->s_block);
+		out_char(' ');
+	}
+	(void)strmode(sp->st_mode, buf);
+	np = p->fts_pointer;
+	(void)out_str(buf);
+	out_char(' ');
+	(void)out_uint(sp->st_nlink, dp->s_nlink);
+	out_char(' ');
+	if (!f_grouponly) {
+		(void)out_pad(np->user, dp->s_user, 1);
+		out_write("  ", 2);
+	}
+	(void)out_pad(np->group, dp->s_group, 1);
+	out_write("  ", 2);
+	if (f_flags) {
+		(void)out_pad(np->flags, dp->s_flags, 1);
+		out_char(' ');
+	}
+	if (S_ISCHR(sp->st_mode) || S_ISBLK(sp->st_mode)) {
+		(void)out_uint(major(sp->st_rdev), dp->s_major);
+		out_write(", ", 2);
+		(void)out_uint(minor(sp->st_rdev), dp->s_minor);
+		out_char(' ');
+	} else
+		if (f_humanize) {
+			if ((humanize_number(szbuf, sizeof(szbuf),
+			    sp->st_size, "", HN_AUTOSCALE,
+			    (HN_DECIMAL | HN_B | HN_NOSPACE))) == -1)
+				err(1, "humanize_number");
+			(void)out_pad(szbuf, dp->s_size, 0);
+			out_char(' ');
+		} else {
+			(void)out_uint(sp->st_size, dp->s_size);
+			out_char(' ');
 		}
-		(void)strmode(sp->st_mode, buf);
-		np = p->fts_pointer;
-		(void)printf("%s %*lu ", buf, dp->s_nlink,
-		    (unsigned long)sp->st_nlink);
-		if (!f_grouponly)
-			(void)printf("%-*s  ", dp->s_user, np->user);
-		(void)printf("%-*s  ", dp->s_group, np->group);
-		if (f_flags)
-			(void)printf("%-*s ", dp->s_flags, np->flags);
-		if (S_ISCHR(sp->st_mode) || S_ISBLK(sp->st_mode))
-			(void)printf("%*u, %*u ",
-			    dp->s_major, major(sp->st_rdev), dp->s_minor,
-			    minor(sp->st_rdev));
-		else
-			if (f_humanize) {
-				if ((humanize_number(szbuf, sizeof(szbuf),
-				    sp->st_size, "", HN_AUTOSCALE,
-				    (HN_DECIMAL | HN_B | HN_NOSPACE))) == -1)
-					err(1, "humanize_number");
-				(void)printf("%*s ", dp->s_size, szbuf);
-			} else {
-				(void)printf("%*llu ", dp->s_size,
-				    (long long)sp->st_size);
-			}
-		if (f_accesstime)
-			printtime(sp->st_atime);
-		else if (f_statustime)
-			printtime(sp->st_ctime);
-		else
-			printtime(sp->st_mtime);
-		if (f_octal || f_octal_escape)
-			(void)safe_print(p->fts_name);
-		else if (f_nonprint)
-			(void)printescaped(p->fts_name);
-		else
-			(void)printf("%s", p->fts_name);
+	if (f_accesstime)
+		printtime(sp->st_atime);
+	else if (f_statustime)
+		printtime(sp->st_ctime);
+	else
+		printtime(sp->st_mtime);
+	if (f_octal || f_octal_escape)
+		(void)safe_print(p->fts_name);
+	else if (f_nonprint)
+		(void)printescaped(p->fts_name);
+	else
+		out_write(p->fts_name, p->fts_namelen);
+
+	if (f_type || (f_typedir && S_ISDIR(sp->st_mode)))
+		(void)printtype(sp->st_mode);
+	if (S_ISLNK(sp->st_mode))
+		printlink(p);
+	out_char('\n');
+}
+
+/*
+ * Print a single entry on a line of its own, in the long format for -l,
+ * for listings that are printed as they are read.  There is no total.
+ */
+void
+printentry(DISPLAY *dp, FTSENT *p)
+{
 
-		if (f_type || (f_typedir && S_ISDIR(sp->st_mode)))
-			(void)printtype(sp->st_mode);
-		if (S_ISLNK(sp->st_mode))
-			printlink(p);
-		(void)putchar('\n');
+	if (now == 0)
+		now = time(NULL);
+	if (f_record == REC_JSON)
+		printjson(p);
+	else if (f_record == REC_BINARY)
+		printbinary(p);
+	else if (f_longform)
+		printlongline(dp, p);
+	else {
+		(void)printaname(p, dp->s_inode, dp->s_block);
+		out_char('\n');
 	}
 }
 
 void
 printcol(DISPLAY *dp)
+{
+
+	printgrid(dp, 0);
+}
+
+void
+printacol(DISPLAY *dp)
+{
+
+	printgrid(dp, 1);
+}
+
+/*
+ * Lay the entries out in as many columns as fit into termwidth, each as
+ * wide as its widest entry plus GRID_GAP spaces, the way GNU ls does:
+ * down the columns or, for -x, across them.  The width of each entry is
+ * measured only once, and a layout is abandoned as soon as a line grows
+ * too long, so this takes time linear in the number of entries for any
+ * given terminal width.
+ */
+static void
+printgrid(DISPLAY *dp, int across)
 {
 	static FTSENT **array;
+	static int *widths, *colw;
 	static int lastentries = -1;
 	FTSENT *p;
-	int base, chcnt, col, colwidth, num;
-	int numcols, numrows, row;
+	int col, extra, i, maxcols, num, numcols, numrows, row;
+	int sizefield;
 	char szbuf[5];
 
-	colwidth = dp->maxlen;
+	sizefield = f_humanize ? dp->s_size : dp->s_block;
+	extra = 0;
 	if (f_inode)
-		colwidth += dp->s_inode + 1;
-	if (f_size) {
-		if (f_humanize)
-			colwidth += dp->s_size + 1;
-		else
-			colwidth += dp->s_block + 1;
-	}
-	if (f_type || f_typedir)
-		colwidth += 1;
-
-	colwidth += 1;
-
-	if (termwidth < 2 * colwidth) {
-		printscol(dp);
-		return;
-	}
+		extra += dp->s_inode + 1;
+	if (f_size)
+		extra += sizefield + 1;
 
 	/*
 	 * Have to do random access in the linked list -- build a table
-	 * of pointers.
+	 * of pointers, and one of the widths.
 	 */
 	if (dp->entries > lastentries) {
 		lastentries = dp->entries;
-		if ((array =
-		    realloc(array, dp->entries * sizeof(FTSENT *))) == NULL) {
-			warn(NULL);
-			printscol(dp);
-		}
+		if ((array = realloc(array,
+		    dp->entries * sizeof(FTSENT *))) == NULL ||
+		    (widths = realloc(widths,
+		    dp->entries * sizeof(int))) == NULL ||
+		    (colw = realloc(colw, dp->entries * sizeof(int))) == NULL)
+			err(EXIT_FAILURE, NULL);
+	}
+	for (p = dp->list, num = 0; p; p = p->fts_link) {
+		if (IS_NOPRINT(p))
+			continue;
+		array[num] = p;
+		widths[num] = extra + namewidth(p->fts_name, p->fts_namelen);
+		if (f_type ? typechar(p->fts_statp->st_mode) != '\0' :
+		    f_typedir && S_ISDIR(p->fts_statp->st_mode))
+			widths[num]++;
+		num++;
 	}
-	for (p = dp->list, num = 0; p; p = p->fts_link)
-		if (p->fts_number != NO_PRINT)
-			array[num++] = p;
 
-	numcols = termwidth / colwidth;
-	colwidth = termwidth / numcols;		/* spread out if possible */
-	numrows = num / numcols;
-	if (num % numcols)
-		++numrows;
+	maxcols = (termwidth + GRID_MINW - 1) / GRID_MINW;
+	if (maxcols > num)
+		maxcols = num;
+	for (numcols = maxcols; numcols > 1; numcols--)
+		if (gridfits(widths, num, numcols, across, colw))
+			break;
+	if (numcols <= 1) {
+		printscol(dp);
+		return;
+	}
+	numrows = (num + numcols - 1) / numcols;
 
 	if (dp->list->fts_level != FTS_ROOTLEVEL && (f_longform || f_size)) {
 		if (f_humanize) {
@@ -373,82 +452,61 @@ printcol(DISPLAY *dp)
 			    "", HN_AUTOSCALE,
 			    (HN_DECIMAL | HN_B | HN_NOSPACE))) == -1)
 				err(1, "humanize_number");
-			(void)printf("total %s\n", szbuf);
+			(void)out_str("total ");
+			(void)out_str(szbuf);
 		} else {
-			(void)printf("total %llu\n",
-			    (long long)(howmany(dp->btotal, blocksize)));
+			(void)out_str("total ");
+			(void)out_uint(howmany(dp->btotal, blocksize), 0);
 		}
+		out_char('\n');
+	}
+	if (across) {
+		for (i = 0; i < num; i++) {
+			if ((col = i % numcols) == 0 && i > 0)
+				out_char('\n');
+			else if (col > 0)
+				out_spaces(colw[col - 1] - widths[i - 1]);
+			(void)printaname(array[i], dp->s_inode, sizefield);
+		}
+		out_char('\n');
+		return;
 	}
 	for (row = 0; row < numrows; ++row) {
-		for (base = row, chcnt = col = 0; col < numcols; ++col) {
-			chcnt = printaname(array[base], dp->s_inode,
-			    f_humanize ? dp->s_size : dp->s_block);
-			if ((base += numrows) >= num)
+		for (i = row, col = 0; ; col++) {
+			(void)printaname(array[i], dp->s_inode, sizefield);
+			if (i + numrows >= num)
 				break;
-			while (chcnt++ < colwidth)
-				(void)putchar(' ');
+			out_spaces(colw[col] - widths[i]);
+			i += numrows;
 		}
-		(void)putchar('\n');
+		out_char('\n');
 	}
 }
 
-void
-printacol(DISPLAY *dp)
+/*
+ * Work out the widths of numcols columns for the num entries of width
+ * widths into colw, and return whether they fit into termwidth.
+ */
+static int
+gridfits(const int *widths, int num, int numcols, int across, int *colw)
 {
-	FTSENT *p;
-	int chcnt, col, colwidth;
-	int numcols;
-	char szbuf[5];
-
-	colwidth = dp->maxlen;
-	if (f_inode)
-		colwidth += dp->s_inode + 1;
-	if (f_size) {
-		if (f_humanize)
-			colwidth += dp->s_size + 1;
-		else
-			colwidth += dp->s_block + 1;
-	}
-	if (f_type || f_typedir)
-		colwidth += 1;
-
-	colwidth += 1;
-
-	if (termwidth < 2 * colwidth) {
-		printscol(dp);
-		return;
-	}
-
-	numcols = termwidth / colwidth;
-	colwidth = termwidth / numcols;		/* spread out if possible */
-
-	if (dp->list->fts_level != FTS_ROOTLEVEL && (f_longform || f_size)) {
-		if (f_humanize) {
-			if ((humanize_number(szbuf, sizeof(szbuf), dp->stotal,
-			    "", HN_AUTOSCALE,
-			    (HN_DECIMAL | HN_B | HN_NOSPACE))) == -1)
-				err(1, "humanize_number");
-			(void)printf("total %s\n", szbuf);
-		} else {
-			(void)printf("total %llu\n",
-			    (long long)(howmany(dp->btotal, blocksize)));
+	int col, i, len, numrows, w;
+
+	numrows = (num + numcols - 1) / numcols;
+	for (col = 0; col < numcols; col++)
+		colw[col] = GRID_MINW;
+	len = numcols * GRID_MINW;
+	for (i = 0; i < num; i++) {
+		col = across ? i % numcols : i / numrows;
+		w = widths[i] + (col == numcols - 1 ? 0 : GRID_GAP);
+		if (w > colw[col]) {
+			len += w - colw[col];
+			colw[col] = w;
+			if (len >= termwidth)
+				return (0);
 		}
 	}
-	chcnt = col = 0;
-	for (p = dp->list; p; p = p->fts_link) {
-		if (IS_NOPRINT(p))
-			continue;
-		if (col >= numcols) {
-			chcnt = col = 0;
-			(void)putchar('\n');
-		}
-		chcnt = printaname(p, dp->s_inode,
-		    f_humanize ? dp->s_size : dp->s_block);
-		while (chcnt++ < colwidth)
-			(void)putchar(' ');
-		col++;
-	}
-	(void)putchar('\n');
+	return (1);
 }
 
 void
@@ -474,16 +532,158 @@ printstream(DISPLAY *dp)
 		if (IS_NOPRINT(p))
 			continue;
 		if (col > 0) {
-			(void)putchar(','), col++;
+			out_char(','), col++;
 			if (col + 1 + extwidth + p->fts_namelen >= termwidth)
-				(void)putchar('\n'), col = 0;
+				out_char('\n'), col = 0;
 			else
-				(void)putchar(' '), col++;
+				out_char(' '), col++;
 		}
 		col += printaname(p, dp->s_inode,
 		    f_humanize ? dp->s_size : dp->s_block);
 	}
-	(void)putchar('\n');
+	out_char('\n');
+}
+
+/*
+ * Print one record per entry, for programs rather than people: -O json
+ * writes a line of JSON, -O binary a struct lsrecord.  Either carries
+ * the raw stat information and the path as it is, in the order the
+ * other formats would have listed the entries.
+ */
+void
+printrecords(DISPLAY *dp)
+{
+	FTSENT *p;
+
+	for (p = dp->list; p; p = p->fts_link) {
+		if (IS_NOPRINT(p))
+			continue;
+		if (f_record == REC_JSON)
+			printjson(p);
+		else
+			printbinary(p);
+	}
+}
+
+#define	JSONFIELD(name, v)	(out_str(",\"" name "\":"), out_int(v))
+
+static void
+printjson(FTSENT *p)
+{
+	struct stat *sp;
+	char path[MAXPATHLEN + 1], link[MAXPATHLEN + 1];
+	size_t len;
+	int lnklen;
+
+	sp = p->fts_statp;
+	len = recordpath(p, path, sizeof(path));
+	(void)out_str("{\"path\":");
+	printjsonstr(path, len);
+	(void)out_str(",\"name\":");
+	printjsonstr(p->fts_name, p->fts_namelen);
+	JSONFIELD("dev", (int64_t)sp->st_dev);
+	JSONFIELD("ino", (int64_t)sp->st_ino);
+	JSONFIELD("mode", sp->st_mode);
+	JSONFIELD("nlink", (int64_t)sp->st_nlink);
+	JSONFIELD("uid", sp->st_uid);
+	JSONFIELD("gid", sp->st_gid);
+	JSONFIELD("rdev", (int64_t)sp->st_rdev);
+	JSONFIELD("size", sp->st_size);
+	JSONFIELD("blocks", sp->st_blocks);
+	JSONFIELD("atime", sp->st_atime);
+	JSONFIELD("atime_nsec", ATIMENSEC(sp));
+	JSONFIELD("mtime", sp->st_mtime);
+	JSONFIELD("mtime_nsec", MTIMENSEC(sp));
+	JSONFIELD("ctime", sp->st_ctime);
+	JSONFIELD("ctime_nsec", CTIMENSEC(sp));
+	if (S_ISLNK(sp->st_mode) &&
+	    (lnklen = readlink(path, link, sizeof(link) - 1)) != -1) {
+		(void)out_str(",\"link\":");
+		printjsonstr(link, lnklen);
+	}
+	(void)out_str("}\n");
+}
+
+static void
+printbinary(FTSENT *p)
+{
+	static const char zero[8];
+	struct lsrecord r;
+	char path[MAXPATHLEN + 1];
+	size_t len;
+
+	len = recordpath(p, path, sizeof(path));
+	r.lr_reclen = (sizeof(r) + len + 7) & ~7;
+	r.lr_pathlen = len;
+	recordfill(&r, p->fts_statp);
+	out_write((char *)&r, sizeof(r));
+	out_write(path, len);
+	out_write(zero, r.lr_reclen - sizeof(r) - len);
+}
+
+/*
+ * Write s as a JSON string.  Only what JSON requires is escaped; any
+ * other bytes, valid UTF-8 or not, are copied as they are.
+ */
+static void
+printjsonstr(const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *end, *run;
+	char esc[6];
+
+	out_char('"');
+	for (run = s, end = s + len; s < end; s++) {
+		if (*s != '"' && *s != '\\' && (unsigned char)*s >= 0x20)
+			continue;
+		out_write(run, s - run);
+		run = s + 1;
+		switch (*s) {
+		case '"':
+		case '\\':
+			esc[0] = '\\';
+			esc[1] = *s;
+			out_write(esc, 2);
+			break;
+		case '\n':
+			out_write("\\n", 2);
+			break;
+		case '\t':
+			out_write("\\t", 2);
+			break;
+		default:
+			memcpy(esc, "\\u00", 4);
+			esc[4] = hex[(unsigned char)*s >> 4];
+			esc[5] = hex[*s & 0xf];
+			out_write(esc, 6);
+			break;
+		}
+	}
+	out_write(run, s - run);
+	out_char('"');
+}
+
+/*
+ * Put the path of p in buf, the way fts(3) would build it, and return
+ * its length.  The roots' fts_name holds all of the argument.
+ */
+static size_t
+recordpath(FTSENT *p, char *buf, size_t size)
+{
+	const FTSENT *dir;
+	size_t len;
+
+	if (p->fts_level == FTS_ROOTLEVEL)
+		len = snprintf(buf, size, "%s", p->fts_name);
+	else {
+		dir = p->fts_parent;
+		len = dir->fts_pathlen;
+		if (len > 0 && dir->fts_path[len - 1] == '/')
+			len--;
+		len = snprintf(buf, size, "%.*s/%s", (int)len, dir->fts_path,
+		    p->fts_name);
+	}
+	return (len < size ? len : size - 1);
 }
 
 /*
@@ -499,81 +699,108 @@ printaname(FTSENT *p, int inodefield, int sizefield)
 
 	sp = p->fts_statp;
 	chcnt = 0;
-	if (f_inode)
-		chcnt += printf("%*lu ", inodefield, (unsigned long)sp->st_ino);
+	if (f_inode) {
+		chcnt += out_uint(sp->st_ino, inodefield);
+		out_char(' ');
+		chcnt++;
+	}
 	if (f_size) {
 		if (f_humanize) {
 			if ((humanize_number(szbuf, sizeof(szbuf), sp->st_size,
 			    "", HN_AUTOSCALE,
 			    (HN_DECIMAL | HN_B | HN_NOSPACE))) == -1)
 				err(1, "humanize_number");
-			chcnt += printf("%*s ", sizefield, szbuf);
+			chcnt += out_pad(szbuf, sizefield, 0);
 		} else {
-			chcnt += printf("%*llu ", sizefield,
-			    (long long)howmany(sp->st_blocks, blocksize));
+			chcnt += out_uint(howmany(sp->st_blocks, blocksize),
+			    sizefield);
 		}
+		out_char(' ');
+		chcnt++;
 	}
 	if (f_octal || f_octal_escape)
 		chcnt += safe_print(p->fts_name);
 	else if (f_nonprint)
 		chcnt += printescaped(p->fts_name);
-	else
-		chcnt += printf("%s", p->fts_name);
+	else {
+		out_write(p->fts_name, p->fts_namelen);
+		chcnt += p->fts_namelen;
+	}
 	if (f_type || (f_typedir && S_ISDIR(sp->st_mode)))
 		chcnt += printtype(sp->st_mode);
 	return (chcnt);
 }
 
+/*
+ * Print the date the way ls always has, as pieces of ctime(3) output,
+ * but formatted by timefmt(), without the detour through ctime(), when
+ * the year has the usual four digits.
+ */
 static void
 printtime(time_t ftime)
 {
+	char *buf, *longstring;
+	size_t len;
 	int i;
-	char *longstring;
+
+#define	SIXMONTHS	((DAYSPERNYEAR / 2) * SECSPERDAY)
+	if ((buf = out_reserve(TIMEFMT_MAX)) != NULL &&
+	    (len = timefmt(buf, ftime, now, f_sectime)) > 0) {
+		out_commit(len);
+		return;
+	}
 
 	longstring = ctime(&ftime);
 	for (i = 4; i < 11; ++i)
-		(void)putchar(longstring[i]);
+		out_char(longstring[i]);
 
-#define	SIXMONTHS	((DAYSPERNYEAR / 2) * SECSPERDAY)
 	if (f_sectime)
 		for (i = 11; i < 24; i++)
-			(void)putchar(longstring[i]);
+			out_char(longstring[i]);
 	else if (ftime + SIXMONTHS > now)
 		for (i = 11; i < 16; ++i)
-			(void)putchar(longstring[i]);
+			out_char(longstring[i]);
 	else {
-		(void)putchar(' ');
+		out_char(' ');
 		for (i = 20; i < 24; ++i)
-			(void)putchar(longstring[i]);
+			out_char(longstring[i]);
 	}
-	(void)putchar(' ');
+	out_char(' ');
 }
 
 static int
 printtype(u_int mode)
 {
+	int c;
+
+	if ((c = typechar(mode)) == '\0')
+		return (0);
+	out_char(c);
+	return (1);
+}
+
+/*
+ * Return the character -F appends for mode, or NUL if none.
+ */
+static int
+typechar(u_int mode)
+{
+
 	switch (mode & S_IFMT) {
 	case S_IFDIR:
-		(void)putchar('/');
-		return (1);
+		return ('/');
 	case S_IFIFO:
-		(void)putchar('|');
-		return (1);
+		return ('|');
 	case S_IFLNK:
-		(void)putchar('@');
-		return (1);
+		return ('@');
 	case S_IFSOCK:
-		(void)putchar('=');
-		return (1);
+		return ('=');
 	case S_IFWHT:
-		(void)putchar('%');
-		return (1);
-	}
-	if (mode & (S_IXUSR | S_IXGRP | S_IXOTH)) {
-		(void)putchar('*');
-		return (1);
+		return ('%');
 	}
-	return (0);
+	if (mode & (S_IXUSR | S_IXGRP | S_IXOTH))
+		return ('*');
+	return ('\0');
 }
 
 static void
@@ -592,11 +819,11 @@ printlink(FTSENT *p)
 		return;
 	}
 	path[lnklen] = '\0';
-	(void)printf(" -> ");
+	out_write(" -> ", 4);
 	if (f_octal || f_octal_escape)
 		(void)safe_print(path);
 	else if (f_nonprint)
 		(void)printescaped(path);
 	else
-		(void)printf("%s", path);
+		out_write(path, lnklen);
 }
@@ -0,0 +1,423 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * The snapshot index for -z.
+ *
+ * Every directory the walker reads is written to a new index file, with
+ * its own inode, mtime and ctime and the stat information of all of its
+ * entries.  On the next run, the old index is mapped into memory, and a
+ * directory whose mtime and ctime have not changed since then is listed
+ * from it instead of being read and having all its entries stat'ed.
+ *
+ * A directory's times change whenever an entry is added, removed or
+ * renamed, but not when a file in it is written to or has its mode
+ * changed, so the stat information of files in an unchanged directory
+ * can be out of date, as it can be with locate(1).  Subdirectories are
+ * always stat'ed again, since the walker needs their times anyway to
+ * decide whether to trust the index for them.
+ *
+ * The file holds, all in host byte order:
+ *
+ *	a struct snaphdr;
+ *	for each directory, the records of its entries, each a struct
+ *	lsrecord as written by -O binary, but followed by the name of the
+ *	entry rather than its path;
+ *	the paths of the directories, each followed by a NUL;
+ *	the table of directories, a struct snapdir each, sorted by path.
+ *
+ * It is written to a temporary file next to the old one, and renamed
+ * over it once complete, so a run that is interrupted leaves the old
+ * index alone.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ls.h"
+#include "extern.h"
+
+#define SNAP_MAGIC	"LSSNAP1"
+#define SNAP_BYTEORDER	0x01020304
+
+/*
+ * A directory changed less than this many seconds before the index was
+ * started may change again without its times moving on, so it is not
+ * entered into the index.
+ */
+#define SNAP_RECENT	2
+
+#define SNAP_ALIGN(n)	(((n) + 7) & ~(u_int64_t)7)
+
+struct snaphdr {
+	char		sh_magic[8];
+	u_int32_t	sh_byteorder;
+	u_int32_t	sh_options;	/* FTS_LOGICAL and FTS_SEEDOT */
+	u_int64_t	sh_ndirs;
+	u_int64_t	sh_dirs;	/* offset of the directory table */
+	u_int64_t	sh_size;	/* of the whole file */
+};
+
+struct snapdir {
+	u_int64_t	sd_path;	/* offset of the path */
+	u_int64_t	sd_recs;	/* offset of the first record */
+	u_int64_t	sd_len;		/* bytes of records */
+	u_int64_t	sd_nents;
+	u_int64_t	sd_dev;
+	u_int64_t	sd_ino;
+	int64_t		sd_mtime;
+	int64_t		sd_ctime;
+	u_int32_t	sd_mtimensec;
+	u_int32_t	sd_ctimensec;
+};
+
+struct snapshot {
+	/* The index from the last run, if there is a usable one. */
+	char		*map;
+	size_t		 mapsize;
+	const struct snapdir *dirs;
+	size_t		 ndirs;
+	u_int64_t	 pathend;	/* the paths all end before this */
+
+	/* The index being written. */
+	pthread_mutex_t	 lock;
+	char		*path;
+	char		*tmppath;
+	FILE		*fp;
+	int		 options;
+	time_t		 start;
+	u_int64_t	 off;		/* bytes written so far */
+	struct snapdir	*newdirs;	/* sd_path indexes paths */
+	size_t		 nnew;
+	size_t		 maxnew;
+	char		*paths;
+	size_t		 pathlen;
+	size_t		 maxpath;
+	int		 error;		/* errno of a failed write, if any */
+	u_long		 served;
+	u_long		 read;
+};
+
+static const char *sortpaths;		/* for snapdircmp() */
+
+static int	snapdircmp(const void *, const void *);
+static void	snapshot_map(SNAPSHOT *, const char *);
+static void	snapshot_write(SNAPSHOT *, const void *, size_t);
+
+/*
+ * Open the index in path from the last run, if there is one that was
+ * written with the same options, and start on the new one.
+ */
+SNAPSHOT *
+snapshot_open(const char *path, int options)
+{
+	SNAPSHOT *sp;
+	struct snaphdr hdr;
+	size_t len;
+	int fd;
+
+	len = strlen(path);
+	if ((sp = calloc(1, sizeof(SNAPSHOT))) == NULL ||
+	    (sp->path = strdup(path)) == NULL ||
+	    (sp->tmppath = malloc(len + sizeof(".XXXXXX"))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	memcpy(sp->tmppath, path, len);
+	memcpy(sp->tmppath + len, ".XXXXXX", sizeof(".XXXXXX"));
+	pthread_mutex_init(&sp->lock, NULL);
+	sp->options = options & (FTS_LOGICAL | FTS_SEEDOT);
+	sp->start = time(NULL);
+	snapshot_map(sp, path);
+
+	if ((fd = mkstemp(sp->tmppath)) == -1 ||
+	    (sp->fp = fdopen(fd, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", sp->tmppath);
+	/* The header is filled in at the end. */
+	memset(&hdr, 0, sizeof(hdr));
+	snapshot_write(sp, &hdr, sizeof(hdr));
+	return (sp);
+}
+
+/*
+ * Return the records of directory path from the last run, if its stat
+ * information st shows that it has not changed since, and set *nentsp
+ * to their number.  Otherwise, return NULL.
+ */
+const struct lsrecord *
+snapshot_find(SNAPSHOT *sp, const char *path, const struct stat *st,
+    size_t *nentsp)
+{
+	const struct snapdir *sd;
+	const struct lsrecord *r;
+	size_t lo, hi, mid, n;
+	u_int64_t off, end;
+	int cmp;
+
+	sd = NULL;
+	lo = 0;
+	hi = sp->ndirs;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (sp->dirs[mid].sd_path >= sp->pathend)
+			return (NULL);
+		cmp = strcmp(path, sp->map + sp->dirs[mid].sd_path);
+		if (cmp == 0) {
+			sd = &sp->dirs[mid];
+			break;
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	if (sd == NULL || sd->sd_dev != (u_int64_t)st->st_dev ||
+	    sd->sd_ino != (u_int64_t)st->st_ino ||
+	    sd->sd_mtime != st->st_mtime ||
+	    sd->sd_mtimensec != (u_int32_t)MTIMENSEC(st) ||
+	    sd->sd_ctime != st->st_ctime ||
+	    sd->sd_ctimensec != (u_int32_t)CTIMENSEC(st))
+		return (NULL);
+
+	/* Don't trust the file any further than we have to. */
+	if (sd->sd_recs % 8 != 0 || sd->sd_recs > sp->mapsize ||
+	    sd->sd_len > sp->mapsize - sd->sd_recs)
+		return (NULL);
+	end = sd->sd_recs + sd->sd_len;
+	for (n = 0, off = sd->sd_recs; off < end; n++) {
+		if (end - off < sizeof(*r))
+			return (NULL);
+		r = (const struct lsrecord *)(sp->map + off);
+		if (r->lr_reclen % 8 != 0 || r->lr_reclen < sizeof(*r) ||
+		    r->lr_reclen > end - off ||
+		    r->lr_pathlen > r->lr_reclen - sizeof(*r) ||
+		    r->lr_pathlen == 0)
+			return (NULL);
+		off += r->lr_reclen;
+	}
+	if (n != sd->sd_nents)
+		return (NULL);
+
+	*nentsp = n;
+	return ((const struct lsrecord *)(sp->map + sd->sd_recs));
+}
+
+/*
+ * Enter directory path, whose stat information is st, with the entries
+ * in list into the new index.  Served says whether the entries came
+ * from the old one.
+ */
+void
+snapshot_add(SNAPSHOT *sp, const char *path, const struct stat *st,
+    FTSENT *list, int served)
+{
+	static const char zero[8];
+	struct snapdir *sd;
+	struct lsrecord r;
+	FTSENT *p;
+	size_t len;
+
+	pthread_mutex_lock(&sp->lock);
+	if (served)
+		sp->served++;
+	else
+		sp->read++;
+
+	if (st->st_ctime > sp->start - SNAP_RECENT)
+		goto out;
+	for (p = list; p != NULL; p = p->fts_link)
+		if (p->fts_info == FTS_NS || p->fts_info == FTS_NSOK)
+			goto out;
+
+	if (sp->nnew == sp->maxnew) {
+		sp->maxnew = sp->maxnew ? sp->maxnew * 2 : 1024;
+		if ((sp->newdirs = realloc(sp->newdirs,
+		    sp->maxnew * sizeof(*sp->newdirs))) == NULL)
+			err(EXIT_FAILURE, NULL);
+	}
+	len = strlen(path) + 1;
+	while (sp->maxpath - sp->pathlen < len) {
+		sp->maxpath = sp->maxpath ? sp->maxpath * 2 : 64 * 1024;
+		if ((sp->paths = realloc(sp->paths, sp->maxpath)) == NULL)
+			err(EXIT_FAILURE, NULL);
+	}
+
+	sd = &sp->newdirs[sp->nnew++];
+	memset(sd, 0, sizeof(*sd));
+	sd->sd_path = sp->pathlen;
+	memcpy(sp->paths + sp->pathlen, path, len);
+	sp->pathlen += len;
+	sd->sd_recs = sp->off;
+	sd->sd_dev = st->st_dev;
+	sd->sd_ino = st->st_ino;
+	sd->sd_mtime = st->st_mtime;
+	sd->sd_mtimensec = MTIMENSEC(st);
+	sd->sd_ctime = st->st_ctime;
+	sd->sd_ctimensec = CTIMENSEC(st);
+
+	for (p = list; p != NULL; p = p->fts_link) {
+		recordfill(&r, p->fts_statp);
+		r.lr_pathlen = p->fts_namelen;
+		r.lr_reclen = SNAP_ALIGN(sizeof(r) + p->fts_namelen);
+		snapshot_write(sp, &r, sizeof(r));
+		snapshot_write(sp, p->fts_name, p->fts_namelen);
+		snapshot_write(sp, zero, r.lr_reclen - sizeof(r) -
+		    p->fts_namelen);
+		sd->sd_nents++;
+	}
+	sd->sd_len = sp->off - sd->sd_recs;
+out:
+	pthread_mutex_unlock(&sp->lock);
+}
+
+/*
+ * Finish the new index and put it in place of the old one.  Returns -1
+ * if that could not be done.
+ */
+int
+snapshot_close(SNAPSHOT *sp)
+{
+	static const char zero[8];
+	struct snaphdr hdr;
+	size_t i, pathoff;
+	int rv, serrno;
+
+	pathoff = sp->off;
+	snapshot_write(sp, sp->paths, sp->pathlen);
+	snapshot_write(sp, zero, SNAP_ALIGN(sp->off) - sp->off);
+
+	sortpaths = sp->paths;
+	if (sp->nnew > 1)
+		qsort(sp->newdirs, sp->nnew, sizeof(*sp->newdirs), snapdircmp);
+	for (i = 0; i < sp->nnew; i++)
+		sp->newdirs[i].sd_path += pathoff;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.sh_magic, SNAP_MAGIC, sizeof(hdr.sh_magic));
+	hdr.sh_byteorder = SNAP_BYTEORDER;
+	hdr.sh_options = sp->options;
+	hdr.sh_ndirs = sp->nnew;
+	hdr.sh_dirs = sp->off;
+	snapshot_write(sp, sp->newdirs, sp->nnew * sizeof(*sp->newdirs));
+	hdr.sh_size = sp->off;
+
+	rv = 0;
+	if (sp->error == 0 && (fseeko(sp->fp, 0, SEEK_SET) == -1 ||
+	    fwrite(&hdr, sizeof(hdr), 1, sp->fp) != 1 ||
+	    fflush(sp->fp) == EOF || fsync(fileno(sp->fp)) == -1))
+		sp->error = errno;
+	if (fclose(sp->fp) == EOF && sp->error == 0)
+		sp->error = errno;
+	if (sp->error == 0 && rename(sp->tmppath, sp->path) == -1)
+		sp->error = errno;
+	if (sp->error != 0) {
+		serrno = sp->error;
+		(void)unlink(sp->tmppath);
+		errno = serrno;
+		rv = -1;
+	}
+
+	if (sp->map != NULL)
+		(void)munmap(sp->map, sp->mapsize);
+	pthread_mutex_destroy(&sp->lock);
+	free(sp->newdirs);
+	free(sp->paths);
+	free(sp->tmppath);
+	free(sp->path);
+	free(sp);
+	return (rv);
+}
+
+void
+snapshot_stats(SNAPSHOT *sp)
+{
+
+	warnx("directories: %lu from the snapshot, %lu read", sp->served,
+	    sp->read);
+}
+
+/*
+ * Map the index in path, if it is there and fit to be used.
+ */
+static void
+snapshot_map(SNAPSHOT *sp, const char *path)
+{
+	const struct snaphdr *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+		if (errno != ENOENT)
+			warn("%s", path);
+		return;
+	}
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_size < (off_t)sizeof(struct snaphdr) ||
+	    (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd,
+	    0)) == MAP_FAILED) {
+		(void)close(fd);
+		return;
+	}
+	(void)close(fd);
+
+	hdr = map;
+	if (memcmp(hdr->sh_magic, SNAP_MAGIC, sizeof(hdr->sh_magic)) != 0 ||
+	    hdr->sh_byteorder != SNAP_BYTEORDER ||
+	    hdr->sh_options != (u_int32_t)sp->options ||
+	    hdr->sh_size != (u_int64_t)st.st_size ||
+	    hdr->sh_dirs % 8 != 0 || hdr->sh_dirs > hdr->sh_size ||
+	    hdr->sh_ndirs > (hdr->sh_size - hdr->sh_dirs) /
+	    sizeof(struct snapdir) ||
+	    (hdr->sh_ndirs > 0 &&
+	    ((char *)map)[hdr->sh_dirs - 1] != '\0')) {
+		(void)munmap(map, st.st_size);
+		return;
+	}
+	sp->map = map;
+	sp->mapsize = st.st_size;
+	sp->dirs = (const struct snapdir *)(sp->map + hdr->sh_dirs);
+	sp->ndirs = hdr->sh_ndirs;
+	sp->pathend = hdr->sh_dirs;
+}
+
+static void
+snapshot_write(SNAPSHOT *sp, const void *buf, size_t len)
+{
+
+	if (len == 0 || sp->error)
+		return;
+	if (fwrite(buf, len, 1, sp->fp) != 1)
+		sp->error = errno;
+	sp->off += len;
+}
+
+static int
+snapdircmp(const void *a, const void *b)
+{
+
+	return (strcmp(sortpaths + ((const struct snapdir *)a)->sd_path,
+	    sortpaths + ((const struct snapdir *)b)->sd_path));
+}
@@ -0,0 +1,132 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * A micro-benchmark for the time column of 'ls -l': formats the same
+ * synthetic modification times once with a call to localtime(3) for
+ * each, as ls used to, and once with the cache in timefmt.c, makes sure
+ * both come out the same, and prints how long each took.
+ *
+ * The times are spread over the two years before now, in clusters the
+ * way files tend to be changed: a number of files within minutes of each
+ * other, then a jump to some other day.
+ *
+ * Usage: timebench [-T] [-n count]
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <fts.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ls.h"
+#include "extern.h"
+
+#define DEFAULT_COUNT	1000000
+#define SPREAD		(2 * 365 * 24 * 60 * 60)
+
+static double	elapsed(struct timespec *);
+
+int
+main(int argc, char **argv)
+{
+	struct timespec start;
+	char buf[TIMEFMT_MAX], old[TIMEFMT_MAX];
+	time_t *times, now, t;
+	double cached, uncached;
+	size_t len, sum;
+	long count, i;
+	int ch, sectime;
+
+	count = DEFAULT_COUNT;
+	sectime = 0;
+	while ((ch = getopt(argc, argv, "Tn:")) != -1) {
+		switch (ch) {
+		case 'T':
+			sectime = 1;
+			break;
+		case 'n':
+			if ((count = strtol(optarg, NULL, 10)) <= 0)
+				errx(EXIT_FAILURE, "invalid count: %s", optarg);
+			break;
+		default:
+			(void)fprintf(stderr,
+			    "usage: timebench [-T] [-n count]\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if ((times = malloc(count * sizeof(time_t))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	now = time(NULL);
+	srandom(1);
+	t = now;
+	for (i = 0; i < count; i++) {
+		if (random() % 64 == 0)
+			t = now - random() % SPREAD;
+		else
+			t += random() % 120;
+		times[i] = t;
+	}
+
+	/* Once to fault everything in and load the time zone. */
+	for (i = 0; i < count && i < 1000; i++)
+		(void)timefmt_uncached(buf, times[i], now, sectime);
+
+	sum = 0;
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++)
+		sum += timefmt_uncached(buf, times[i], now, sectime);
+	uncached = elapsed(&start);
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++)
+		sum -= timefmt(buf, times[i], now, sectime);
+	cached = elapsed(&start);
+	if (sum != 0)
+		errx(EXIT_FAILURE, "the two paths wrote different lengths");
+
+	for (i = 0; i < count; i++) {
+		len = timefmt_uncached(old, times[i], now, sectime);
+		if (timefmt(buf, times[i], now, sectime) != len ||
+		    memcmp(buf, old, len) != 0)
+			errx(EXIT_FAILURE, "mismatch for %lld: '%.*s' vs '%.*s'",
+			    (long long)times[i], (int)len, old, (int)len, buf);
+	}
+
+	(void)printf("%ld times%s\n", count, sectime ? " (-T)" : "");
+	(void)printf("localtime: %8.3f s  %6.1f ns/time\n", uncached,
+	    uncached * 1e9 / count);
+	(void)printf("cached:    %8.3f s  %6.1f ns/time\n", cached,
+	    cached * 1e9 / count);
+	timefmt_stats();
+	free(times);
+	return (EXIT_SUCCESS);
+}
+
+static double
+elapsed(struct timespec *start)
+{
+	struct timespec end;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &end);
+	return ((end.tv_sec - start->tv_sec) +
+	    (end.tv_nsec - start->tv_nsec) / 1e9);
+}
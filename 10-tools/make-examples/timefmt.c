@@ -0,0 +1,204 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * Formatting of the time column of the long format.
+ *
+ * Converting every time with localtime(3) means a trip through the time
+ * zone rules for each entry, although the files in a directory were
+ * usually changed on only a handful of days.  So instead, the date part
+ * ("Mon dd " and the year) is kept for each local day seen, along with
+ * the span of seconds that day covers, and the time of day is worked out
+ * from the distance to its start.  That only holds if the day has no
+ * change of UTC offset in it; for the few days that do, the span is an
+ * hour instead, or failing that a minute, and if even that does not hold,
+ * the time is converted with localtime(3) as before.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <fts.h>
+#include <string.h>
+#include <time.h>
+#include <tzfile.h>
+
+#include "ls.h"
+#include "extern.h"
+
+#define TIMECACHE_SIZE	256	/* must be a power of two */
+
+#define	SIXMONTHS	((DAYSPERNYEAR / 2) * SECSPERDAY)
+#define	TWODIGITS(p, v)	((p)[0] = '0' + (v) / 10, (p)[1] = '0' + (v) % 10)
+
+struct tspan {
+	time_t		lo;		/* first second of the span */
+	time_t		hi;		/* first second after it */
+	int		sod;		/* local second of the day at lo */
+	int		year;
+	char		date[7];	/* "Mon dd " */
+};
+
+static struct tspan	timecache[TIMECACHE_SIZE];
+static u_long		hits, misses;
+
+static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+static void	timefmt_date(char *, int, int);
+static size_t	timefmt_fill(char *, int, int, int, int, time_t, time_t,
+		    int);
+static int	timefmt_span(struct tspan *, time_t, const struct tm *, int);
+
+/*
+ * Format t for the long format into buf, which must have room for
+ * TIMEFMT_MAX bytes, the way ls always has: "Mon dd hh:mm " for times in
+ * the six months before now, "Mon dd  yyyy " for others, and with -T
+ * (sectime), "Mon dd hh:mm:ss yyyy ".  Returns the length, or 0 if the
+ * year does not have four digits.
+ */
+size_t
+timefmt(char *buf, time_t t, time_t now, int sectime)
+{
+	struct tspan *ts;
+	struct tm tm;
+	int secs;
+
+	ts = &timecache[(u_int64_t)(t / SECSPERDAY) & (TIMECACHE_SIZE - 1)];
+	if (t >= ts->lo && t < ts->hi) {
+		hits++;
+		memcpy(buf, ts->date, sizeof(ts->date));
+		secs = ts->sod + (int)(t - ts->lo);
+		return (7 + timefmt_fill(buf + 7, secs / SECSPERHOUR,
+		    secs / SECSPERMIN % MINSPERHOUR, secs % SECSPERMIN,
+		    ts->year, t, now, sectime));
+	}
+	misses++;
+
+	if (localtime_r(&t, &tm) == NULL ||
+	    tm.tm_year + 1900 < 1000 || tm.tm_year + 1900 > 9999)
+		return (0);
+	if (timefmt_span(ts, t, &tm, SECSPERDAY) == -1 &&
+	    timefmt_span(ts, t, &tm, SECSPERHOUR) == -1 &&
+	    timefmt_span(ts, t, &tm, SECSPERMIN) == -1)
+		ts->lo = ts->hi = 0;
+	timefmt_date(buf, tm.tm_mon, tm.tm_mday);
+	return (7 + timefmt_fill(buf + 7, tm.tm_hour, tm.tm_min, tm.tm_sec,
+	    tm.tm_year + 1900, t, now, sectime));
+}
+
+/*
+ * Format t with a call to localtime(3) each time, without the cache.
+ */
+size_t
+timefmt_uncached(char *buf, time_t t, time_t now, int sectime)
+{
+	struct tm *tm;
+
+	if ((tm = localtime(&t)) == NULL ||
+	    tm->tm_year + 1900 < 1000 || tm->tm_year + 1900 > 9999)
+		return (0);
+	timefmt_date(buf, tm->tm_mon, tm->tm_mday);
+	return (7 + timefmt_fill(buf + 7, tm->tm_hour, tm->tm_min, tm->tm_sec,
+	    tm->tm_year + 1900, t, now, sectime));
+}
+
+void
+timefmt_stats(void)
+{
+
+	warnx("times: %lu hits, %lu misses", hits, misses);
+}
+
+/*
+ * Write "Mon dd " to p.
+ */
+static void
+timefmt_date(char *p, int mon, int mday)
+{
+
+	memcpy(p, &months[mon * 3], 3);
+	p[3] = ' ';
+	p[4] = mday < 10 ? ' ' : '0' + mday / 10;
+	p[5] = '0' + mday % 10;
+	p[6] = ' ';
+}
+
+/*
+ * Write what follows the date: the time of day, the year or both.
+ */
+static size_t
+timefmt_fill(char *buf, int hour, int min, int sec, int year, time_t t,
+    time_t now, int sectime)
+{
+	char *p;
+	int i, recent;
+
+	p = buf;
+	recent = t + SIXMONTHS > now;
+	if (sectime || recent) {
+		TWODIGITS(p, hour);
+		p[2] = ':';
+		TWODIGITS(p + 3, min);
+		p += 5;
+	}
+	if (sectime) {
+		p[0] = ':';
+		TWODIGITS(p + 1, sec);
+		p += 3;
+	}
+	if (sectime || !recent) {
+		*p++ = ' ';
+		for (i = 3; i >= 0; i--, year /= 10)
+			p[i] = '0' + year % 10;
+		p += 4;
+	}
+	*p++ = ' ';
+	return (p - buf);
+}
+
+/*
+ * Make ts the local span of len seconds (a day, an hour or a minute)
+ * that t, whose local time is tm, falls in.  Both ends are converted to
+ * make sure the clock runs straight through it; if it does not, -1 is
+ * returned.
+ */
+static int
+timefmt_span(struct tspan *ts, time_t t, const struct tm *tm, int len)
+{
+	struct tm end;
+	time_t lo;
+	int sod;
+
+	sod = tm->tm_hour * SECSPERHOUR + tm->tm_min * SECSPERMIN +
+	    tm->tm_sec;
+	lo = t - sod % len;
+	sod -= sod % len;
+	if (localtime_r(&lo, &end) == NULL || end.tm_mday != tm->tm_mday ||
+	    end.tm_hour * SECSPERHOUR + end.tm_min * SECSPERMIN +
+	    end.tm_sec != sod)
+		return (-1);
+	lo += len - 1;
+	if (localtime_r(&lo, &end) == NULL || end.tm_mday != tm->tm_mday ||
+	    end.tm_hour * SECSPERHOUR + end.tm_min * SECSPERMIN +
+	    end.tm_sec != sod + len - 1)
+		return (-1);
+
+	ts->lo = lo - (len - 1);
+	ts->hi = lo + 1;
+	ts->sod = sod;
+	ts->year = tm->tm_year + 1900;
+	timefmt_date(ts->date, tm->tm_mon, tm->tm_mday);
+	return (0);
+}
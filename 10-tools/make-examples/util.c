@@ -52,58 +52,208 @@ __RCSID("$NetBSD: util.c,v 1.27 2003/09/22 02:43:20 jschauma Exp $");
 #include <stdlib.h>
 #include <string.h>
 #include <vis.h>
+#include <wchar.h>
 
 #include "ls.h"
 #include "extern.h"
 
+static int	visflags(void);
+
+/*
+ * Print src with strvis(3), straight into the output buffer when there
+ * is room for the worst case.
+ */
 int
 safe_print(const char *src)
 {
-	size_t len;
+	size_t len, clean;
 	char *name;
 	int flags;
 
-	flags = VIS_NL | VIS_OCTAL;
-	if (f_octal_escape)
-		flags |= VIS_CSTYLE;
-
+	flags = visflags();
 	len = strlen(src);
 	if (len != 0 && SIZE_T_MAX/len <= 4) {
 		errx(EXIT_FAILURE, "%s: name too long", src);
 		/* NOTREACHED */
 	}
 
+	/* Copy what strvis() would leave alone, and encode the rest. */
+	if ((clean = namescan(src, len, 1)) != 0) {
+		out_write(src, clean);
+		if (clean == len)
+			return len;
+		src += clean;
+		len -= clean;
+	}
+
+	if ((name = out_reserve(4*len+1)) != NULL) {
+		len = strvis(name, src, flags);
+		out_commit(len);
+		return clean + len;
+	}
 	name = (char *)malloc(4*len+1);
 	if (name != NULL) {
 		len = strvis(name, src, flags);
-		printf("%s", name);
+		out_write(name, len);
 		free(name);
-		return len;
+		return clean + len;
 	} else
 		errx(EXIT_FAILURE, "out of memory!");
 		/* NOTREACHED */
 }
 
+static int
+visflags(void)
+{
+	int flags;
+
+	flags = VIS_NL | VIS_OCTAL;
+	if (f_octal_escape)
+		flags |= VIS_CSTYLE;
+	return (flags);
+}
+
 int
 printescaped(const char *src)
 {
 	unsigned char c;
+	size_t len, clean;
+	char *buf;
 	int n;
 
-	for (n = 0; (c = *src) != '\0'; ++src, ++n)
-		if (isprint(c))
-			(void)putchar(c);
-		else
-			(void)putchar('?');
+	len = strlen(src);
+	if ((clean = namescan(src, len, 0)) == len) {
+		out_write(src, len);
+		return len;
+	}
+	n = clean;
+	if ((buf = out_reserve(len)) == NULL) {
+		out_write(src, n);
+		for (src += n; (c = *src) != '\0'; ++src, ++n)
+			out_char(isprint(c) ? c : '?');
+		return n;
+	}
+	(void)memcpy(buf, src, n);
+	for (src += n; (c = *src) != '\0'; ++src, ++n)
+		buf[n] = isprint(c) ? c : '?';
+	out_commit(n);
 	return n;
 }
 
+/*
+ * Return the number of columns the name in src, of len bytes, takes up
+ * when printaname() prints it: the length of what safe_print() or
+ * printescaped() make of it, or else its width on the terminal.  The
+ * widths of the characters of the Basic Multilingual Plane are looked
+ * up with wcwidth(3) only once.
+ */
+int
+namewidth(const char *src, size_t len)
+{
+	static signed char wcache[0x10000];	/* width + 2, or 0 */
+	mbstate_t mbs;
+	wchar_t wc;
+	char buf[4*NAME_MAX+1], *name;
+	size_t clean, n;
+	int w, width;
+
+	clean = namescan(src, len, f_octal || f_octal_escape);
+	if (clean == len)
+		return (len);
+
+	if (f_octal || f_octal_escape) {
+		if (len - clean <= NAME_MAX)
+			name = buf;
+		else if ((name = malloc(4*(len-clean)+1)) == NULL)
+			err(EXIT_FAILURE, NULL);
+		width = clean + strvis(name, src + clean, visflags());
+		if (name != buf)
+			free(name);
+		return (width);
+	}
+	if (f_nonprint)
+		return (len);
+
+	width = clean;
+	memset(&mbs, 0, sizeof(mbs));
+	for (src += clean, len -= clean; len > 0; src += n, len -= n) {
+		n = mbrtowc(&wc, src, len, &mbs);
+		if (n == (size_t)-1 || n == (size_t)-2) {
+			/* Not a character; the terminal shows each byte. */
+			memset(&mbs, 0, sizeof(mbs));
+			n = 1;
+			width++;
+			continue;
+		}
+		if (n == 0)
+			break;
+		if ((u_int32_t)wc < sizeof(wcache)) {
+			if (wcache[wc] == 0)
+				wcache[wc] = wcwidth(wc) + 2;
+			w = wcache[wc] - 2;
+		} else
+			w = wcwidth(wc);
+		if (w > 0)
+			width += w;
+	}
+	return (width);
+}
+
+/*
+ * Copy the stat information in sp to the record r and back.  The length
+ * fields of r are left alone.
+ */
+void
+recordfill(struct lsrecord *r, const struct stat *sp)
+{
+
+	r->lr_dev = sp->st_dev;
+	r->lr_ino = sp->st_ino;
+	r->lr_rdev = sp->st_rdev;
+	r->lr_nlink = sp->st_nlink;
+	r->lr_mode = sp->st_mode;
+	r->lr_uid = sp->st_uid;
+	r->lr_gid = sp->st_gid;
+	r->lr_atimensec = ATIMENSEC(sp);
+	r->lr_mtimensec = MTIMENSEC(sp);
+	r->lr_ctimensec = CTIMENSEC(sp);
+	r->lr_size = sp->st_size;
+	r->lr_blocks = sp->st_blocks;
+	r->lr_atime = sp->st_atime;
+	r->lr_mtime = sp->st_mtime;
+	r->lr_ctime = sp->st_ctime;
+}
+
+void
+recordstat(const struct lsrecord *r, struct stat *sp)
+{
+
+	memset(sp, 0, sizeof(struct stat));
+	sp->st_dev = r->lr_dev;
+	sp->st_ino = r->lr_ino;
+	sp->st_rdev = r->lr_rdev;
+	sp->st_nlink = r->lr_nlink;
+	sp->st_mode = r->lr_mode;
+	sp->st_uid = r->lr_uid;
+	sp->st_gid = r->lr_gid;
+	ATIMENSEC(sp) = r->lr_atimensec;
+	MTIMENSEC(sp) = r->lr_mtimensec;
+	CTIMENSEC(sp) = r->lr_ctimensec;
+	sp->st_size = r->lr_size;
+	sp->st_blocks = r->lr_blocks;
+	sp->st_atime = r->lr_atime;
+	sp->st_mtime = r->lr_mtime;
+	sp->st_ctime = r->lr_ctime;
+}
+
 void
 usage(void)
 {
 
 	(void)fprintf(stderr,
-	    "usage: ls [-AaBbCcdFfgikLlmnopqRrSsTtuWwx1] [file ...]\n");
+	    "usage: ls [-AaBbCcdFfgikLlmnopqRrSsTtUuWwx1] [-j jobs] "
+	    "[-O format] [-z snapshot]\n"
+	    "          [file ...]\n");
 	exit(EXIT_FAILURE);
 	/* NOTREACHED */
 }
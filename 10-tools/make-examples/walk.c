@@ -0,0 +1,852 @@
+/* This file is part of the sample code and exercises
+ * used by the class "Advanced Programming in the UNIX
+ * Environment" taught by Jan Schaumann
+ * <jschauma@netmeister.org> at Stevens Institute of
+ * Technology.
+ *
+ * This file is in the public domain.
+ *
+ * You don't have to, but if you feel like
+ * acknowledging where you got this code, you may
+ * reference me by name, email address, or point
+ * people to the course website:
+ * https://stevens.netmeister.org/631/
+ */
+
+/*
+ * A parallel stand-in for the fts(3) walk that ls(1) uses for -R.
+ *
+ * The work is split in two: a pool of worker threads reads and stats
+ * directories, while the caller consumes the results through walk_read()
+ * and walk_children(), which behave like fts_read() and fts_children()
+ * and return the directories in exactly the same preorder.
+ *
+ * Each worker owns a deque of directories waiting to be read.  A worker
+ * pushes the subdirectories it finds onto its own deque and pops from the
+ * same end, so it keeps working depth-first, close to where the caller is
+ * going to look next; a worker whose deque runs dry steals from the other
+ * end of somebody else's.  If the caller gets to a directory that nobody
+ * has claimed yet, it reads it itself rather than wait, so a walk with no
+ * worker threads at all is simply a serial walk.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fts.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ls.h"
+#include "extern.h"
+
+/*
+ * How many entries the workers may read ahead of the caller before they
+ * wait for it to catch up.  This bounds memory use on huge trees.
+ */
+#define WALK_AHEAD	(256 * 1024)
+
+/*
+ * A directory's entries are carved out of blocks of this size, which are
+ * all freed together once the caller is done with the listing.
+ */
+#define WBLOCK_SIZE	(64 * 1024)
+
+#define WN_QUEUED	0	/* waiting in a deque */
+#define WN_BUSY		1	/* being read */
+#define WN_READY	2	/* children available */
+
+#define WALK_ALIGN(n)	(((n) + sizeof(long long) - 1) & \
+			    ~(sizeof(long long) - 1))
+
+struct wblock {
+	struct wblock	 *next;
+	size_t		  avail;
+	char		 *cur;
+};
+
+struct wnode {
+	struct wnode	 *parent;
+	struct wnode	**kids;		/* subdirectories, in display order */
+	int		  nkids;
+	int		  refs;		/* caller's visit, deque, live kids */
+	int		  state;
+	int		  dnr;		/* errno of a failed opendir() */
+	size_t		  nents;	/* entries in list */
+	FTSENT		 *dir;		/* as fts_read() would return it */
+	FTSENT		 *list;		/* as fts_children() would return it */
+	struct wblock	 *blocks;	/* where list lives */
+};
+
+struct wdeque {
+	pthread_mutex_t	  lock;
+	struct wnode	**ring;
+	size_t		  size;		/* always a power of two */
+	size_t		  head;		/* thieves take from here */
+	size_t		  tail;		/* the owner pushes and pops here */
+};
+
+struct wframe {
+	struct wnode	 *node;
+	int		  next;		/* next kid to visit */
+};
+
+struct walk {
+	int		  options;
+	int		  fields;	/* FLD_ bits to stat for */
+	int		  recurse;
+	FTSENT		*(*sort)(FTSENT *, size_t);
+	SNAPSHOT	 *snap;		/* the index for -z, if any */
+
+	int		  njobs;
+	pthread_t	 *threads;
+	struct wdeque	 *deques;	/* one each, plus one for the caller */
+	DIRREAD		**readers;	/* likewise */
+
+	pthread_mutex_t	  lock;		/* protects everything below */
+	pthread_cond_t	  ready;	/* a node became WN_READY */
+	pthread_cond_t	  work;		/* work queued, room freed or done */
+	size_t		  pending;	/* nodes sitting in deques */
+	size_t		  ahead;	/* entries read but not yet consumed */
+	int		  done;
+
+	struct wframe	 *stack;	/* the caller's position in the tree */
+	int		  depth;
+	int		  maxdepth;
+	struct wnode	 *cur;		/* last node returned by walk_read() */
+	struct wnode	  top;		/* parent of the roots */
+};
+
+struct wstart {
+	WALK		 *wp;
+	int		  id;
+};
+
+static void	 dq_init(struct wdeque *);
+static struct wnode *dq_pop(struct wdeque *);
+static void	 dq_push(struct wdeque *, struct wnode *);
+static struct wnode *dq_steal(struct wdeque *);
+static FTSENT	*walk_alloc(const char *, size_t, size_t);
+static void	*walk_balloc(struct wnode *, size_t);
+static void	 walk_claim(WALK *, struct wnode *);
+static FTSENT	*walk_entry(struct wnode *, const char *, size_t, int);
+static void	 walk_free(struct wnode *);
+static int	 walk_info(WALK *, struct wnode *, FTSENT *);
+static struct wnode *walk_node(struct wnode *, FTSENT *, const char *, int);
+static void	 walk_queue(WALK *, struct wnode *, int);
+static void	 walk_readdir(WALK *, struct wnode *, int);
+static void	 walk_release(WALK *, struct wnode *);
+static void	 walk_unref(WALK *, struct wnode *);
+static FTSENT	*walk_snapdir(WALK *, struct wnode *, DIRREAD *,
+		    const struct lsrecord *, size_t);
+static int	 walk_stat(WALK *, struct wnode *, DIRREAD *, FTSENT *);
+static void	*walk_worker(void *);
+
+/*
+ * Only the FLD_ stat fields in fields are filled in for the entries of
+ * the listings, unless options includes FTS_NOSTAT, in which case
+ * they are only stat'ed to find the directories.  If sort is not NULL,
+ * each listing of nents entries is handed to it to be reordered, and
+ * the new head of the list returned.  If snap is not NULL, directories
+ * that have not changed are listed from it, and all that are read are
+ * entered into it.
+ */
+WALK *
+walk_open(FTSENT *roots, int options, int fields,
+    FTSENT *(*sort)(FTSENT *, size_t), int recurse, int njobs,
+    SNAPSHOT *snap)
+{
+	WALK *wp;
+	FTSENT *p;
+	struct wstart *ws;
+	int i;
+
+	if ((wp = calloc(1, sizeof(WALK))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	wp->options = options;
+	wp->fields = options & FTS_NOSTAT ? 0 : fields;
+	wp->recurse = recurse;
+	wp->sort = sort;
+	wp->njobs = njobs;
+	wp->snap = snap;
+	pthread_mutex_init(&wp->lock, NULL);
+	pthread_cond_init(&wp->ready, NULL);
+	pthread_cond_init(&wp->work, NULL);
+
+	/*
+	 * The roots have already been sorted by fts_open(); we only take
+	 * over the directories among them.  Until fts_read() gets to them,
+	 * their fts_path is not filled in, but fts_name holds the whole
+	 * argument.
+	 */
+	for (p = roots; p != NULL; p = p->fts_link)
+		if (p->fts_info == FTS_D)
+			wp->top.nkids++;
+	if (wp->top.nkids && (wp->top.kids =
+	    malloc(wp->top.nkids * sizeof(*wp->top.kids))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	for (i = 0, p = roots; p != NULL; p = p->fts_link)
+		if (p->fts_info == FTS_D)
+			wp->top.kids[i++] =
+			    walk_node(&wp->top, p, p->fts_name,
+			    !(options & FTS_NOSTAT));
+	wp->top.refs = 1;
+	wp->top.state = WN_READY;
+
+	wp->maxdepth = 16;
+	if ((wp->stack = malloc(wp->maxdepth * sizeof(*wp->stack))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	wp->stack[0].node = &wp->top;
+	wp->stack[0].next = 0;
+	wp->depth = 1;
+
+	if ((wp->deques = calloc(njobs + 1, sizeof(*wp->deques))) == NULL ||
+	    (wp->readers = calloc(njobs + 1, sizeof(*wp->readers))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	for (i = 0; i <= njobs; i++) {
+		dq_init(&wp->deques[i]);
+		wp->readers[i] = dirread_alloc();
+	}
+	walk_queue(wp, &wp->top, njobs);
+
+	if (njobs &&
+	    (wp->threads = calloc((size_t)njobs, sizeof(pthread_t))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	for (i = 0; i < njobs; i++) {
+		if ((ws = malloc(sizeof(*ws))) == NULL)
+			err(EXIT_FAILURE, NULL);
+		ws->wp = wp;
+		ws->id = i;
+		if ((errno = pthread_create(&wp->threads[i], NULL,
+		    walk_worker, ws)) != 0)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	return (wp);
+}
+
+/*
+ * Return the next directory in preorder, reading it first if no worker
+ * has got to it yet.  Like fts_read(), a directory that cannot be read
+ * is returned twice: once as FTS_D, with no children, and then as
+ * FTS_DNR.  Directories that would form a cycle are returned as FTS_DC.
+ */
+FTSENT *
+walk_read(WALK *wp)
+{
+	struct wframe *fp;
+	struct wnode *n, *k;
+
+	if ((n = wp->cur) != NULL) {
+		wp->cur = NULL;
+		walk_free(n);
+		pthread_mutex_lock(&wp->lock);
+		wp->ahead -= n->nents;
+		pthread_cond_broadcast(&wp->work);
+		pthread_mutex_unlock(&wp->lock);
+	}
+
+	while (wp->depth > 0) {
+		fp = &wp->stack[wp->depth - 1];
+		n = fp->node;
+		if (n->dnr) {
+			n->dir->fts_info = FTS_DNR;
+			n->dir->fts_errno = n->dnr;
+			n->dnr = 0;
+			return (n->dir);
+		}
+		if (fp->next < n->nkids) {
+			k = n->kids[fp->next++];
+			if (wp->depth == wp->maxdepth) {
+				wp->maxdepth *= 2;
+				if ((wp->stack = realloc(wp->stack,
+				    wp->maxdepth * sizeof(*wp->stack))) == NULL)
+					err(EXIT_FAILURE, NULL);
+			}
+			wp->stack[wp->depth].node = k;
+			wp->stack[wp->depth].next = 0;
+			wp->depth++;
+			if (k->dir->fts_info == FTS_D)
+				walk_claim(wp, k);
+			wp->cur = k;
+			return (k->dir);
+		}
+		wp->depth--;
+		walk_release(wp, n);
+	}
+	return (NULL);
+}
+
+/*
+ * Return the children of the directory last returned by walk_read(),
+ * sorted and linked the way fts_children() would have.  The list is
+ * released by the next call to walk_read().
+ */
+FTSENT *
+walk_children(WALK *wp)
+{
+
+	return (wp->cur != NULL ? wp->cur->list : NULL);
+}
+
+void
+walk_close(WALK *wp)
+{
+	struct wnode *n;
+	int i;
+
+	pthread_mutex_lock(&wp->lock);
+	wp->done = 1;
+	pthread_cond_broadcast(&wp->work);
+	pthread_mutex_unlock(&wp->lock);
+	for (i = 0; i < wp->njobs; i++)
+		(void)pthread_join(wp->threads[i], NULL);
+
+	/* Anything not walked yet is left for exit(3) to clean up. */
+	for (i = 0; i <= wp->njobs; i++) {
+		while ((n = dq_pop(&wp->deques[i])) != NULL)
+			walk_unref(wp, n);
+		free(wp->deques[i].ring);
+		pthread_mutex_destroy(&wp->deques[i].lock);
+		dirread_free(wp->readers[i]);
+	}
+	free(wp->deques);
+	free(wp->readers);
+	free(wp->threads);
+	free(wp->stack);
+	free(wp->top.kids);
+	pthread_cond_destroy(&wp->work);
+	pthread_cond_destroy(&wp->ready);
+	pthread_mutex_destroy(&wp->lock);
+	free(wp);
+}
+
+static void *
+walk_worker(void *arg)
+{
+	struct wstart *ws;
+	struct wnode *n;
+	WALK *wp;
+	int i, id, victim;
+
+	ws = arg;
+	wp = ws->wp;
+	id = ws->id;
+	free(ws);
+
+	for (;;) {
+		if ((n = dq_pop(&wp->deques[id])) == NULL)
+			for (i = 1; i <= wp->njobs; i++) {
+				victim = (id + i) % (wp->njobs + 1);
+				if ((n = dq_steal(&wp->deques[victim])) != NULL)
+					break;
+			}
+
+		pthread_mutex_lock(&wp->lock);
+		if (n == NULL) {
+			if (!wp->done && wp->pending == 0)
+				pthread_cond_wait(&wp->work, &wp->lock);
+			if (wp->done) {
+				pthread_mutex_unlock(&wp->lock);
+				return (NULL);
+			}
+			pthread_mutex_unlock(&wp->lock);
+			continue;
+		}
+		wp->pending--;
+
+		/*
+		 * Don't run too far ahead of the caller.  If it wants this
+		 * node while we wait, it will read it itself.
+		 */
+		while (!wp->done && n->state == WN_QUEUED &&
+		    wp->ahead >= WALK_AHEAD)
+			pthread_cond_wait(&wp->work, &wp->lock);
+		if (n->state != WN_QUEUED) {
+			walk_unref(wp, n);
+			pthread_mutex_unlock(&wp->lock);
+			continue;
+		}
+		n->state = WN_BUSY;
+
+		/* The caller's reference keeps n around until it is read. */
+		walk_unref(wp, n);
+		pthread_mutex_unlock(&wp->lock);
+
+		walk_readdir(wp, n, id);
+	}
+	/* NOTREACHED */
+}
+
+/*
+ * Make sure n has been read: wait for whoever is reading it, or read it
+ * ourselves if it is still sitting in a deque.
+ */
+static void
+walk_claim(WALK *wp, struct wnode *n)
+{
+
+	pthread_mutex_lock(&wp->lock);
+	if (n->state == WN_QUEUED) {
+		n->state = WN_BUSY;
+		pthread_mutex_unlock(&wp->lock);
+		walk_readdir(wp, n, wp->njobs);
+		return;
+	}
+	while (n->state != WN_READY)
+		pthread_cond_wait(&wp->ready, &wp->lock);
+	pthread_mutex_unlock(&wp->lock);
+}
+
+/*
+ * Read and stat the entries of directory n, sort them, and queue its
+ * subdirectories onto deque id.
+ */
+static void
+walk_readdir(WALK *wp, struct wnode *n, int id)
+{
+	DIRREAD *dr;
+	FTSENT *head, *p, **tailp;
+	const struct lsrecord *recs;
+	struct stat dst;
+	const char *name;
+	size_t len, nents;
+	int i, nostat, snap, type;
+
+	dr = wp->readers[id];
+	head = NULL;
+	tailp = &head;
+	nents = 0;
+	nostat = (wp->options & (FTS_NOSTAT | FTS_PHYSICAL)) ==
+	    (FTS_NOSTAT | FTS_PHYSICAL);
+
+	if (dirread_open(dr, n->dir->fts_accpath) == -1) {
+		n->dnr = errno;
+		goto out;
+	}
+
+	/*
+	 * With a snapshot, look up the directory as it is now; if it has
+	 * not changed, its entries are listed from the snapshot.
+	 */
+	recs = NULL;
+	snap = wp->snap != NULL && dirread_fstat(dr, &dst) == 0;
+	if (snap && (recs = snapshot_find(wp->snap, n->dir->fts_path, &dst,
+	    &nents)) != NULL) {
+		head = walk_snapdir(wp, n, dr, recs, nents);
+		goto listed;
+	}
+
+	/*
+	 * Collect all the names first, then stat them in one go, so that
+	 * reading the directory is not interleaved with the stat calls.
+	 */
+	while ((name = dirread_next(dr, &len, &type)) != NULL) {
+		if (ISDOT(name) && !(wp->options & FTS_SEEDOT))
+			continue;
+#ifdef DT_DIR
+		/*
+		 * Like fts(3), only stat what might be a directory when
+		 * nobody asked for stat information and we are not
+		 * following symbolic links.
+		 */
+		if (nostat && type != DT_DIR && type != DT_UNKNOWN) {
+			p = walk_entry(n, name, len, 0);
+			p->fts_info = FTS_NSOK;
+		} else
+#endif
+		{
+			/*
+			 * If the type is all that is printed, it is
+			 * enough to go by, except for the directories we
+			 * descend into, whose inode and device are needed.
+			 */
+			p = walk_entry(n, name, len, 1);
+			if (!(wp->recurse && type == DT_DIR) &&
+			    dirread_type(type, wp->options & FTS_LOGICAL,
+			    wp->fields, p->fts_statp) == 0)
+				p->fts_info = walk_info(wp, n, p);
+		}
+		*tailp = p;
+		tailp = &p->fts_link;
+		nents++;
+	}
+	/*
+	 * Like one that could not be opened, a directory that could not be
+	 * read to the end is reported as FTS_DNR, after what was read of
+	 * it; a listing that may be short does not go into the snapshot.
+	 */
+	if (errno != 0) {
+		n->dnr = errno;
+		snap = 0;
+	}
+	/* What is still without an fts_info has to be stat'ed. */
+	for (p = head; p != NULL; p = p->fts_link)
+		if (p->fts_info == 0)
+			p->fts_info = walk_stat(wp, n, dr, p);
+listed:
+	if (snap)
+		snapshot_add(wp->snap, n->dir->fts_path, &dst, head,
+		    recs != NULL);
+	dirread_close(dr);
+
+	if (wp->sort != NULL && nents > 1)
+		head = wp->sort(head, nents);
+
+	if (wp->recurse)
+		for (p = head; p != NULL; p = p->fts_link)
+			if (p->fts_info == FTS_D || p->fts_info == FTS_DC)
+				n->nkids++;
+	if (n->nkids) {
+		if ((n->kids = malloc(n->nkids * sizeof(*n->kids))) == NULL)
+			err(EXIT_FAILURE, NULL);
+		for (i = 0, p = head; p != NULL; p = p->fts_link)
+			if (p->fts_info == FTS_D || p->fts_info == FTS_DC)
+				n->kids[i++] = walk_node(n, p, NULL, 1);
+	}
+
+out:
+	n->list = head;
+	n->nents = nents;
+	walk_queue(wp, n, id);
+
+	pthread_mutex_lock(&wp->lock);
+	n->refs += n->nkids;
+	wp->ahead += nents;
+	n->state = WN_READY;
+	pthread_cond_broadcast(&wp->ready);
+	pthread_mutex_unlock(&wp->lock);
+}
+
+/*
+ * Fill in p's stat information the way fts_stat() would, and return
+ * its fts_info.
+ */
+static int
+walk_stat(WALK *wp, struct wnode *n, DIRREAD *dr, FTSENT *p)
+{
+	struct stat *sp;
+	int serrno;
+
+	sp = p->fts_statp;
+	if (wp->options & FTS_LOGICAL) {
+		if (dirread_stat(dr, p->fts_name, 1, wp->fields, sp) == -1) {
+			serrno = errno;
+			if (dirread_stat(dr, p->fts_name, 0, wp->fields,
+			    sp) == 0)
+				return (FTS_SLNONE);
+			p->fts_errno = serrno;
+			goto err;
+		}
+	} else if (dirread_stat(dr, p->fts_name, 0, wp->fields, sp) == -1) {
+		p->fts_errno = errno;
+err:		memset(sp, 0, sizeof(struct stat));
+		return (FTS_NS);
+	}
+	return (walk_info(wp, n, p));
+}
+
+/*
+ * Return the fts_info for p, an entry of n, from its stat information.
+ */
+static int
+walk_info(WALK *wp, struct wnode *n, FTSENT *p)
+{
+	struct stat *sp;
+	struct wnode *t;
+
+	sp = p->fts_statp;
+	if (S_ISDIR(sp->st_mode)) {
+		if (ISDOT(p->fts_name))
+			return (FTS_DOT);
+		for (t = n; t->dir != NULL; t = t->parent)
+			if (sp->st_ino == t->dir->fts_statp->st_ino &&
+			    sp->st_dev == t->dir->fts_statp->st_dev)
+				return (FTS_DC);
+		return (FTS_D);
+	}
+	if (S_ISLNK(sp->st_mode))
+		/* Under FTS_LOGICAL, only a dangling link is lstat'ed. */
+		return (wp->options & FTS_LOGICAL ? FTS_SLNONE : FTS_SL);
+	if (S_ISREG(sp->st_mode))
+		return (FTS_F);
+	return (FTS_DEFAULT);
+}
+
+/*
+ * List directory n, open in dr, from its nents records in the snapshot.
+ * Subdirectories are stat'ed again, to see whether they have changed.
+ */
+static FTSENT *
+walk_snapdir(WALK *wp, struct wnode *n, DIRREAD *dr,
+    const struct lsrecord *r, size_t nents)
+{
+	FTSENT *head, *p, **tailp;
+	size_t i;
+
+	head = NULL;
+	tailp = &head;
+	for (i = 0; i < nents; i++) {
+		p = walk_entry(n, (const char *)(r + 1), r->lr_pathlen, 1);
+		recordstat(r, p->fts_statp);
+		if (S_ISDIR(p->fts_statp->st_mode))
+			p->fts_info = walk_stat(wp, n, dr, p);
+		else
+			p->fts_info = walk_info(wp, n, p);
+		*tailp = p;
+		tailp = &p->fts_link;
+		r = (const struct lsrecord *)((const char *)r + r->lr_reclen);
+	}
+	return (head);
+}
+
+/*
+ * Create a node for directory p, a child of parent.  The node keeps its
+ * own copy of p, since the listing p came from is freed as soon as the
+ * caller is done with it.  If p has no valid stat information, which
+ * is the case for the roots under FTS_NOSTAT, stat it again.
+ */
+static struct wnode *
+walk_node(struct wnode *parent, FTSENT *p, const char *path, int hasstat)
+{
+	struct wnode *n;
+	FTSENT *dir;
+	size_t len, plen;
+
+	if (path == NULL) {
+		/* Like fts(3), don't double up a trailing slash. */
+		plen = parent->dir->fts_pathlen;
+		if (plen > 0 && parent->dir->fts_path[plen - 1] == '/')
+			plen--;
+		len = plen + 1 + p->fts_namelen;
+	} else
+		len = strlen(path);
+
+	if ((n = calloc(1, sizeof(*n))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	dir = walk_alloc(p->fts_name, p->fts_namelen,
+	    sizeof(struct stat) + len + 1);
+	dir->fts_path = (char *)(dir->fts_statp + 1);
+	if (path == NULL) {
+		memcpy(dir->fts_path, parent->dir->fts_path, plen);
+		dir->fts_path[plen] = '/';
+		memcpy(dir->fts_path + plen + 1, p->fts_name,
+		    p->fts_namelen + 1);
+	} else
+		memcpy(dir->fts_path, path, len + 1);
+	dir->fts_pathlen = len;
+	dir->fts_accpath = dir->fts_path;
+	dir->fts_level = p->fts_level;
+	dir->fts_info = p->fts_info;
+
+	if (hasstat)
+		*dir->fts_statp = *p->fts_statp;
+	else if (stat(dir->fts_path, dir->fts_statp) == -1)
+		memset(dir->fts_statp, 0, sizeof(struct stat));
+
+	n->parent = parent;
+	n->dir = dir;
+	n->refs = 1;
+	n->state = p->fts_info == FTS_D ? WN_QUEUED : WN_READY;
+	return (n);
+}
+
+/*
+ * Queue n's unread kids for the workers.  A worker pushes them onto its
+ * own deque last one first, so that it pops them in the order the caller
+ * will want them; the caller's deque is only ever stolen from, so it gets
+ * them first one first.  Each queued node holds a reference until it is
+ * taken off the deque again.
+ */
+static void
+walk_queue(WALK *wp, struct wnode *n, int id)
+{
+	struct wnode *k;
+	int i;
+
+	if (wp->njobs == 0 || n->nkids == 0)
+		return;
+
+	pthread_mutex_lock(&wp->lock);
+	for (i = 0; i < n->nkids; i++) {
+		k = n->kids[id == wp->njobs ? i : n->nkids - 1 - i];
+		if (k->state == WN_QUEUED) {
+			k->refs++;
+			wp->pending++;
+			dq_push(&wp->deques[id], k);
+		}
+	}
+	pthread_cond_broadcast(&wp->work);
+	pthread_mutex_unlock(&wp->lock);
+}
+
+static void
+walk_release(WALK *wp, struct wnode *n)
+{
+
+	pthread_mutex_lock(&wp->lock);
+	walk_unref(wp, n);
+	pthread_mutex_unlock(&wp->lock);
+}
+
+/*
+ * Drop a reference to n, freeing it and any ancestors that are no longer
+ * needed for cycle detection.  Called with wp->lock held.
+ */
+static void
+walk_unref(WALK *wp, struct wnode *n)
+{
+	struct wnode *parent;
+
+	while (n != &wp->top && --n->refs == 0) {
+		parent = n->parent;
+		free(n->kids);
+		free(n->dir);
+		free(n);
+		n = parent;
+	}
+}
+
+/*
+ * Allocate an FTSENT for name with extra bytes of suitably aligned space
+ * after it, which fts_statp points to.
+ */
+static FTSENT *
+walk_alloc(const char *name, size_t namelen, size_t extra)
+{
+	FTSENT *p;
+	size_t len;
+
+	len = WALK_ALIGN(sizeof(FTSENT) + namelen);
+	if ((p = malloc(len + extra)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	memset(p, 0, sizeof(FTSENT));
+	memcpy(p->fts_name, name, namelen);
+	p->fts_name[namelen] = '\0';
+	p->fts_namelen = namelen;
+	p->fts_statp = (struct stat *)((char *)p + len);
+	return (p);
+}
+
+/*
+ * Allocate an entry of directory n for name, with room for its stat
+ * information if hasstat is set.
+ */
+static FTSENT *
+walk_entry(struct wnode *n, const char *name, size_t namelen, int hasstat)
+{
+	FTSENT *p;
+	size_t len;
+
+	len = WALK_ALIGN(sizeof(FTSENT) + namelen);
+	p = walk_balloc(n, len + (hasstat ? sizeof(struct stat) : 0));
+	memset(p, 0, sizeof(FTSENT));
+	memcpy(p->fts_name, name, namelen);
+	p->fts_name[namelen] = '\0';
+	p->fts_namelen = namelen;
+	p->fts_accpath = p->fts_name;
+	p->fts_parent = n->dir;
+	p->fts_level = n->dir->fts_level + 1;
+	if (hasstat)
+		p->fts_statp = (struct stat *)((char *)p + len);
+	return (p);
+}
+
+static void *
+walk_balloc(struct wnode *n, size_t size)
+{
+	struct wblock *bp;
+	size_t bsize;
+	void *mem;
+
+	size = WALK_ALIGN(size);
+	if ((bp = n->blocks) == NULL || bp->avail < size) {
+		bsize = WALK_ALIGN(sizeof(struct wblock)) +
+		    (size > WBLOCK_SIZE ? size : WBLOCK_SIZE);
+		if ((bp = malloc(bsize)) == NULL)
+			err(EXIT_FAILURE, NULL);
+		bp->cur = (char *)bp + WALK_ALIGN(sizeof(struct wblock));
+		bp->avail = bsize - WALK_ALIGN(sizeof(struct wblock));
+		bp->next = n->blocks;
+		n->blocks = bp;
+	}
+	mem = bp->cur;
+	bp->cur += size;
+	bp->avail -= size;
+	return (mem);
+}
+
+/* Free n's listing. */
+static void
+walk_free(struct wnode *n)
+{
+	struct wblock *bp;
+
+	while ((bp = n->blocks) != NULL) {
+		n->blocks = bp->next;
+		free(bp);
+	}
+	n->list = NULL;
+}
+
+static void
+dq_init(struct wdeque *dq)
+{
+
+	pthread_mutex_init(&dq->lock, NULL);
+	dq->ring = NULL;
+	dq->size = dq->head = dq->tail = 0;
+}
+
+static void
+dq_push(struct wdeque *dq, struct wnode *n)
+{
+	struct wnode **ring;
+	size_t i, size;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail - dq->head == dq->size) {
+		size = dq->size ? dq->size * 2 : 64;
+		if ((ring = malloc(size * sizeof(*ring))) == NULL)
+			err(EXIT_FAILURE, NULL);
+		for (i = 0; i < dq->size; i++)
+			ring[i] = dq->ring[(dq->head + i) & (dq->size - 1)];
+		free(dq->ring);
+		dq->ring = ring;
+		dq->tail -= dq->head;
+		dq->head = 0;
+		dq->size = size;
+	}
+	dq->ring[dq->tail++ & (dq->size - 1)] = n;
+	pthread_mutex_unlock(&dq->lock);
+}
+
+static struct wnode *
+dq_pop(struct wdeque *dq)
+{
+	struct wnode *n;
+
+	n = NULL;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail != dq->head)
+		n = dq->ring[--dq->tail & (dq->size - 1)];
+	pthread_mutex_unlock(&dq->lock);
+	return (n);
+}
+
+static struct wnode *
+dq_steal(struct wdeque *dq)
+{
+	struct wnode *n;
+
+	n = NULL;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail != dq->head)
+		n = dq->ring[dq->head++ & (dq->size - 1)];
+	pthread_mutex_unlock(&dq->lock);
+	return (n);
+}
@@ -10,6 +10,8 @@ URIS="/cgi-bin/env.cgi
 /cgi-bin/env.cgi/yes/we/want/path_info
 /cgi-bin/post.cgi
 /cgi-binaajsodijaoisjd
+//cgi-bin/env.cgi
+/./cgi-bin/env.cgi
 /testdir/dir/file
 /testdir/dir
 /testdir/dir/
@@ -24,6 +26,8 @@ URIS="/cgi-bin/env.cgi
 /testdir/notallowed
 no-leading-slash
 /../../../../../../../../../etc/passwd
+/rootlink/
+/rootlink/etc/
 /dir/file/../../dir/file
 /dir/./file
 /~jschauma/